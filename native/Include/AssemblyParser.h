@@ -8,6 +8,8 @@
 
 #include <nanoCLR_Runtime.h>
 
+#include <unordered_map>
+
 typedef LPCSTR LPCUTF8;
 typedef LPSTR LPUTF8;
 
@@ -154,6 +156,7 @@ struct ByteCode
         CLR_INT32 m_stackDiff;
 
         CLR_UINT32 m_references;
+        CLR_UINT32 m_originalIndex;
 
         CLR_UINT32 m_index;
         mdToken m_token;
@@ -198,6 +201,45 @@ struct ByteCode
     typedef Distribution::iterator DistributionIter;
     typedef Distribution::const_iterator DistributionConstIter;
 
+    typedef std::vector<bool> OpcodeMask;
+
+    //
+    // Instruction mix of all the methods compiled so far, collected under -ILstats. The n-grams never span a branch
+    // target, a handler entry or an unconditional transfer, so each one could become a superinstruction.
+    //
+    struct Statistics
+    {
+        typedef std::map<CLR_INT64, size_t> Counter;
+        typedef Counter::iterator CounterIter;
+        typedef Counter::const_iterator CounterConstIter;
+
+        bool m_fEnabled;
+        size_t m_methods;
+
+        Counter m_opcodes;  // opcode
+        Counter m_bigrams;  // opcode << 16 | opcode
+        Counter m_trigrams; // opcode << 32 | opcode << 16 | opcode
+        Counter m_tokens;   // opcode << 8 | table of the token operand
+        Counter m_branches; // signed distance in bytes, from the end of the branch
+        Counter m_locals;   // access << 16 | index of the local variable
+        Counter m_args;     // access << 16 | index of the argument
+
+        Statistics();
+
+        void Add(const ByteCode &bc);
+
+        void Dump(size_t numTop);
+        HRESULT Save(const std::wstring &file);
+    };
+
+    typedef size_t (ByteCode::*PeepholePass)(const OpcodeMask &pinned, OpcodeMask &remove);
+
+    struct PeepholeRule
+    {
+        LPCWSTR m_name;
+        PeepholePass m_pass;
+    };
+
     //--//
 
     std::wstring m_name;
@@ -207,6 +249,7 @@ struct ByteCode
     static Distribution s_numOfOpcodes;
     static Distribution s_numOfEHs;
     static Distribution s_sizeOfMethod;
+    static Statistics s_statistics;
 
     //--//
 
@@ -216,6 +259,9 @@ struct ByteCode
     //--//
 
     HRESULT ConvertTokens(mdTokenMap &lookupIDs);
+    HRESULT Optimize(size_t &numRemoved);
+    HRESULT ComputeLocalInterference(size_t numLocals, OpcodeMask &interference, OpcodeMask &excluded);
+    HRESULT RemapLocals(const std::vector<CLR_UINT32> &remap);
     HRESULT GenerateOldIL(std::vector<BYTE> &code);
 
     CLR_UINT32 MaxStackDepth();
@@ -236,6 +282,19 @@ struct ByteCode
 
     //--//
 
+    static const PeepholeRule c_PeepholeRules[];
+
+    size_t Peephole_BranchChains(const OpcodeMask &pinned, OpcodeMask &remove);
+    size_t Peephole_Unreachable(const OpcodeMask &pinned, OpcodeMask &remove);
+    size_t Peephole_Nop(const OpcodeMask &pinned, OpcodeMask &remove);
+    size_t Peephole_DupPop(const OpcodeMask &pinned, OpcodeMask &remove);
+
+    void ComputePinned(OpcodeMask &pinned);
+    bool IsInSameProtectedRegions(size_t left, size_t right);
+    HRESULT RemoveOpcodes(const OpcodeMask &remove);
+
+    //--//
+
     HRESULT Parse_ByteCode(const MethodDef &md, COR_ILMETHOD_DECODER &il);
 };
 
@@ -467,6 +526,29 @@ struct InterfaceImpl
     InterfaceImpl();
 };
 
+//
+// What parsing a custom attribute needs from its constructor, resolved once per distinct constructor token.
+//
+struct AttributeConstructor
+{
+    enum Kind
+    {
+        AC_Generic,
+        AC_NativeProfiler,
+        AC_GloballySynchronized,
+        AC_FieldNoReflection,
+        AC_PublishInApplicationDirectory,
+    };
+
+    std::wstring m_nameOfAttributeClass;
+    std::vector<CorSerializationType> m_params;
+    Kind m_kind;
+    bool m_fExcluded;
+};
+
+typedef std::unordered_map<mdToken, AttributeConstructor> AttributeConstructorMap;
+typedef AttributeConstructorMap::iterator AttributeConstructorMapIter;
+
 struct CustomAttribute
 {
     struct Reader
@@ -572,7 +654,7 @@ struct CustomAttribute
 
     CustomAttribute(Parser *holder);
 
-    HRESULT Parse();
+    HRESULT Parse(const AttributeConstructor *&ctor);
 };
 
 struct TypeSpec
@@ -705,6 +787,58 @@ typedef ParsedResourceMap::iterator ParsedResourceMapIter;
 
 //--//
 
+//
+// The -excludeClassByName entries, compiled once before minimizing, so checking a type doesn't build its name.
+// Exact names are looked up by the hash of the full name, names ending with '*' are prefixes matched by a trie.
+//
+struct ExcludeFilter
+{
+    static const size_t c_NoNode = (size_t)-1;
+
+    struct TrieNode
+    {
+        std::map<WCHAR, size_t> m_children;
+        bool m_fEnd;
+
+        TrieNode()
+        {
+            m_fEnd = false;
+        }
+    };
+
+    typedef std::vector<TrieNode> TrieNodeVector;
+    typedef std::unordered_multimap<CLR_UINT64, std::wstring> NameMap;
+    typedef NameMap::const_iterator NameMapConstIter;
+
+    struct Match
+    {
+        CLR_UINT64 m_hash;
+        size_t m_node;
+        bool m_fPrefix;
+    };
+
+    //--//
+
+    NameMap m_names;
+    TrieNodeVector m_trie;
+
+    //--//
+
+    void Compile(const CLR_RT_StringSet &set);
+
+    bool IsEmpty() const
+    {
+        return m_names.empty() && m_trie.empty();
+    }
+
+    void Begin(Match &m) const;
+    void Feed(Match &m, LPCWSTR str, size_t len) const;
+
+    static CLR_UINT64 Hash(CLR_UINT64 hash, LPCWSTR str, size_t len);
+};
+
+//--//
+
 class Parser
 {
   public:
@@ -769,6 +903,9 @@ class Parser
     FILE *m_output;
     FILE *m_toclose;
 
+    ExcludeFilter m_filterExcludeClassByName;
+    AttributeConstructorMap m_mapAttributeConstructors;
+
     //--//
 
     HRESULT GetAssemblyDef();
@@ -804,6 +941,9 @@ class Parser
     HRESULT ParseByteCode(MethodDef &db);
 
     HRESULT CanIncludeMember(mdToken tk, mdToken tm);
+    bool IsExcludedByName(mdTypeDef td);
+    void ExcludeFilter_Feed(mdTypeDef td, ExcludeFilter::Match &m);
+    bool ExcludeFilter_Equals(mdTypeDef td, LPCWSTR name, size_t len);
     HRESULT BuildDependencyList(mdToken tk, mdTokenSet &set);
     HRESULT IncludeAttributes(mdToken tk, mdTokenSet &set);
 
@@ -849,7 +989,11 @@ class Parser
     HRESULT CheckTokenPresence(mdToken tk);
     HRESULT CheckTokensPresence(mdTokenSet &set);
 
+    HRESULT ResolveAttributeConstructor(mdToken tk, const AttributeConstructor *&ctor);
+
     void TokenToString(mdToken tk, std::wstring &str);
+    void SigToString(TypeSignature &sig, std::wstring &str, bool fTypeNames);
+    void SigToString(MethodSignature &sig, std::wstring &str, bool fTypeNames);
 };
 
 class Collection
@@ -885,6 +1029,10 @@ class Collection
 
     HRESULT CreateAssembly(Parser *&pr);
     HRESULT CreateDependentAssembly(LPCWSTR szFileName, Parser *&pr);
+    void ReleaseAssembly(Parser *pr);
+    void ReleaseAssembly(const std::wstring &file);
+
+    void GetAssemblyFiles(CLR_RT_StringSet &files);
 
     HRESULT ResolveAssemblyDef(Parser *pr, mdToken tk, Parser *&prDst);
     HRESULT ResolveTypeDef(Parser *pr, mdToken tk, Parser *&prDst, TypeDef *&tdDst);
@@ -10,6 +10,8 @@
 
 #include <nanoCLR_Runtime.h>
 
+#include <unordered_map>
+
 //////////////////////////////////////////////////////
 
 #define REPARSER_TABLE_ENUM_BEGIN(obj, src)                                                                            \
@@ -53,10 +55,72 @@ class Assembly;
 
 //--//--//--//
 
+//
+// 128 bits identity of an element, computed bottom-up over names, signatures and owners.
+// It follows the same equivalence as the display string (a TypeRef and the TypeDef it points to share the key),
+// so lookups never have to render and compare the full text.
+//
+struct StructuralHash
+{
+    CLR_UINT64 m_hi;
+    CLR_UINT64 m_lo;
+
+    StructuralHash()
+    {
+        m_hi = 0;
+        m_lo = 0;
+    }
+
+    void Begin(CLR_UINT32 kind);
+    void Add(CLR_UINT64 val);
+    void Add(LPCSTR val, size_t len);
+    void Add(const StructuralHash &val);
+    void End();
+
+    void Add(const std::string &val)
+    {
+        Add(val.c_str(), val.size());
+    }
+
+    bool IsEmpty() const
+    {
+        return m_hi == 0 && m_lo == 0;
+    }
+
+    bool operator==(const StructuralHash &r) const
+    {
+        return m_hi == r.m_hi && m_lo == r.m_lo;
+    }
+
+    bool operator!=(const StructuralHash &r) const
+    {
+        return !(*this == r);
+    }
+
+    bool operator<(const StructuralHash &r) const
+    {
+        if (m_hi != r.m_hi)
+            return m_hi < r.m_hi;
+
+        return m_lo < r.m_lo;
+    }
+};
+
+struct StructuralHashHasher
+{
+    size_t operator()(const StructuralHash &h) const
+    {
+        return (size_t)(h.m_hi ^ h.m_lo);
+    }
+};
+
+//--//
+
 struct BaseElement
 {
     Assembly *m_holder;
     std::string m_displayString;
+    StructuralHash m_hash;
 
     BaseElement();
 
@@ -69,11 +133,13 @@ struct BaseElement
     //--//
 
     const std::string &GetDisplayString();
+    const StructuralHash &GetHash();
 
     //--//
 
   protected:
     virtual void BuildString() = 0;
+    virtual void BuildHash() = 0;
 };
 
 struct BaseTokenInner : public BaseElement
@@ -209,6 +275,7 @@ struct TypeSignature : public BaseElement
 
   protected:
     virtual void BuildString();
+    virtual void BuildHash();
 };
 
 typedef std::list<TypeSignature> TypeSignatureList;
@@ -240,6 +307,7 @@ struct MethodSignature : public BaseElement
 
   protected:
     virtual void BuildString();
+    virtual void BuildHash();
 };
 
 struct LocalVarSignature : public BaseElement
@@ -258,6 +326,7 @@ struct LocalVarSignature : public BaseElement
 
   protected:
     virtual void BuildString();
+    virtual void BuildHash();
 };
 
 //--//--//--//
@@ -283,6 +352,7 @@ struct AssemblyRef : public BaseToken
 
   protected:
     virtual void BuildString();
+    virtual void BuildHash();
 };
 
 //--//
@@ -310,6 +380,7 @@ struct TypeRef : public BaseToken
 
   protected:
     virtual void BuildString();
+    virtual void BuildHash();
 };
 
 //--//
@@ -337,6 +408,7 @@ struct FieldRef : public BaseToken
 
   protected:
     virtual void BuildString();
+    virtual void BuildHash();
 };
 
 //--//
@@ -364,6 +436,7 @@ struct MethodRef : public BaseToken
 
   protected:
     virtual void BuildString();
+    virtual void BuildHash();
 };
 
 //--//
@@ -406,6 +479,7 @@ struct TypeDef : public BaseToken
 
   protected:
     virtual void BuildString();
+    virtual void BuildHash();
 
   private:
     void ParseMethod(BaseTokenPtrList &lst, CLR_RT_Assembly *assm, CLR_IDX pos);
@@ -443,6 +517,7 @@ struct FieldDef : public BaseToken
 
   protected:
     virtual void BuildString();
+    virtual void BuildHash();
 };
 
 //--//
@@ -502,6 +577,7 @@ struct MethodDef : public BaseToken
 
   protected:
     virtual void BuildString();
+    virtual void BuildHash();
 };
 
 //--//
@@ -615,6 +691,7 @@ struct Attribute : public BaseToken
 
   protected:
     virtual void BuildString();
+    virtual void BuildHash();
 };
 
 //--//
@@ -639,6 +716,7 @@ struct TypeSpec : public BaseToken
 
   protected:
     virtual void BuildString();
+    virtual void BuildHash();
 };
 
 //--//
@@ -665,6 +743,7 @@ struct String : public BaseToken
 
   protected:
     virtual void BuildString();
+    virtual void BuildHash();
 };
 
 //--//
@@ -673,9 +752,13 @@ typedef std::map<mdToken, BaseTokenPtr> TokenToObjectMap;
 typedef TokenToObjectMap::iterator TokenToObjectIter;
 typedef TokenToObjectMap::const_iterator TokenToObjectConstIter;
 
-typedef std::map<std::string, BaseTokenPtr> StringToObjectMap;
-typedef StringToObjectMap::iterator StringToObjectIter;
-typedef StringToObjectMap::const_iterator StringToObjectConstIter;
+typedef std::unordered_map<StructuralHash, BaseTokenPtr, StructuralHashHasher> HashToObjectMap;
+typedef HashToObjectMap::iterator HashToObjectIter;
+typedef HashToObjectMap::const_iterator HashToObjectConstIter;
+
+typedef std::set<StructuralHash> HashSet;
+typedef HashSet::iterator HashSetIter;
+typedef HashSet::const_iterator HashSetConstIter;
 
 typedef std::set<std::string> StringSet;
 typedef StringSet::iterator StringSetIter;
@@ -690,10 +773,10 @@ class Assembly : public AssemblyRef
     std::wstring m_assemblyFile;
 
     TokenToObjectMap m_lookupTokenToObject;
-    StringToObjectMap m_lookupStringToObject;
+    HashToObjectMap m_lookupHashToObject;
 
-    StringToObjectMap m_lookupStringToObjectToCreate;
-    StringToObjectMap m_lookupStringToObjectToPatch;
+    HashToObjectMap m_lookupHashToObjectToCreate;
+    HashToObjectMap m_lookupHashToObjectToPatch;
 
     BaseTokenPtrList m_objectsToProcess;
 
@@ -702,7 +785,18 @@ class Assembly : public AssemblyRef
 
     //--//
 
-    typedef HRESULT (Assembly::*CompareFtn)(Assembly *other, StringSet *equal, StringSet *changed, StringSet *missing);
+    struct CompareJob
+    {
+        BaseToken *m_rec;
+        Assembly *m_other;
+        HashSet *m_equal;
+        HashSet *m_changed;
+        HashSet *m_missing;
+        CLR_UINT32 m_result;
+    };
+
+    typedef std::vector<CompareJob> CompareJobVector;
+    typedef CompareJobVector::iterator CompareJobIter;
 
     //--//
 
@@ -712,6 +806,7 @@ class Assembly : public AssemblyRef
     HRESULT CreateDiff(Assembly *orig, Assembly *patched, bool fForceAssemblyRef);
 
     static void BuildString(std::string &value, LPCSTR szName, const CLR_RECORD_VERSION &ver);
+    static void BuildHash(StructuralHash &value, LPCSTR szName, const CLR_RECORD_VERSION &ver);
 
     static bool CompareToken(Assembly *orig, mdToken tkOrig, Assembly *patched, mdToken tkPatched);
     static bool CompareObject(const BaseTokenPtr &ptrOrig, const BaseTokenPtr &ptrPatched);
@@ -719,6 +814,8 @@ class Assembly : public AssemblyRef
 
     void Dump();
 
+    HRESULT ListPatch(LPCWSTR szFile, size_t &size);
+
     //--//
 
   public:
@@ -739,34 +836,42 @@ class Assembly : public AssemblyRef
 
     //--//
 
-    template <class T> T *FindObject(const std::string &value, const T &selector) const
+    template <class T> T *FindObject(const StructuralHash &value, const T &selector) const
     {
         return FindObject(value).CastTo(selector);
     }
 
-    const BaseTokenPtr &FindObject(const std::string &value) const;
+    const BaseTokenPtr &FindObject(const StructuralHash &value) const;
 
     //--//
 
-    void DumpError(LPCSTR fmt, StringSet &set) const;
+    void DumpError(LPCSTR fmt, HashSet &set) const;
 
     //--//
 
   private:
     struct DiffData
     {
-        StringSet m_setEqual;
-        StringSet m_setChanged;
-        StringSet m_setDeleted;
-        StringSet m_setAdded;
+        HashSet m_setEqual;
+        HashSet m_setChanged;
+        HashSet m_setDeleted;
+        HashSet m_setAdded;
 
-        HRESULT Compute(CompareFtn ftn, Assembly *orig, Assembly *patched);
+        void Queue(CompareJobVector &jobs, CLR_TABLESENUM tbl, Assembly *orig, Assembly *patched);
     };
 
-    HRESULT Compare_TypeDef(Assembly *other, StringSet *equal, StringSet *changed, StringSet *missing);
-    HRESULT Compare_FieldDef(Assembly *other, StringSet *equal, StringSet *changed, StringSet *missing);
-    HRESULT Compare_MethodDef(Assembly *other, StringSet *equal, StringSet *changed, StringSet *missing);
-    HRESULT Compare_Attribute(Assembly *other, StringSet *equal, StringSet *changed, StringSet *missing);
+    void PrepareCompare();
+    void QueueCompare(
+        CompareJobVector &jobs,
+        CLR_TABLESENUM tbl,
+        Assembly *other,
+        HashSet *equal,
+        HashSet *changed,
+        HashSet *missing);
+
+    static CLR_UINT32 CompareRecord(BaseToken *rec, Assembly *other);
+    static void CompareWorker(CompareJobVector &jobs, LONG volatile *next);
+    static void RunCompare(CompareJobVector &jobs);
 
     //--//
 
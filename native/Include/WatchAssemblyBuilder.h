@@ -10,12 +10,119 @@
 
 #include <nanoCLR_Runtime.h>
 
+//
+// Binary side format of the .pdbx file, all the tables are sorted for binary search and can be used straight from a
+// mapped view of the file.
+//
+struct NanoPdbxBinaryHeader
+{
+    static const CLR_UINT32 MAGIC_NUMBER = 0x58424450; // 'PDBX'
+    static const CLR_UINT32 VERSION = 1;
+
+    CLR_UINT32 magicNumber;
+    CLR_UINT32 version;
+    CLR_UINT32 sizeOfHeader;
+
+    CLR_UINT32 assemblyToken_CLR;
+    CLR_UINT32 assemblyToken_nanoCLR;
+    CLR_RECORD_VERSION assemblyVersion;
+
+    CLR_UINT32 numberOfTokens;
+    CLR_UINT32 offsetTokensByCLR;     // NanoPdbxBinaryToken[numberOfTokens], sorted on tokenCLR
+    CLR_UINT32 offsetTokensByNanoCLR; // NanoPdbxBinaryToken[numberOfTokens], sorted on tokenNanoCLR
+
+    CLR_UINT32 numberOfMethods;
+    CLR_UINT32 offsetMethods; // NanoPdbxBinaryMethod[numberOfMethods], sorted on tokenNanoCLR
+
+    CLR_UINT32 numberOfILEntries;
+    CLR_UINT32 offsetILEntries; // NanoPdbxBinaryIL[numberOfILEntries], grouped by method, sorted on offsets
+
+    CLR_UINT32 offsetFileName; // UTF-8, zero terminated
+    CLR_UINT32 lengthFileName;
+};
+
+struct NanoPdbxBinaryToken
+{
+    CLR_UINT32 tokenCLR;
+    CLR_UINT32 tokenNanoCLR;
+};
+
+struct NanoPdbxBinaryMethod
+{
+    static const CLR_UINT32 FLAGS_HasByteCode = 0x00000001;
+
+    CLR_UINT32 tokenCLR;
+    CLR_UINT32 tokenNanoCLR;
+    CLR_UINT32 flags;
+    CLR_UINT32 firstILEntry;
+    CLR_UINT32 numberOfILEntries;
+};
+
+//
+// Same content as the <IL> elements of the .pdbx: each entry marks the point where the distance between the CLR and
+// the nanoCLR offsets changes.
+//
+struct NanoPdbxBinaryIL
+{
+    CLR_UINT32 ipCLR;
+    CLR_UINT32 ipNanoCLR;
+};
+
+//
+// Directory optionally written by -create_database after the zero terminator of a device database. The device stops
+// at the terminator, tools find the directory through the footer closing the file.
+//
+struct NanoDatabaseDirectoryFooter
+{
+    static const CLR_UINT32 MAGIC_NUMBER = 0x52494444; // 'DDIR'
+    static const CLR_UINT32 VERSION = 1;
+
+    CLR_UINT32 numberOfEntries;
+    CLR_UINT32 offsetEntries; // NanoDatabaseDirectoryEntry[numberOfEntries], in database order
+    CLR_UINT32 crcEntries;
+    CLR_UINT32 version;
+    CLR_UINT32 magicNumber;
+};
+
+struct NanoDatabaseDirectoryEntry
+{
+    CLR_UINT32 nameHash; // CRC of the UTF-8 name of the assembly
+    CLR_RECORD_VERSION version;
+    CLR_UINT32 offset;
+    CLR_UINT32 size;
+    CLR_UINT32 assemblyCRC;
+};
+
+//
+// Delta produced by -plan_deployment: the chunks of the new database that differ from the old one, each to be written
+// at its offset in flash. The chunk data follows the table, in the same order.
+//
+struct NanoDatabaseDeltaHeader
+{
+    static const CLR_UINT32 MAGIC_NUMBER = 0x544C4444; // 'DDLT'
+    static const CLR_UINT32 VERSION = 1;
+
+    CLR_UINT32 magicNumber;
+    CLR_UINT32 version;
+    CLR_UINT32 sizeOfImage;
+    CLR_UINT32 crcOfImage;
+    CLR_UINT32 numberOfChunks; // NanoDatabaseDeltaChunk[numberOfChunks]
+};
+
+struct NanoDatabaseDeltaChunk
+{
+    CLR_UINT32 offset;
+    CLR_UINT32 size;
+};
+
 namespace WatchAssemblyBuilder
 {
 LPCWSTR ToHex(CLR_UINT32 u);
 
 void ChangeExtensionOnFileName(std::wstring strFile, std::wstring &strFileNew, const wchar_t *szExt);
 
+bool FindMethodBoundaries(CLR_RT_Assembly *assm, CLR_INDEX i, CLR_OFFSET &start, CLR_OFFSET &end);
+
 template <class T> class CQuickRecord : public CQuickBytesBase
 {
     SIZE_T m_pos;
@@ -123,6 +230,84 @@ template <class T> class CQuickRecord : public CQuickBytesBase
     }
 };
 
+//
+// Forward-only XML writer, elements are written straight to the file through a buffer reused across flushes.
+//
+class XmlWriter
+{
+    static const size_t c_FlushThreshold = 64 * 1024;
+
+    FILE *m_file;
+    CQuickRecord<CHAR> m_buffer;
+    std::vector<LPCSTR> m_elements;
+    bool m_fStartPending;
+    std::string m_tmp;
+
+    HRESULT Append(LPCSTR sz, size_t len);
+    HRESULT Append(LPCSTR sz);
+    HRESULT AppendEscaped(LPCSTR sz, size_t len);
+    HRESULT CloseStartTag();
+    HRESULT Flush();
+
+  public:
+    XmlWriter();
+    ~XmlWriter();
+
+    HRESULT Open(LPCWSTR szFile);
+    HRESULT Close();
+
+    HRESULT StartElement(LPCSTR szTag);
+    HRESULT EndElement();
+
+    HRESULT WriteElement(LPCSTR szTag, LPCSTR szValue);
+    HRESULT WriteElement(LPCSTR szTag, const std::wstring &strValue);
+    HRESULT WriteElement(LPCSTR szTag, CLR_UINT32 value);
+    HRESULT WriteElementHex(LPCSTR szTag, CLR_UINT32 value);
+};
+
+//
+// Flash usage of an assembly, charged byte by byte to the entities that caused it. Each row holds the bytes one
+// entity takes in one table, rows are saved as CSV sorted by size and two reports can be compared row by row.
+//
+class SizeReport
+{
+    struct Key
+    {
+        std::string m_kind;
+        std::string m_entity;
+        std::string m_table;
+
+        bool operator<(const Key &r) const;
+    };
+
+    typedef std::map<Key, CLR_INT64> RowMap;
+    typedef RowMap::iterator RowMapIter;
+
+    RowMap m_rows;
+
+    static bool SortBySize(const RowMapIter &left, const RowMapIter &right);
+    static bool SortByDelta(const RowMapIter &left, const RowMapIter &right);
+    static void WriteField(FILE *stream, const std::string &str);
+    static bool ReadField(LPCSTR &ptr, std::string &str);
+
+  public:
+    static LPCSTR const c_Kind_Assembly;
+    static LPCSTR const c_Kind_Namespace;
+    static LPCSTR const c_Kind_Type;
+    static LPCSTR const c_Kind_Method;
+    static LPCSTR const c_Kind_Reference;
+    static LPCSTR const c_Kind_Resource;
+
+    void Charge(LPCSTR szKind, const std::string &entity, LPCSTR szTable, size_t bytes);
+
+    CLR_INT64 Total();
+
+    HRESULT Save(const std::wstring &file);
+    HRESULT Load(const std::wstring &file);
+
+    static HRESULT Diff(const std::wstring &fileOld, const std::wstring &fileNew, const std::wstring &fileOut);
+};
+
 class Linker
 {
     friend MetaData::CustomAttribute::Writer;
@@ -150,27 +335,30 @@ class Linker
 
     //--//
 
-    class ExceptionHandlerHierarchy
+    struct ByteCodeBody
     {
-        CLR_RECORD_EH *m_data;
-        std::list<ExceptionHandlerHierarchy *> m_children;
-
-        //--//
-
-        ExceptionHandlerHierarchy(const CLR_RECORD_EH &eh);
+        CLR_OFFSET m_RVA;
+        size_t m_length;
+    };
 
-        void Queue(ExceptionHandlerHierarchy *newEhh);
+    //--//
 
-        bool FindMaxCoverage(CLR_OFFSET &start, CLR_OFFSET &end) const;
+    class ExceptionHandlerHierarchy
+    {
+        struct Clause
+        {
+            CLR_RECORD_EH m_eh;
+            size_t m_index;
+        };
 
-      public:
-        ExceptionHandlerHierarchy();
-        ExceptionHandlerHierarchy(ExceptionHandlerHierarchy &ehh);
-        ExceptionHandlerHierarchy &operator=(const ExceptionHandlerHierarchy &ehh);
-        ~ExceptionHandlerHierarchy();
+        std::vector<Clause> m_clauses;
+        std::vector<size_t> m_stack;
 
         //--//
 
+        static bool SortByNesting(const Clause &left, const Clause &right);
+
+      public:
         void Clear();
 
         void Queue(const CLR_RECORD_EH &eh);
@@ -178,6 +366,29 @@ class Linker
         HRESULT GenerateOutput(CQuickRecord<CLR_RECORD_EH> &tbl);
     };
 
+    //
+    // ByteCode of the methods of one type, compiled on a worker thread and merged into m_tableByteCode in type order.
+    //
+    struct MethodByteCode
+    {
+        CLR_RECORD_METHODDEF *m_dst;
+        size_t m_offset;
+        size_t m_length;
+        bool m_fHasEH;
+    };
+
+    struct TypeByteCode
+    {
+        mdTypeDef m_td;
+        HRESULT m_hr;
+        CQuickRecord<BYTE> m_buffer;
+        std::vector<MethodByteCode> m_methods;
+        size_t m_numRemovedOpcodes;
+    };
+
+    typedef std::vector<TypeByteCode *> TypeByteCodeVector;
+    typedef TypeByteCodeVector::iterator TypeByteCodeVectorIter;
+
     friend class CustomAttributeId;
 
     CQuickRecord<CLR_RECORD_ASSEMBLYREF> m_tableAssemblyRef;
@@ -207,6 +418,21 @@ class Linker
     MetaData::mdTokenSet m_setAttributes_Fields;
     MetaData::mdTokenSet m_setAttributes_Methods;
 
+    ByteCodeBody m_previousBody;
+    bool m_fFoldMethods;
+    bool m_fPreviousHasEH;
+    size_t m_numFoldedMethods;
+    size_t m_sizeFoldedMethods;
+
+    bool m_fOptimizeByteCode;
+    size_t m_numRemovedOpcodes;
+
+    bool m_fCompactLocals;
+    size_t m_numRemovedLocals;
+
+    std::map<std::wstring, CLR_UINT32> m_profile;
+    size_t m_numProfiledMethods;
+
     MetaData::Parser *m_pr;
 
     BYTE m_tmpSig[1024];
@@ -266,18 +492,26 @@ class Linker
     HRESULT ProcessMemberRef();
     HRESULT ProcessTypeDef(MetaData::mdTypeDefList &order);
     HRESULT ProcessTypeDef(mdTypeDef tdIdx);
-    HRESULT ProcessTypeDef_ByteCode(mdTypeDef tdIdx);
+    HRESULT ProcessByteCode(MetaData::mdTypeDefList &order);
+    void CompileByteCode(TypeByteCodeVector &types, LONG volatile *next);
+    HRESULT ProcessTypeDef_ByteCode(TypeByteCode &tbc, ExceptionHandlerHierarchy &lookupEh);
     HRESULT ProcessFieldDef(MetaData::TypeDef &td, CLR_RECORD_TYPEDEF *tdDst, MetaData::FieldDef &fd, CLR_UINT32 mode);
     HRESULT ProcessMethodDef(
         MetaData::TypeDef &td,
         CLR_RECORD_TYPEDEF *tdDst,
         MetaData::MethodDef &md,
         CLR_UINT32 mode);
+    HRESULT CompactLocals(MetaData::MethodDef &md);
+    CLR_UINT32 GetProfileHits(MetaData::MethodDef &md);
+    void ApplyProfile(MetaData::TypeDef &td);
     HRESULT ProcessMethodDef_ByteCode(
         MetaData::TypeDef &td,
         CLR_RECORD_TYPEDEF *tdDst,
         MetaData::MethodDef &md,
-        CLR_UINT32 mode);
+        CLR_UINT32 mode,
+        TypeByteCode &tbc,
+        ExceptionHandlerHierarchy &lookupEh);
+    HRESULT EmitMethodBody(CLR_RECORD_METHODDEF *dst, const BYTE *body, size_t len, bool fHasEH);
     HRESULT ProcessTypeSpec();
     HRESULT ProcessAttribute();
     HRESULT ProcessResource();
@@ -285,7 +519,9 @@ class Linker
 
     HRESULT EmitData(CQuickRecord<BYTE> &buf, CLR_RECORD_ASSEMBLY &headerSrc);
 
-    HRESULT DumpPdbxToken(CLR_XmlUtil &xml, IXMLDOMNodePtr pNodeParent, mdToken tk);
+    HRESULT DumpPdbxToken(XmlWriter &xml, mdToken tk);
+    void SizeReport_Names(std::map<CLR_UINT32, std::string> &names);
+    HRESULT GetPdbxILMap(MetaData::MethodDef &md, std::vector<NanoPdbxBinaryIL> &ilMap);
 
     void DumpSig(CLR_UINT32 token, CLR_UINT16 sig, const BYTE *sigRaw, size_t sigLen);
 
@@ -297,6 +533,10 @@ class Linker
 
     void Clean();
 
+    void SetFoldIdenticalMethods(bool fFold);
+    void SetOptimizeByteCode(bool fOptimize);
+    void SetCompactLocals(bool fCompact);
+
     HRESULT Process(MetaData::Parser &pr);
 
     HRESULT Generate(CQuickRecord<BYTE> &buf, bool patch_fReboot, std::wstring *patch_szNative);
@@ -304,12 +544,54 @@ class Linker
     HRESULT SaveUniqueStrings(const std::wstring &file);
     HRESULT LoadUniqueStrings(const std::wstring &file);
     HRESULT DumpUniqueStrings(const std::wstring &file);
+    HRESULT LoadProfile(const std::wstring &file);
     HRESULT DumpPdbx(std::wstring szFileNamePE);
+    HRESULT DumpPdbxBinary(std::wstring szFileNamePE);
+    HRESULT DumpSizeReport(const std::wstring &file, CQuickRecord<BYTE> &buf);
 
     void LoadGlobalStrings();
 
     static CLR_DataType MapElementTypeToDataType(CorElementType et);
 };
+
+//
+// Resolves tokens and IL offsets from a binary pdbx, without loading the XML.
+//
+class PdbxBinaryReader
+{
+    HANDLE m_hFile;
+    HANDLE m_hMapping;
+
+    const CLR_UINT8 *m_data;
+    size_t m_size;
+
+    const NanoPdbxBinaryHeader *m_header;
+    const NanoPdbxBinaryToken *m_tokensByCLR;
+    const NanoPdbxBinaryToken *m_tokensByNanoCLR;
+    const NanoPdbxBinaryMethod *m_methods;
+    const NanoPdbxBinaryIL *m_ilEntries;
+
+    bool VerifyTable(CLR_UINT32 offset, CLR_UINT32 num, size_t size) const;
+
+    const NanoPdbxBinaryMethod *FindMethod(CLR_UINT32 tkNanoCLR) const;
+
+  public:
+    PdbxBinaryReader();
+    ~PdbxBinaryReader();
+
+    HRESULT Open(LPCWSTR szFile);
+    HRESULT Attach(const void *data, size_t size);
+    void Close();
+
+    const NanoPdbxBinaryHeader *GetHeader() const;
+    LPCSTR GetFileName() const;
+
+    bool TokenToCLR(CLR_UINT32 tkNanoCLR, CLR_UINT32 &tkCLR) const;
+    bool TokenToNanoCLR(CLR_UINT32 tkCLR, CLR_UINT32 &tkNanoCLR) const;
+
+    bool IPToCLR(CLR_UINT32 tkMethodNanoCLR, CLR_UINT32 ipNanoCLR, CLR_UINT32 &ipCLR) const;
+    bool IPToNanoCLR(CLR_UINT32 tkMethodCLR, CLR_UINT32 ipCLR, CLR_UINT32 &ipNanoCLR) const;
+};
 }; // namespace WatchAssemblyBuilder
 
 class ErrorReporting
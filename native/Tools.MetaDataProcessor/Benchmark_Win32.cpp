@@ -0,0 +1,939 @@
+//
+// Copyright (c) 2017 The nanoFramework project contributors
+// Portions Copyright (c) Microsoft Corporation.  All rights reserved.
+// See LICENSE file in the project root for full license information.
+//
+
+#include "stdafx.h"
+
+#include <MetaHost.h>
+#include <Psapi.h>
+
+#include <algorithm>
+
+_COM_SMRT_PTR(ICLRMetaHost);
+_COM_SMRT_PTR(ICLRRuntimeInfo);
+_COM_SMRT_PTR_2(IMetaDataEmit, IID_IMetaDataEmit);
+_COM_SMRT_PTR_2(IMetaDataAssemblyEmit, IID_IMetaDataAssemblyEmit);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//
+// Layout of the synthetic PE file: headers in the first file block, then a single section holding the COR header, the
+// method bodies and the metadata, in that order.
+//
+static const DWORD c_Benchmark_NtHeadersOffset = 0x80;
+static const DWORD c_Benchmark_HeadersSize = 0x200;
+static const DWORD c_Benchmark_FileAlignment = 0x200;
+static const DWORD c_Benchmark_SectionAlignment = 0x2000;
+static const DWORD c_Benchmark_SectionRva = 0x2000;
+
+// a phase regresses when its median is this much slower than the baseline, on top of a noise floor
+static const double c_Benchmark_Tolerance = 0.10;
+static const double c_Benchmark_NoiseFloorMs = 1.0;
+static const CLR_UINT64 c_Benchmark_NoiseFloorKB = 1024;
+
+static const CLR_UINT8 c_Benchmark_ParamTypes[] = {
+    ELEMENT_TYPE_I4,
+    ELEMENT_TYPE_I8,
+    ELEMENT_TYPE_R8,
+    ELEMENT_TYPE_BOOLEAN,
+    ELEMENT_TYPE_STRING,
+    ELEMENT_TYPE_U1,
+    ELEMENT_TYPE_I2,
+    ELEMENT_TYPE_CHAR,
+};
+
+static const LPCSTR c_Benchmark_PhaseNames[] = {
+    "Analyze",
+    "RemoveUnused",
+    "Process",
+    "Generate",
+    "DumpPdbx",
+};
+
+//--//
+
+Benchmark::Config::Config()
+{
+    m_types = 10;      // CLR_UINT32 m_types;
+    m_methods = 10;    // CLR_UINT32 m_methods;
+    m_signatures = 10; // CLR_UINT32 m_signatures;
+    m_strings = 1;     // CLR_UINT32 m_strings;
+    m_eh = 0;          // CLR_UINT32 m_eh;
+    m_resources = 0;   // CLR_UINT32 m_resources;
+}
+
+HRESULT Benchmark::Config::Parse(const std::string &text)
+{
+    NANOCLR_HEADER();
+
+    size_t pos = 0;
+
+    m_text = text;
+
+    while (pos < text.size())
+    {
+        size_t end = text.find(',', pos);
+        std::string item;
+        std::string key;
+        CLR_UINT32 value;
+        size_t sep;
+
+        if (end == std::string::npos)
+            end = text.size();
+
+        item = text.substr(pos, end - pos);
+        pos = end + 1;
+
+        if (item.empty())
+            continue;
+
+        sep = item.find('=');
+
+        if (sep == std::string::npos)
+        {
+            wprintf(L"Benchmark parameter '%S' needs a value\n", item.c_str());
+            NANOCLR_SET_AND_LEAVE(CLR_E_INVALID_PARAMETER);
+        }
+
+        key = item.substr(0, sep);
+        value = strtoul(item.c_str() + sep + 1, NULL, 0);
+
+        if (key == "types")
+            m_types = value;
+        else if (key == "methods")
+            m_methods = value;
+        else if (key == "signatures")
+            m_signatures = value;
+        else if (key == "strings")
+            m_strings = value;
+        else if (key == "eh")
+            m_eh = value;
+        else if (key == "resources")
+            m_resources = value;
+        else
+        {
+            wprintf(L"Unknown benchmark parameter '%S'\n", key.c_str());
+            NANOCLR_SET_AND_LEAVE(CLR_E_INVALID_PARAMETER);
+        }
+    }
+
+    if (m_signatures == 0)
+        m_signatures = 1;
+
+    if (m_resources > 0x7FFF)
+    {
+        wprintf(L"Resource ids are 16 bits wide, cannot generate %u resources\n", m_resources);
+        NANOCLR_SET_AND_LEAVE(CLR_E_INVALID_PARAMETER);
+    }
+
+    NANOCLR_NOCLEANUP();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void local_Align(CLR_RT_Buffer &buf, size_t align)
+{
+    buf.resize((buf.size() + align - 1) & ~(align - 1), 0);
+}
+
+static void local_EmitToken(CLR_RT_Buffer &code, CLR_OPCODE op, mdToken tk)
+{
+    code.push_back((CLR_UINT8)op);
+    code.push_back((CLR_UINT8)(tk));
+    code.push_back((CLR_UINT8)(tk >> 8));
+    code.push_back((CLR_UINT8)(tk >> 16));
+    code.push_back((CLR_UINT8)(tk >> 24));
+}
+
+static void local_EmitDefault(CLR_RT_Buffer &code, CLR_UINT8 type)
+{
+    switch (type)
+    {
+        case ELEMENT_TYPE_STRING:
+            code.push_back((CLR_UINT8)CEE_LDNULL);
+            break;
+
+        case ELEMENT_TYPE_I8:
+            code.push_back((CLR_UINT8)CEE_LDC_I4_0);
+            code.push_back((CLR_UINT8)CEE_CONV_I8);
+            break;
+
+        case ELEMENT_TYPE_R8:
+            code.push_back((CLR_UINT8)CEE_LDC_I4_0);
+            code.push_back((CLR_UINT8)CEE_CONV_R8);
+            break;
+
+        default:
+            code.push_back((CLR_UINT8)CEE_LDC_I4_0);
+            break;
+    }
+}
+
+//
+// Static method returning an int, the parameters are the digits of (index + 1) in base 8, each digit picking one of
+// c_Benchmark_ParamTypes. Different indexes always give different signatures.
+//
+static void local_BuildSignature(CLR_UINT32 index, CLR_RT_Buffer &sig)
+{
+    const CLR_UINT32 numTypes = ARRAYSIZE(c_Benchmark_ParamTypes);
+
+    sig.clear();
+    sig.push_back(IMAGE_CEE_CS_CALLCONV_DEFAULT);
+    sig.push_back(0);
+    sig.push_back(ELEMENT_TYPE_I4);
+
+    for (CLR_UINT32 n = index + 1; n; n /= numTypes)
+    {
+        sig.push_back(c_Benchmark_ParamTypes[n % numTypes]);
+        sig[1]++;
+    }
+}
+
+//
+// Every body loads its strings, calls the next method of the type and runs a sequence of try/catch blocks, so all
+// the knobs of the configuration end up in the bytecode and the EH tables.
+//
+static HRESULT local_EmitMethod(
+    IMetaDataEmit *pEmit,
+    const Benchmark::Config &cfg,
+    CLR_UINT32 type,
+    CLR_UINT32 method,
+    mdMethodDef md,
+    const CLR_RT_Buffer *calleeSig,
+    mdMethodDef mdCallee,
+    mdTypeDef tdError,
+    CLR_RT_Buffer &section)
+{
+    NANOCLR_HEADER();
+
+    CLR_RT_Buffer code;
+    std::vector<IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT> clauses;
+    COR_ILMETHOD_FAT fat;
+    CLR_UINT32 maxStack = 1;
+    unsigned sizeHeader;
+    size_t pos;
+
+    for (CLR_UINT32 i = 0; i < cfg.m_strings; i++)
+    {
+        WCHAR sz[64];
+        mdString tk;
+
+        swprintf_s(sz, ARRAYSIZE(sz), L"Synthetic string %u.%u.%u", type, method, i);
+
+        NANOCLR_CHECK_HRESULT(pEmit->DefineUserString(sz, (ULONG)wcslen(sz), &tk));
+
+        local_EmitToken(code, CEE_LDSTR, tk);
+        code.push_back((CLR_UINT8)CEE_POP);
+    }
+
+    if (calleeSig)
+    {
+        CLR_UINT32 numParams = (*calleeSig)[1];
+
+        for (CLR_UINT32 i = 0; i < numParams; i++)
+        {
+            local_EmitDefault(code, (*calleeSig)[3 + i]);
+        }
+
+        local_EmitToken(code, CEE_CALL, mdCallee);
+        code.push_back((CLR_UINT8)CEE_POP);
+
+        if (maxStack < numParams)
+            maxStack = numParams;
+    }
+
+    for (CLR_UINT32 i = 0; i < cfg.m_eh; i++)
+    {
+        IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT clause;
+
+        // try { ldc.i4.0; pop; leave.s END } catch (Error) { pop; leave.s END } END:
+        clause.Flags = COR_ILEXCEPTION_CLAUSE_NONE;
+        clause.TryOffset = (DWORD)code.size();
+        clause.TryLength = 4;
+        clause.HandlerOffset = clause.TryOffset + clause.TryLength;
+        clause.HandlerLength = 3;
+        clause.ClassToken = tdError;
+
+        code.push_back((CLR_UINT8)CEE_LDC_I4_0);
+        code.push_back((CLR_UINT8)CEE_POP);
+        code.push_back((CLR_UINT8)CEE_LEAVE_S);
+        code.push_back(3);
+        code.push_back((CLR_UINT8)CEE_POP);
+        code.push_back((CLR_UINT8)CEE_LEAVE_S);
+        code.push_back(0);
+
+        clauses.push_back(clause);
+    }
+
+    code.push_back((CLR_UINT8)CEE_LDC_I4_0);
+    code.push_back((CLR_UINT8)CEE_RET);
+
+    memset(&fat, 0, sizeof(fat));
+    fat.SetMaxStack(maxStack);
+    fat.SetCodeSize((DWORD)code.size());
+
+    sizeHeader = COR_ILMETHOD::Size(&fat, clauses.size() > 0);
+
+    local_Align(section, sizeof(DWORD));
+
+    NANOCLR_CHECK_HRESULT(pEmit->SetRVA(md, c_Benchmark_SectionRva + (ULONG)section.size()));
+
+    pos = section.size();
+    section.resize(pos + sizeHeader);
+    COR_ILMETHOD::Emit(sizeHeader, &fat, clauses.size() > 0, &section[pos]);
+
+    section.insert(section.end(), code.begin(), code.end());
+
+    if (clauses.size())
+    {
+        unsigned sizeEH = COR_ILMETHOD_SECT_EH::Size((unsigned)clauses.size(), &clauses[0]);
+
+        local_Align(section, sizeof(DWORD));
+
+        pos = section.size();
+        section.resize(pos + sizeEH);
+        COR_ILMETHOD_SECT_EH::Emit(sizeEH, (unsigned)clauses.size(), &clauses[0], false, &section[pos]);
+    }
+
+    NANOCLR_NOCLEANUP();
+}
+
+static HRESULT local_SaveImage(const std::wstring &file, const CLR_RT_Buffer &section)
+{
+    NANOCLR_HEADER();
+
+    CLR_RT_Buffer image;
+    IMAGE_DOS_HEADER *dos;
+    IMAGE_NT_HEADERS *nt;
+    IMAGE_SECTION_HEADER *sec;
+    DWORD sizeRaw = (DWORD)((section.size() + c_Benchmark_FileAlignment - 1) & ~(c_Benchmark_FileAlignment - 1));
+    DWORD sizeVirtual =
+        (DWORD)((section.size() + c_Benchmark_SectionAlignment - 1) & ~(c_Benchmark_SectionAlignment - 1));
+
+    image.resize(c_Benchmark_HeadersSize + sizeRaw, 0);
+
+    dos = (IMAGE_DOS_HEADER *)&image[0];
+    nt = (IMAGE_NT_HEADERS *)&image[c_Benchmark_NtHeadersOffset];
+    sec = IMAGE_FIRST_SECTION(nt);
+
+    dos->e_magic = IMAGE_DOS_SIGNATURE;
+    dos->e_lfanew = c_Benchmark_NtHeadersOffset;
+
+    nt->Signature = IMAGE_NT_SIGNATURE;
+#ifdef _WIN64
+    nt->FileHeader.Machine = IMAGE_FILE_MACHINE_AMD64;
+#else
+    nt->FileHeader.Machine = IMAGE_FILE_MACHINE_I386;
+#endif
+    nt->FileHeader.NumberOfSections = 1;
+    nt->FileHeader.SizeOfOptionalHeader = sizeof(nt->OptionalHeader);
+    nt->FileHeader.Characteristics = IMAGE_FILE_EXECUTABLE_IMAGE | IMAGE_FILE_DLL;
+
+    nt->OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR_MAGIC;
+    nt->OptionalHeader.SizeOfCode = sizeRaw;
+    nt->OptionalHeader.BaseOfCode = c_Benchmark_SectionRva;
+    nt->OptionalHeader.ImageBase = 0x10000000;
+    nt->OptionalHeader.SectionAlignment = c_Benchmark_SectionAlignment;
+    nt->OptionalHeader.FileAlignment = c_Benchmark_FileAlignment;
+    nt->OptionalHeader.MajorOperatingSystemVersion = 4;
+    nt->OptionalHeader.MajorSubsystemVersion = 4;
+    nt->OptionalHeader.SizeOfImage = c_Benchmark_SectionRva + sizeVirtual;
+    nt->OptionalHeader.SizeOfHeaders = c_Benchmark_HeadersSize;
+    nt->OptionalHeader.Subsystem = IMAGE_SUBSYSTEM_WINDOWS_CUI;
+    nt->OptionalHeader.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+    nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_COMHEADER].VirtualAddress = c_Benchmark_SectionRva;
+    nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_COMHEADER].Size = sizeof(IMAGE_COR20_HEADER);
+
+    memcpy(sec->Name, ".text", 5);
+    sec->Misc.VirtualSize = (DWORD)section.size();
+    sec->VirtualAddress = c_Benchmark_SectionRva;
+    sec->SizeOfRawData = sizeRaw;
+    sec->PointerToRawData = c_Benchmark_HeadersSize;
+    sec->Characteristics = IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ;
+
+    memcpy(&image[c_Benchmark_HeadersSize], &section[0], section.size());
+
+    NANOCLR_SET_AND_LEAVE(CLR_RT_FileStore::SaveFile(file.c_str(), image));
+
+    NANOCLR_NOCLEANUP();
+}
+
+static HRESULT local_SaveResources(const Benchmark::Config &cfg, const std::wstring &file)
+{
+    NANOCLR_HEADER();
+
+    CLR_RT_Buffer buf;
+    NanoResourcesFileHeader header;
+
+    header.magicNumber = NanoResourcesFileHeader::MAGIC_NUMBER;
+    header.version = CLR_RECORD_RESOURCE_FILE::CURRENT_VERSION;
+    header.sizeOfHeader = sizeof(NanoResourcesFileHeader);
+    header.sizeOfResourceHeader = sizeof(NanoResourcesResourceHeader);
+    header.numberOfResources = cfg.m_resources;
+
+    buf.insert(buf.end(), (CLR_UINT8 *)&header, (CLR_UINT8 *)&header + sizeof(header));
+
+    // strings and binary blobs of varying length, ids are sorted as the linker expects
+    for (CLR_UINT32 i = 0; i < cfg.m_resources; i++)
+    {
+        NanoResourcesResourceHeader resource;
+        std::string data;
+
+        if (i % 2)
+        {
+            data.assign((i % 16 + 1) * 8, (char)i);
+
+            resource.kind = CLR_RECORD_RESOURCE::RESOURCE_Binary;
+        }
+        else
+        {
+            char sz[64];
+
+            sprintf_s(sz, ARRAYSIZE(sz), "Synthetic resource %u", i);
+            data = sz;
+
+            resource.kind = CLR_RECORD_RESOURCE::RESOURCE_String;
+        }
+
+        resource.id = (CLR_INT16)i;
+        resource.pad = 0;
+        resource.size = (CLR_UINT32)data.size();
+
+        buf.insert(buf.end(), (CLR_UINT8 *)&resource, (CLR_UINT8 *)&resource + sizeof(resource));
+        buf.insert(buf.end(), data.begin(), data.end());
+    }
+
+    NANOCLR_SET_AND_LEAVE(CLR_RT_FileStore::SaveFile(file.c_str(), buf));
+
+    NANOCLR_NOCLEANUP();
+}
+
+HRESULT Benchmark::Generate(const Config &cfg, const std::wstring &assemblyFile, const std::wstring &resourceFile)
+{
+    NANOCLR_HEADER();
+
+    ICLRMetaHostPtr spMetaHost;
+    ICLRRuntimeInfoPtr spRuntimeInfo;
+    IMetaDataDispenserExPtr spDisp;
+    IMetaDataEmitPtr spEmit;
+    IMetaDataAssemblyEmitPtr spAssemblyEmit;
+    ASSEMBLYMETADATA amd;
+    mdAssembly tkAssembly;
+    mdTypeDef tdError;
+    std::vector<CLR_RT_Buffer> signatures;
+    std::vector<mdMethodDef> methods;
+    std::vector<CLR_UINT32> methodSig;
+    CLR_RT_Buffer section;
+    IMAGE_COR20_HEADER *cor;
+    DWORD sizeMetaData;
+    size_t posMetaData;
+
+    NANOCLR_CHECK_HRESULT(CLRCreateInstance(CLSID_CLRMetaHost, IID_PPV_ARGS(&spMetaHost)));
+    NANOCLR_CHECK_HRESULT(spMetaHost->GetRuntime(L"v4.0.30319", IID_PPV_ARGS(&spRuntimeInfo)));
+    NANOCLR_CHECK_HRESULT(
+        spRuntimeInfo->GetInterface(CLSID_CorMetaDataDispenser, IID_IMetaDataDispenserEx, (LPVOID *)&spDisp));
+
+    NANOCLR_CHECK_HRESULT(spDisp->DefineScope(CLSID_CorMetaDataRuntime, 0, IID_IMetaDataEmit, (IUnknown **)&spEmit));
+    NANOCLR_CHECK_HRESULT(spEmit->QueryInterface(IID_IMetaDataAssemblyEmit, (void **)&spAssemblyEmit));
+
+    memset(&amd, 0, sizeof(amd));
+    amd.usMajorVersion = 1;
+
+    NANOCLR_CHECK_HRESULT(spEmit->SetModuleProps(L"Synthetic.dll"));
+    NANOCLR_CHECK_HRESULT(spAssemblyEmit->DefineAssembly(NULL, 0, CALG_SHA1, L"Synthetic", &amd, 0, &tkAssembly));
+    NANOCLR_CHECK_HRESULT(spEmit->DefineTypeDef(L"Synthetic.Error", tdPublic, mdTypeDefNil, NULL, &tdError));
+
+    signatures.resize(cfg.m_signatures);
+
+    for (CLR_UINT32 i = 0; i < cfg.m_signatures; i++)
+    {
+        local_BuildSignature(i, signatures[i]);
+    }
+
+    //
+    // All the methods are defined up front, so every body can call its successor by token.
+    //
+    for (CLR_UINT32 type = 0; type < cfg.m_types; type++)
+    {
+        WCHAR sz[64];
+        mdTypeDef td;
+
+        swprintf_s(sz, ARRAYSIZE(sz), L"Synthetic.Type%u", type);
+
+        NANOCLR_CHECK_HRESULT(spEmit->DefineTypeDef(sz, tdPublic | tdAbstract | tdSealed, mdTypeDefNil, NULL, &td));
+
+        for (CLR_UINT32 method = 0; method < cfg.m_methods; method++)
+        {
+            CLR_UINT32 sig = (CLR_UINT32)(methods.size() % cfg.m_signatures);
+            mdMethodDef md;
+
+            swprintf_s(sz, ARRAYSIZE(sz), L"Method%u", method);
+
+            NANOCLR_CHECK_HRESULT(spEmit->DefineMethod(
+                td,
+                sz,
+                mdPublic | mdStatic | mdHideBySig,
+                &signatures[sig][0],
+                (ULONG)signatures[sig].size(),
+                0,
+                miIL | miManaged,
+                &md));
+
+            methods.push_back(md);
+            methodSig.push_back(sig);
+        }
+    }
+
+    // the COR header goes first, it's filled in once the metadata has been placed
+    section.resize(sizeof(IMAGE_COR20_HEADER), 0);
+
+    for (CLR_UINT32 type = 0; type < cfg.m_types; type++)
+    {
+        for (CLR_UINT32 method = 0; method < cfg.m_methods; method++)
+        {
+            size_t idx = (size_t)type * cfg.m_methods + method;
+            bool fCall = method + 1 < cfg.m_methods;
+
+            NANOCLR_CHECK_HRESULT(local_EmitMethod(
+                spEmit,
+                cfg,
+                type,
+                method,
+                methods[idx],
+                fCall ? &signatures[methodSig[idx + 1]] : NULL,
+                fCall ? methods[idx + 1] : mdMethodDefNil,
+                tdError,
+                section));
+        }
+    }
+
+    local_Align(section, sizeof(DWORD));
+
+    NANOCLR_CHECK_HRESULT(spEmit->GetSaveSize(cssAccurate, &sizeMetaData));
+
+    posMetaData = section.size();
+    section.resize(posMetaData + sizeMetaData, 0);
+
+    NANOCLR_CHECK_HRESULT(spEmit->SaveToMemory(&section[posMetaData], sizeMetaData));
+
+    cor = (IMAGE_COR20_HEADER *)&section[0];
+    cor->cb = sizeof(IMAGE_COR20_HEADER);
+    cor->MajorRuntimeVersion = 2;
+    cor->MinorRuntimeVersion = 5;
+    cor->MetaData.VirtualAddress = c_Benchmark_SectionRva + (DWORD)posMetaData;
+    cor->MetaData.Size = sizeMetaData;
+    cor->Flags = COMIMAGE_FLAGS_ILONLY;
+
+    NANOCLR_CHECK_HRESULT(local_SaveImage(assemblyFile, section));
+
+    if (cfg.m_resources)
+    {
+        NANOCLR_CHECK_HRESULT(local_SaveResources(cfg, resourceFile));
+    }
+
+    NANOCLR_NOCLEANUP();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct BenchmarkMemory
+{
+    CLR_UINT64 m_workingSetKB;
+    CLR_UINT64 m_peakWorkingSetKB;
+};
+
+static void local_SampleMemory(BenchmarkMemory &mem)
+{
+    PROCESS_MEMORY_COUNTERS pmc;
+
+    mem.m_workingSetKB = 0;
+    mem.m_peakWorkingSetKB = 0;
+
+    if (::GetProcessMemoryInfo(::GetCurrentProcess(), &pmc, sizeof(pmc)))
+    {
+        mem.m_workingSetKB = (CLR_UINT64)pmc.WorkingSetSize / 1024;
+        mem.m_peakWorkingSetKB = (CLR_UINT64)pmc.PeakWorkingSetSize / 1024;
+    }
+}
+
+//
+// Closes the phase started at 'start' and opens the next one.
+// The figure recorded for a phase is how far the working set grew over its value when the phase started. The process
+// peak can't be reset: when the phase raised it, the new peak is the phase's own, otherwise only the growth still
+// there at its end can be seen.
+//
+static void local_EndPhase(
+    LARGE_INTEGER &start,
+    BenchmarkMemory &mem,
+    const LARGE_INTEGER &freq,
+    std::vector<double> &times,
+    CLR_UINT64 &growthKB)
+{
+    LARGE_INTEGER now;
+    BenchmarkMemory memNow;
+    CLR_UINT64 top;
+    CLR_UINT64 kb;
+
+    ::QueryPerformanceCounter(&now);
+
+    times.push_back((double)(now.QuadPart - start.QuadPart) * 1000.0 / (double)freq.QuadPart);
+
+    local_SampleMemory(memNow);
+
+    top = memNow.m_peakWorkingSetKB > mem.m_peakWorkingSetKB ? memNow.m_peakWorkingSetKB : memNow.m_workingSetKB;
+    kb = top > mem.m_workingSetKB ? top - mem.m_workingSetKB : 0;
+
+    if (growthKB < kb)
+        growthKB = kb;
+
+    mem = memNow;
+
+    ::QueryPerformanceCounter(&start);
+}
+
+static double local_Median(std::vector<double> &values)
+{
+    size_t num = values.size();
+
+    std::sort(values.begin(), values.end());
+
+    if (num == 0)
+        return 0;
+
+    if (num % 2)
+        return values[num / 2];
+
+    return (values[num / 2 - 1] + values[num / 2]) / 2;
+}
+
+HRESULT Benchmark::RunConfig(const Config &cfg, CLR_UINT32 iterations, ResultVector &results)
+{
+    NANOCLR_HEADER();
+
+    WCHAR szTemp[MAX_PATH];
+    WCHAR szBase[MAX_PATH];
+    std::wstring assemblyFile;
+    std::wstring resourceFile;
+    std::wstring outputFile;
+    std::wstring pdbxFile;
+    std::vector<double> times[c_Phase_Count];
+    CLR_UINT64 growthKB[c_Phase_Count];
+    LARGE_INTEGER freq;
+
+    szBase[0] = 0;
+
+    //
+    // The empty file GetTempFileName creates keeps the name taken until the run is over, so concurrent runs don't
+    // overwrite each other's synthetic assembly.
+    //
+    if (::GetTempPathW(ARRAYSIZE(szTemp), szTemp) == 0 || ::GetTempFileNameW(szTemp, L"nfb", 0, szBase) == 0)
+    {
+        szBase[0] = 0;
+
+        NANOCLR_SET_AND_LEAVE(CLR_E_FILE_IO);
+    }
+
+    assemblyFile = std::wstring(szBase) + L".dll";
+    resourceFile = std::wstring(szBase) + L".nanoresources";
+    outputFile = std::wstring(szBase) + L".pe";
+    WatchAssemblyBuilder::ChangeExtensionOnFileName(outputFile, pdbxFile, L"pdbx");
+
+    NANOCLR_CHECK_HRESULT(Generate(cfg, assemblyFile, resourceFile));
+
+    memset(growthKB, 0, sizeof(growthKB));
+
+    ::QueryPerformanceFrequency(&freq);
+
+    for (CLR_UINT32 it = 0; it < iterations; it++)
+    {
+        MetaData::Collection collection;
+        MetaData::Parser *pr;
+        WatchAssemblyBuilder::Linker lk;
+        WatchAssemblyBuilder::CQuickRecord<BYTE> buf;
+        LARGE_INTEGER start;
+        BenchmarkMemory mem;
+
+        NANOCLR_CHECK_HRESULT(collection.CreateAssembly(pr));
+
+        if (cfg.m_resources)
+        {
+            pr->m_resources.insert(resourceFile);
+        }
+
+        local_SampleMemory(mem);
+
+        ::QueryPerformanceCounter(&start);
+
+        NANOCLR_CHECK_HRESULT(pr->Analyze(assemblyFile.c_str()));
+        local_EndPhase(start, mem, freq, times[c_Phase_Analyze], growthKB[c_Phase_Analyze]);
+
+        NANOCLR_CHECK_HRESULT(pr->RemoveUnused());
+        local_EndPhase(start, mem, freq, times[c_Phase_RemoveUnused], growthKB[c_Phase_RemoveUnused]);
+
+        lk.LoadGlobalStrings();
+        NANOCLR_CHECK_HRESULT(lk.Process(*pr));
+        local_EndPhase(start, mem, freq, times[c_Phase_Process], growthKB[c_Phase_Process]);
+
+        NANOCLR_CHECK_HRESULT(lk.Generate(buf, false, NULL));
+        local_EndPhase(start, mem, freq, times[c_Phase_Generate], growthKB[c_Phase_Generate]);
+
+        NANOCLR_CHECK_HRESULT(lk.DumpPdbx(outputFile));
+        local_EndPhase(start, mem, freq, times[c_Phase_DumpPdbx], growthKB[c_Phase_DumpPdbx]);
+    }
+
+    for (int phase = 0; phase < c_Phase_Count; phase++)
+    {
+        Result res;
+
+        res.m_config = cfg.m_text;
+        res.m_phase = c_Benchmark_PhaseNames[phase];
+        res.m_iterations = iterations;
+        res.m_medianMs = local_Median(times[phase]);
+        res.m_minMs = times[phase].size() ? *std::min_element(times[phase].begin(), times[phase].end()) : 0;
+        res.m_workingSetGrowthKB = growthKB[phase];
+
+        printf(
+            "%-14s min %10.3f ms  median %10.3f ms  growth %8llu KB\n",
+            res.m_phase.c_str(),
+            res.m_minMs,
+            res.m_medianMs,
+            res.m_workingSetGrowthKB);
+
+        results.push_back(res);
+    }
+
+    NANOCLR_CLEANUP();
+
+    if (szBase[0])
+    {
+        ::DeleteFileW(assemblyFile.c_str());
+        ::DeleteFileW(resourceFile.c_str());
+        ::DeleteFileW(outputFile.c_str());
+        ::DeleteFileW(pdbxFile.c_str());
+        ::DeleteFileW(szBase);
+    }
+
+    NANOCLR_CLEANUP_END();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool local_ReadField(LPCSTR &ptr, std::string &str)
+{
+    str.clear();
+
+    if (*ptr == 0 || *ptr == '\r' || *ptr == '\n')
+        return false;
+
+    if (*ptr == '"')
+    {
+        for (ptr++; *ptr && *ptr != '"'; ptr++)
+        {
+            str += *ptr;
+        }
+
+        if (*ptr == '"')
+            ptr++;
+    }
+    else
+    {
+        while (*ptr && *ptr != ',' && *ptr != '\r' && *ptr != '\n')
+        {
+            str += *ptr++;
+        }
+    }
+
+    if (*ptr == ',')
+        ptr++;
+
+    return true;
+}
+
+HRESULT Benchmark::Save(const std::wstring &file, ResultVector &results)
+{
+    NANOCLR_HEADER();
+
+    FILE *stream;
+
+    if (_wfopen_s(&stream, file.c_str(), L"w") != 0)
+    {
+        NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FILE_IO, L"Cannot open '%s' for writing!\n", file.c_str());
+    }
+
+    fprintf(stream, "Config,Phase,Iterations,MinMs,MedianMs,WorkingSetGrowthKB\n");
+
+    // configurations are comma separated lists, so they're always quoted
+    for (ResultVectorIter it = results.begin(); it != results.end(); it++)
+    {
+        fprintf(
+            stream,
+            "\"%s\",%s,%u,%.3f,%.3f,%llu\n",
+            it->m_config.c_str(),
+            it->m_phase.c_str(),
+            it->m_iterations,
+            it->m_minMs,
+            it->m_medianMs,
+            it->m_workingSetGrowthKB);
+    }
+
+    fclose(stream);
+
+    NANOCLR_NOCLEANUP();
+}
+
+HRESULT Benchmark::Load(const std::wstring &file, ResultVector &results)
+{
+    NANOCLR_HEADER();
+
+    CLR_RT_Buffer buffer;
+    LPCSTR ptr;
+    bool fHeader = true;
+
+    NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::LoadFile(file.c_str(), buffer));
+
+    buffer.push_back(0);
+    ptr = (LPCSTR)&buffer[0];
+
+    while (*ptr)
+    {
+        Result res;
+        std::string iterations;
+        std::string minMs;
+        std::string medianMs;
+        std::string growthKB;
+
+        if (local_ReadField(ptr, res.m_config) && local_ReadField(ptr, res.m_phase) &&
+            local_ReadField(ptr, iterations) && local_ReadField(ptr, minMs) && local_ReadField(ptr, medianMs) &&
+            local_ReadField(ptr, growthKB) && !fHeader)
+        {
+            res.m_iterations = strtoul(iterations.c_str(), NULL, 10);
+            res.m_minMs = strtod(minMs.c_str(), NULL);
+            res.m_medianMs = strtod(medianMs.c_str(), NULL);
+            res.m_workingSetGrowthKB = _strtoui64(growthKB.c_str(), NULL, 10);
+
+            results.push_back(res);
+        }
+
+        fHeader = false;
+
+        while (*ptr && *ptr != '\n')
+            ptr++;
+        if (*ptr == '\n')
+            ptr++;
+    }
+
+    NANOCLR_NOCLEANUP();
+}
+
+HRESULT Benchmark::Compare(ResultVector &baseline, ResultVector &results)
+{
+    NANOCLR_HEADER();
+
+    int regressions = 0;
+
+    for (ResultVectorIter it = results.begin(); it != results.end(); it++)
+    {
+        ResultVectorIter itBase;
+
+        for (itBase = baseline.begin(); itBase != baseline.end(); itBase++)
+        {
+            if (itBase->m_config == it->m_config && itBase->m_phase == it->m_phase)
+                break;
+        }
+
+        if (itBase == baseline.end())
+        {
+            printf("No baseline for %s [%s]\n", it->m_phase.c_str(), it->m_config.c_str());
+            continue;
+        }
+
+        if (it->m_medianMs > itBase->m_medianMs * (1 + c_Benchmark_Tolerance) + c_Benchmark_NoiseFloorMs)
+        {
+            printf(
+                "REGRESSION: %s [%s] median %.3f ms, baseline %.3f ms\n",
+                it->m_phase.c_str(),
+                it->m_config.c_str(),
+                it->m_medianMs,
+                itBase->m_medianMs);
+
+            regressions++;
+        }
+
+        if (it->m_workingSetGrowthKB >
+            (CLR_UINT64)(itBase->m_workingSetGrowthKB * (1 + c_Benchmark_Tolerance)) + c_Benchmark_NoiseFloorKB)
+        {
+            printf(
+                "REGRESSION: %s [%s] working set growth %llu KB, baseline %llu KB\n",
+                it->m_phase.c_str(),
+                it->m_config.c_str(),
+                it->m_workingSetGrowthKB,
+                itBase->m_workingSetGrowthKB);
+
+            regressions++;
+        }
+    }
+
+    if (regressions)
+    {
+        NANOCLR_SET_AND_LEAVE(CLR_E_FAIL);
+    }
+
+    NANOCLR_NOCLEANUP();
+}
+
+HRESULT Benchmark::Run(
+    const std::wstring &configs,
+    CLR_UINT32 iterations,
+    const std::wstring &resultsFile,
+    const std::wstring &baselineFile)
+{
+    NANOCLR_HEADER();
+
+    std::string text;
+    ConfigVector vec;
+    ResultVector results;
+    ResultVector baseline;
+    size_t pos = 0;
+
+    CLR_RT_UnicodeHelper::ConvertToUTF8(configs, text);
+
+    while (pos < text.size())
+    {
+        size_t end = text.find(';', pos);
+        Config cfg;
+
+        if (end == std::string::npos)
+            end = text.size();
+
+        if (end > pos)
+        {
+            NANOCLR_CHECK_HRESULT(cfg.Parse(text.substr(pos, end - pos)));
+
+            vec.push_back(cfg);
+        }
+
+        pos = end + 1;
+    }
+
+    if (iterations == 0)
+        iterations = 1;
+
+    for (ConfigVectorIter it = vec.begin(); it != vec.end(); it++)
+    {
+        printf("Benchmarking %s, %u iterations\n", it->m_text.c_str(), iterations);
+
+        NANOCLR_CHECK_HRESULT(RunConfig(*it, iterations, results));
+    }
+
+    NANOCLR_CHECK_HRESULT(Save(resultsFile, results));
+
+    if (baselineFile.size())
+    {
+        NANOCLR_CHECK_HRESULT(Load(baselineFile, baseline));
+        NANOCLR_CHECK_HRESULT(Compare(baseline, results));
+    }
+
+    NANOCLR_NOCLEANUP();
+}
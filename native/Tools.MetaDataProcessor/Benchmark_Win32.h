@@ -0,0 +1,78 @@
+//
+// Copyright (c) 2017 The nanoFramework project contributors
+// Portions Copyright (c) Microsoft Corporation.  All rights reserved.
+// See LICENSE file in the project root for full license information.
+//
+
+#pragma once
+
+//
+// Scaling benchmark: builds synthetic assemblies of a given shape, runs them through the same pipeline as -compile
+// and reports time and memory per phase. A configuration is a list of counts, e.g.
+//
+//      types=100,methods=20,signatures=50,strings=2,eh=1,resources=16
+//
+// several configurations can be given at once, separated by ';'.
+//
+struct Benchmark
+{
+    struct Config
+    {
+        std::string m_text;
+
+        CLR_UINT32 m_types;      // type definitions
+        CLR_UINT32 m_methods;    // methods per type
+        CLR_UINT32 m_signatures; // distinct method signatures, shared by all the methods
+        CLR_UINT32 m_strings;    // user strings loaded by every method
+        CLR_UINT32 m_eh;         // try/catch clauses in every method
+        CLR_UINT32 m_resources;  // entries in the .nanoresources file
+
+        Config();
+
+        HRESULT Parse(const std::string &text);
+    };
+
+    typedef std::vector<Config> ConfigVector;
+    typedef ConfigVector::iterator ConfigVectorIter;
+
+    enum Phase
+    {
+        c_Phase_Analyze,
+        c_Phase_RemoveUnused,
+        c_Phase_Process,
+        c_Phase_Generate,
+        c_Phase_DumpPdbx,
+
+        c_Phase_Count
+    };
+
+    struct Result
+    {
+        std::string m_config;
+        std::string m_phase;
+
+        CLR_UINT32 m_iterations;
+        double m_minMs;
+        double m_medianMs;
+        CLR_UINT64 m_workingSetGrowthKB;
+    };
+
+    typedef std::vector<Result> ResultVector;
+    typedef ResultVector::iterator ResultVectorIter;
+
+    //--//
+
+    static HRESULT Generate(const Config &cfg, const std::wstring &assemblyFile, const std::wstring &resourceFile);
+
+    static HRESULT Run(
+        const std::wstring &configs,
+        CLR_UINT32 iterations,
+        const std::wstring &resultsFile,
+        const std::wstring &baselineFile);
+
+  private:
+    static HRESULT RunConfig(const Config &cfg, CLR_UINT32 iterations, ResultVector &results);
+    static HRESULT Save(const std::wstring &file, ResultVector &results);
+    static HRESULT Load(const std::wstring &file, ResultVector &results);
+    static HRESULT Compare(ResultVector &baseline, ResultVector &results);
+};
@@ -8,5 +8,11 @@
 
 struct HAL_Windows
 {
+    //
+    // The tool is a 32-bit process: both heaps are reserved with this size, next to the mapped databases and the
+    // worker thread stacks, within 2 GB of address space.
+    //
+    static const unsigned int c_Memory_MaxSize = 512 * 1024 * 1024;
+
     static HRESULT Memory_Resize(unsigned int size);
 };
@@ -0,0 +1,709 @@
+//
+// Copyright (c) 2017 The nanoFramework project contributors
+// Portions Copyright (c) Microsoft Corporation.  All rights reserved.
+// See LICENSE file in the project root for full license information.
+//
+
+#include "stdafx.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+JsonWriter::JsonWriter(FILE *output)
+{
+    m_output = output; // FILE*             m_output;
+                       // std::string       m_buffer;
+                       // std::vector<bool> m_first;
+
+    if (m_output)
+    {
+        m_buffer.reserve(c_FlushThreshold + 1024);
+    }
+}
+
+JsonWriter::~JsonWriter()
+{
+    Flush();
+}
+
+void JsonWriter::Separator()
+{
+    if (m_first.size())
+    {
+        if (m_first.back())
+        {
+            m_first.back() = false;
+        }
+        else
+        {
+            m_buffer += ',';
+        }
+    }
+}
+
+void JsonWriter::Name(LPCSTR szName)
+{
+    Separator();
+
+    if (szName)
+    {
+        Escape(szName);
+        m_buffer += ':';
+    }
+}
+
+void JsonWriter::Escape(LPCSTR sz)
+{
+    static const char c_Hex[] = "0123456789abcdef";
+
+    m_buffer += '"';
+
+    for (; *sz; sz++)
+    {
+        unsigned char c = (unsigned char)*sz;
+
+        switch (c)
+        {
+            case '"':
+                m_buffer += "\\\"";
+                break;
+            case '\\':
+                m_buffer += "\\\\";
+                break;
+            case '\n':
+                m_buffer += "\\n";
+                break;
+            case '\r':
+                m_buffer += "\\r";
+                break;
+            case '\t':
+                m_buffer += "\\t";
+                break;
+
+            default:
+                if (c < 0x20)
+                {
+                    m_buffer += "\\u00";
+                    m_buffer += c_Hex[c >> 4];
+                    m_buffer += c_Hex[c & 0xF];
+                }
+                else
+                {
+                    m_buffer += (char)c;
+                }
+                break;
+        }
+    }
+
+    m_buffer += '"';
+}
+
+void JsonWriter::CheckFlush()
+{
+    if (m_output && m_buffer.size() >= c_FlushThreshold)
+    {
+        Flush();
+    }
+}
+
+void JsonWriter::BeginObject(LPCSTR szName)
+{
+    Name(szName);
+
+    m_buffer += '{';
+    m_first.push_back(true);
+}
+
+void JsonWriter::EndObject()
+{
+    m_first.pop_back();
+    m_buffer += '}';
+
+    CheckFlush();
+}
+
+void JsonWriter::BeginArray(LPCSTR szName)
+{
+    Name(szName);
+
+    m_buffer += '[';
+    m_first.push_back(true);
+}
+
+void JsonWriter::EndArray()
+{
+    m_first.pop_back();
+    m_buffer += ']';
+
+    CheckFlush();
+}
+
+void JsonWriter::String(LPCSTR szName, LPCSTR sz)
+{
+    Name(szName);
+
+    Escape(sz ? sz : "");
+}
+
+void JsonWriter::Number(LPCSTR szName, CLR_INT64 val)
+{
+    char rgBuffer[32];
+
+    Name(szName);
+
+    sprintf_s(rgBuffer, ARRAYSIZE(rgBuffer), "%lld", val);
+
+    m_buffer += rgBuffer;
+}
+
+void JsonWriter::Hex(LPCSTR szName, const CLR_UINT8 *data, size_t len)
+{
+    static const char c_Hex[] = "0123456789abcdef";
+
+    Name(szName);
+
+    m_buffer += '"';
+
+    while (len--)
+    {
+        CLR_UINT8 c = *data++;
+
+        m_buffer += c_Hex[c >> 4];
+        m_buffer += c_Hex[c & 0xF];
+    }
+
+    m_buffer += '"';
+
+    CheckFlush();
+}
+
+//
+// Appends an already rendered value as the next element of the current array.
+//
+void JsonWriter::Raw(const std::string &json)
+{
+    Separator();
+
+    if (m_output && m_buffer.size() + json.size() >= c_FlushThreshold)
+    {
+        Flush();
+
+        fwrite(json.c_str(), json.size(), 1, m_output);
+    }
+    else
+    {
+        m_buffer += json;
+    }
+}
+
+void JsonWriter::NewLine()
+{
+    m_buffer += '\n';
+}
+
+void JsonWriter::Flush()
+{
+    if (m_output && m_buffer.size())
+    {
+        fwrite(m_buffer.c_str(), m_buffer.size(), 1, m_output);
+
+        m_buffer.clear();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//
+// Same text Dump_Signature produces, built in memory so it can go through the escaping of the writer.
+//
+static void JsonDump_Signature(const CLR_UINT8 *&p, std::string &str)
+{
+    CLR_DataType opt = CLR_UncompressElementType(p);
+    char rgBuffer[32];
+
+    switch (opt)
+    {
+        case DATATYPE_VOID:
+            str += "VOID";
+            break;
+        case DATATYPE_BOOLEAN:
+            str += "BOOLEAN";
+            break;
+        case DATATYPE_CHAR:
+            str += "CHAR";
+            break;
+        case DATATYPE_I1:
+            str += "I1";
+            break;
+        case DATATYPE_U1:
+            str += "U1";
+            break;
+        case DATATYPE_I2:
+            str += "I2";
+            break;
+        case DATATYPE_U2:
+            str += "U2";
+            break;
+        case DATATYPE_I4:
+            str += "I4";
+            break;
+        case DATATYPE_U4:
+            str += "U4";
+            break;
+        case DATATYPE_I8:
+            str += "I8";
+            break;
+        case DATATYPE_U8:
+            str += "U8";
+            break;
+        case DATATYPE_R4:
+            str += "R4";
+            break;
+        case DATATYPE_R8:
+            str += "R8";
+            break;
+        case DATATYPE_STRING:
+            str += "STRING";
+            break;
+        case DATATYPE_BYREF:
+            str += "BYREF ";
+            JsonDump_Signature(p, str);
+            break;
+        case DATATYPE_VALUETYPE:
+        case DATATYPE_CLASS:
+            str += (opt == DATATYPE_CLASS) ? "CLASS " : "VALUETYPE ";
+            sprintf_s(rgBuffer, ARRAYSIZE(rgBuffer), "[%08x]", CLR_TkFromStream(p));
+            str += rgBuffer;
+            break;
+        case DATATYPE_OBJECT:
+            str += "OBJECT";
+            break;
+        case DATATYPE_SZARRAY:
+            str += "SZARRAY ";
+            JsonDump_Signature(p, str);
+            break;
+
+        default:
+            sprintf_s(rgBuffer, ARRAYSIZE(rgBuffer), "[UNKNOWN: %08x]", opt);
+            str += rgBuffer;
+            break;
+    }
+}
+
+static void JsonDump_Signature(CLR_RT_Assembly *assm, CLR_SIG sig, std::string &str)
+{
+    const CLR_UINT8 *p = assm->GetSignature(sig);
+    CLR_UINT32 len;
+
+    str.clear();
+
+    CLR_CorCallingConvention cc = (CLR_CorCallingConvention)*p++;
+
+    switch (cc & PIMAGE_CEE_CS_CALLCONV_MASK)
+    {
+        case PIMAGE_CEE_CS_CALLCONV_FIELD:
+            str += "FIELD ";
+            JsonDump_Signature(p, str);
+            break;
+
+        case PIMAGE_CEE_CS_CALLCONV_LOCAL_SIG:
+            break;
+
+        case PIMAGE_CEE_CS_CALLCONV_DEFAULT:
+            len = *p++;
+
+            str += "METHOD ";
+            JsonDump_Signature(p, str);
+            str += "(";
+
+            while (len-- > 0)
+            {
+                str += " ";
+                JsonDump_Signature(p, str);
+                str += len ? "," : " ";
+            }
+            str += ")";
+            break;
+    }
+}
+
+static void JsonDump_Version(const CLR_RECORD_VERSION &ver, std::string &str)
+{
+    char rgBuffer[64];
+
+    sprintf_s(
+        rgBuffer,
+        ARRAYSIZE(rgBuffer),
+        "%d.%d.%d.%d",
+        ver.iMajorVersion,
+        ver.iMinorVersion,
+        ver.iBuildNumber,
+        ver.iRevisionNumber);
+
+    str = rgBuffer;
+}
+
+static void JsonDump_Table(JsonWriter &json, LPCSTR szName, CLR_UINT32 items, size_t size, size_t runtime)
+{
+    json.BeginObject(szName);
+    json.Number("bytes", items * size);
+    json.Number("items", items);
+
+    if (runtime)
+    {
+        json.Number("runtime", items * runtime);
+    }
+
+    json.EndObject();
+}
+
+static void JsonDump_Assembly(JsonWriter &json, CLR_RT_Assembly *assm, bool fNoByteCode)
+{
+    const auto &tables = assm->m_pTablesSize;
+    std::vector<CLR_IDX> fieldOwner(tables[TBL_FieldDef], CLR_EmptyIndex);
+    std::vector<CLR_IDX> methodOwner(tables[TBL_MethodDef], CLR_EmptyIndex);
+    std::string str;
+    int i;
+
+    //
+    // Dump_FieldOwner/Dump_MethodOwner scan the TypeDef table for every member, build the reverse maps once instead.
+    //
+    for (i = 0; i < tables[TBL_TypeDef]; i++)
+    {
+        const CLR_RECORD_TYPEDEF *p = assm->GetTypeDef(i);
+        CLR_UINT32 numMethods = p->sMethods_Num + p->iMethods_Num + p->vMethods_Num;
+        CLR_UINT32 j;
+
+        for (j = 0; j < p->iFields_Num && p->iFields_First + j < fieldOwner.size(); j++)
+            fieldOwner[p->iFields_First + j] = i;
+        for (j = 0; j < p->sFields_Num && p->sFields_First + j < fieldOwner.size(); j++)
+            fieldOwner[p->sFields_First + j] = i;
+        for (j = 0; j < numMethods && p->methods_First + j < methodOwner.size(); j++)
+            methodOwner[p->methods_First + j] = i;
+    }
+
+    json.BeginObject();
+
+    json.String("name", assm->m_szName);
+    JsonDump_Version(assm->m_header->version, str);
+    json.String("version", str.c_str());
+
+    json.BeginObject("tables");
+    JsonDump_Table(
+        json,
+        "AssemblyRef",
+        tables[TBL_AssemblyRef],
+        sizeof(CLR_RECORD_ASSEMBLYREF),
+        sizeof(CLR_RT_AssemblyRef_CrossReference));
+    JsonDump_Table(
+        json,
+        "TypeRef",
+        tables[TBL_TypeRef],
+        sizeof(CLR_RECORD_TYPEREF),
+        sizeof(CLR_RT_TypeRef_CrossReference));
+    JsonDump_Table(
+        json,
+        "FieldRef",
+        tables[TBL_FieldRef],
+        sizeof(CLR_RECORD_FIELDREF),
+        sizeof(CLR_RT_FieldRef_CrossReference));
+    JsonDump_Table(
+        json,
+        "MethodRef",
+        tables[TBL_MethodRef],
+        sizeof(CLR_RECORD_METHODREF),
+        sizeof(CLR_RT_MethodRef_CrossReference));
+    JsonDump_Table(
+        json,
+        "TypeDef",
+        tables[TBL_TypeDef],
+        sizeof(CLR_RECORD_TYPEDEF),
+        sizeof(CLR_RT_TypeDef_CrossReference));
+    JsonDump_Table(
+        json,
+        "FieldDef",
+        tables[TBL_FieldDef],
+        sizeof(CLR_RECORD_FIELDDEF),
+        sizeof(CLR_RT_FieldDef_CrossReference));
+    JsonDump_Table(
+        json,
+        "MethodDef",
+        tables[TBL_MethodDef],
+        sizeof(CLR_RECORD_METHODDEF),
+        sizeof(CLR_RT_MethodDef_CrossReference));
+    JsonDump_Table(json, "Attributes", tables[TBL_Attributes], sizeof(CLR_RECORD_ATTRIBUTE), 0);
+    JsonDump_Table(json, "TypeSpec", tables[TBL_TypeSpec], sizeof(CLR_RECORD_TYPESPEC), 0);
+    JsonDump_Table(json, "ResourcesFiles", tables[TBL_ResourcesFiles], sizeof(CLR_RECORD_RESOURCE_FILE), 0);
+    JsonDump_Table(json, "Resources", tables[TBL_Resources], sizeof(CLR_RECORD_RESOURCE), 0);
+    json.Number("ResourcesData", tables[TBL_ResourcesData]);
+    json.Number("Strings", tables[TBL_Strings]);
+    json.Number("Signatures", tables[TBL_Signatures]);
+    json.Number("ByteCode", tables[TBL_ByteCode]);
+    json.EndObject();
+
+    json.BeginArray("assemblyRefs");
+    for (i = 0; i < tables[TBL_AssemblyRef]; i++)
+    {
+        const CLR_RECORD_ASSEMBLYREF *p = assm->GetAssemblyRef(i);
+
+        json.BeginObject();
+        json.Number("index", i);
+        json.String("name", assm->GetString(p->name));
+        JsonDump_Version(p->version, str);
+        json.String("version", str.c_str());
+        json.EndObject();
+    }
+    json.EndArray();
+
+    json.BeginArray("typeRefs");
+    for (i = 0; i < tables[TBL_TypeRef]; i++)
+    {
+        const CLR_RECORD_TYPEREF *p = assm->GetTypeRef(i);
+
+        json.BeginObject();
+        json.Number("index", i);
+        json.Number("scope", p->scope);
+        json.String("namespace", assm->GetString(p->nameSpace));
+        json.String("name", assm->GetString(p->name));
+        json.EndObject();
+    }
+    json.EndArray();
+
+    json.BeginArray("fieldRefs");
+    for (i = 0; i < tables[TBL_FieldRef]; i++)
+    {
+        const CLR_RECORD_FIELDREF *p = assm->GetFieldRef(i);
+
+        json.BeginObject();
+        json.Number("index", i);
+        json.Number("container", p->container);
+        json.String("name", assm->GetString(p->name));
+        JsonDump_Signature(assm, p->sig, str);
+        json.String("signature", str.c_str());
+        json.EndObject();
+    }
+    json.EndArray();
+
+    json.BeginArray("methodRefs");
+    for (i = 0; i < tables[TBL_MethodRef]; i++)
+    {
+        const CLR_RECORD_METHODREF *p = assm->GetMethodRef(i);
+
+        json.BeginObject();
+        json.Number("index", i);
+        json.Number("container", p->container);
+        json.String("name", assm->GetString(p->name));
+        JsonDump_Signature(assm, p->sig, str);
+        json.String("signature", str.c_str());
+        json.EndObject();
+    }
+    json.EndArray();
+
+    json.BeginArray("typeDefs");
+    for (i = 0; i < tables[TBL_TypeDef]; i++)
+    {
+        const CLR_RECORD_TYPEDEF *p = assm->GetTypeDef(i);
+
+        json.BeginObject();
+        json.Number("index", i);
+        json.String("namespace", assm->GetString(p->nameSpace));
+        json.String("name", assm->GetString(p->name));
+        json.Number("flags", p->flags);
+        json.Number("extends", p->extends);
+        json.Number("enclosingType", p->enclosingType);
+        json.Number("methodsFirst", p->methods_First);
+        json.Number("methodsNum", p->sMethods_Num + p->iMethods_Num + p->vMethods_Num);
+        json.Number("instanceFieldsFirst", p->iFields_First);
+        json.Number("instanceFieldsNum", p->iFields_Num);
+        json.Number("staticFieldsFirst", p->sFields_First);
+        json.Number("staticFieldsNum", p->sFields_Num);
+        json.EndObject();
+    }
+    json.EndArray();
+
+    json.BeginArray("fieldDefs");
+    for (i = 0; i < tables[TBL_FieldDef]; i++)
+    {
+        const CLR_RECORD_FIELDDEF *p = assm->GetFieldDef(i);
+
+        json.BeginObject();
+        json.Number("index", i);
+        json.Number("owner", fieldOwner[i]);
+        json.String("name", assm->GetString(p->name));
+        json.Number("flags", p->flags);
+        JsonDump_Signature(assm, p->sig, str);
+        json.String("signature", str.c_str());
+        json.EndObject();
+    }
+    json.EndArray();
+
+    json.BeginArray("methodDefs");
+    for (i = 0; i < tables[TBL_MethodDef]; i++)
+    {
+        const CLR_RECORD_METHODDEF *p = assm->GetMethodDef(i);
+        CLR_OFFSET start;
+        CLR_OFFSET end;
+
+        json.BeginObject();
+        json.Number("index", i);
+        json.Number("owner", methodOwner[i]);
+        json.String("name", assm->GetString(p->name));
+        json.Number("flags", p->flags);
+        json.Number("rva", p->RVA);
+        JsonDump_Signature(assm, p->sig, str);
+        json.String("signature", str.c_str());
+
+        if (WatchAssemblyBuilder::FindMethodBoundaries(assm, i, start, end))
+        {
+            json.Number("byteCodeSize", end - start);
+
+            if (!fNoByteCode)
+            {
+                json.Hex("byteCode", assm->GetByteCode(start), end - start);
+            }
+        }
+
+        json.EndObject();
+    }
+    json.EndArray();
+
+    json.BeginArray("attributes");
+    for (i = 0; i < tables[TBL_Attributes]; i++)
+    {
+        const CLR_RECORD_ATTRIBUTE *p = assm->GetAttribute(i);
+
+        json.BeginObject();
+        json.Number("index", i);
+        json.Number("ownerType", p->ownerType);
+        json.Number("ownerIdx", p->ownerIdx);
+        json.Number("constructor", p->constructor);
+        json.Number("data", p->data);
+        json.EndObject();
+    }
+    json.EndArray();
+
+    // the last entry of the table is a sentinel marking the end of the resource data
+    json.BeginArray("resources");
+    for (i = 0; i < (int)tables[TBL_Resources] - 1; i++)
+    {
+        const CLR_RECORD_RESOURCE *p = assm->GetResource(i);
+        const CLR_RECORD_RESOURCE *pNext = assm->GetResource(i + 1);
+
+        json.BeginObject();
+        json.Number("index", i);
+        json.Number("id", p->id);
+        json.Number("kind", p->kind);
+        json.Number("offset", p->offset);
+        json.Number("size", pNext->offset - p->offset);
+        json.EndObject();
+    }
+    json.EndArray();
+
+    json.EndObject();
+}
+
+//--//
+
+static void JsonDump_Worker(
+    std::vector<CLR_RT_Assembly *> &assemblies,
+    std::vector<std::string> &results,
+    bool fNoByteCode,
+    LONG volatile *next)
+{
+    while (true)
+    {
+        size_t pos = (size_t)(::InterlockedIncrement(next) - 1);
+
+        if (pos >= assemblies.size())
+            break;
+
+        JsonWriter json(NULL);
+
+        JsonDump_Assembly(json, assemblies[pos], fNoByteCode);
+
+        results[pos] = json.GetBuffer();
+    }
+}
+
+//
+// Each assembly is rendered independently on a worker thread, then the results are written in load order so the
+// output doesn't depend on the number of threads.
+//
+HRESULT JsonDump::Dump(LPCWSTR szFileName, bool fNoByteCode)
+{
+    NANOCLR_HEADER();
+
+    std::vector<CLR_RT_Assembly *> assemblies;
+    std::vector<std::string> results;
+    std::vector<std::thread> workers;
+    LONG volatile next = 0;
+    FILE *output = NULL;
+
+    NANOCLR_FOREACH_ASSEMBLY(g_CLR_RT_TypeSystem)
+    {
+        assemblies.push_back(pASSM);
+    }
+    NANOCLR_FOREACH_ASSEMBLY_END();
+
+    if (szFileName)
+    {
+        if (_wfopen_s(&output, szFileName, L"wb") != 0)
+        {
+            NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FILE_IO, L"Cannot open '%s' for writing!\n", szFileName);
+        }
+    }
+    else
+    {
+        output = stdout;
+    }
+
+    results.resize(assemblies.size());
+
+    {
+        size_t numWorkers = std::thread::hardware_concurrency();
+
+        if (numWorkers > assemblies.size())
+            numWorkers = assemblies.size();
+
+        for (size_t i = 1; i < numWorkers; i++)
+        {
+            workers.push_back(
+                std::thread(JsonDump_Worker, std::ref(assemblies), std::ref(results), fNoByteCode, &next));
+        }
+
+        JsonDump_Worker(assemblies, results, fNoByteCode, &next);
+
+        for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); it++)
+        {
+            it->join();
+        }
+    }
+
+    {
+        JsonWriter json(output);
+
+        json.BeginObject();
+        json.BeginArray("assemblies");
+
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            json.Raw(results[i]);
+            json.NewLine();
+
+            results[i].clear();
+            results[i].shrink_to_fit();
+        }
+
+        json.EndArray();
+        json.EndObject();
+        json.NewLine();
+    }
+
+    NANOCLR_CLEANUP();
+
+    if (output && output != stdout)
+    {
+        fclose(output);
+    }
+
+    NANOCLR_CLEANUP_END();
+}
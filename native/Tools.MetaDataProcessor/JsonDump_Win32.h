@@ -0,0 +1,55 @@
+//
+// Copyright (c) 2017 The nanoFramework project contributors
+// Portions Copyright (c) Microsoft Corporation.  All rights reserved.
+// See LICENSE file in the project root for full license information.
+//
+
+#pragma once
+
+//
+// Minimal streaming JSON writer, there's no document tree: values are escaped straight into a buffer that is
+// flushed to the output file whenever it grows past c_FlushThreshold. Without an output file the buffer simply keeps
+// everything, so a whole assembly can be rendered on a worker thread and written out later.
+//
+class JsonWriter
+{
+    static const size_t c_FlushThreshold = 64 * 1024;
+
+    FILE *m_output;
+    std::string m_buffer;
+    std::vector<bool> m_first;
+
+    void Separator();
+    void Name(LPCSTR szName);
+    void Escape(LPCSTR sz);
+    void CheckFlush();
+
+  public:
+    JsonWriter(FILE *output);
+    ~JsonWriter();
+
+    void BeginObject(LPCSTR szName = NULL);
+    void EndObject();
+    void BeginArray(LPCSTR szName = NULL);
+    void EndArray();
+
+    void String(LPCSTR szName, LPCSTR sz);
+    void Number(LPCSTR szName, CLR_INT64 val);
+    void Hex(LPCSTR szName, const CLR_UINT8 *data, size_t len);
+
+    void Raw(const std::string &json);
+    void NewLine();
+    void Flush();
+
+    const std::string &GetBuffer() const
+    {
+        return m_buffer;
+    }
+};
+
+//--//
+
+struct JsonDump
+{
+    static HRESULT Dump(LPCWSTR szFileName, bool fNoByteCode);
+};
@@ -36,14 +36,43 @@ void RtosYield()
 
 struct Settings : CLR_RT_ParseOptions
 {
+    //
+    // A database mapped copy-on-write, the assemblies it contains are used in place.
+    //
+    struct MappedFile
+    {
+        HANDLE m_hFile;
+        HANDLE m_hMapping;
+        CLR_UINT8 *m_data;
+        size_t m_size;
+    };
+
+    typedef std::list<MappedFile> MappedFileList;
+    typedef MappedFileList::iterator MappedFileListIter;
+
+    typedef std::vector<CLR_RECORD_ASSEMBLY *> AssemblyHeaderVector;
+    typedef AssemblyHeaderVector::iterator AssemblyHeaderVectorIter;
+
+    //--//
+
     PELoader peLoader;
     MetaData::Collection metaDataCollention;
     MetaData::Parser *metaDataParser;
     bool generalFlag;
     CLR_RT_Assembly *currentAssembly;
     CLR_RT_ParseOptions::BufferMap bufferMap;
+    MappedFileList mappedFiles;
 
     bool dumpStatistics;
+    bool pdbxBinary;
+    bool foldMethods;
+    bool optimizeByteCode;
+    bool compactLocals;
+    std::wstring profileFile;
+    std::wstring sizeReportFile;
+    std::wstring benchmarkBaselineFile;
+    std::wstring stringPoolFile;
+    bool databaseDirectory;
 
     WatchAssemblyBuilder::Linker linkerForStrings;
 
@@ -56,6 +85,59 @@ struct Settings : CLR_RT_ParseOptions
 
     CLR_RT_StringSet resources;
 
+    std::wstring watchAssembly;
+    std::wstring watchOutput;
+    bool watchMinimize;
+    CLR_RT_StringSet watchResources;
+
+    //--//
+
+    typedef std::map<std::wstring, FILETIME> WatchFileMap;
+    typedef WatchFileMap::iterator WatchFileMapIter;
+
+    static const DWORD c_WatchSettleTime = 100;
+
+    typedef std::map<std::string, CLR_UINT32> StringPoolMap;
+    typedef StringPoolMap::iterator StringPoolMapIter;
+
+    struct DatabaseEntry
+    {
+        std::wstring m_file;
+        size_t m_offset;
+        size_t m_size;
+        HRESULT m_hr;
+    };
+
+    typedef std::vector<DatabaseEntry> DatabaseEntryVector;
+    typedef DatabaseEntryVector::iterator DatabaseEntryVectorIter;
+
+    struct DeploymentAssembly
+    {
+        CLR_RECORD_ASSEMBLY *m_header;
+        CLR_UINT32 m_hash;
+        size_t m_offset;
+    };
+
+    typedef std::map<std::string, DeploymentAssembly> DeploymentAssemblyMap;
+    typedef DeploymentAssemblyMap::iterator DeploymentAssemblyMapIter;
+
+    typedef std::vector<std::string> AssemblyNameVector;
+    typedef AssemblyNameVector::iterator AssemblyNameVectorIter;
+
+    typedef std::vector<NanoDatabaseDeltaChunk> DeltaChunkVector;
+    typedef DeltaChunkVector::iterator DeltaChunkVectorIter;
+
+    struct AssemblyScan
+    {
+        CLR_RT_Assembly *m_assm;
+        CLR_UINT32 m_hash;
+        std::vector<CLR_RT_Assembly *> m_refs; // NULL when the reference can't be found
+        std::vector<std::string> m_typeNames;  // empty for the types used by the runtime
+    };
+
+    typedef std::vector<AssemblyScan> AssemblyScanVector;
+    typedef AssemblyScanVector::iterator AssemblyScanVectorIter;
+
     //--//
 
     struct Command_Call : CLR_RT_ParseOptions::Command
@@ -81,6 +163,11 @@ struct Settings : CLR_RT_ParseOptions
         generalFlag = false;
 
         dumpStatistics = false;
+        pdbxBinary = false;
+        foldMethods = false;
+        optimizeByteCode = false;
+        compactLocals = false;
+        databaseDirectory = false;
 
         patchToReboot = false;
 
@@ -106,12 +193,18 @@ struct Settings : CLR_RT_ParseOptions
             delete it->second;
         }
 
+        for (MappedFileListIter it = mappedFiles.begin(); it != mappedFiles.end(); it++)
+        {
+            UnmapFile(*it);
+        }
+
         peLoader.Close();                // PELoader                       peLoader;
         metaDataCollention.Clear(false); // MetaData::Collection metaDataCollention;
         metaDataParser = NULL;           // MetaData::Parser*              metaDataParser;
                                          // bool                           generalFlag;
         currentAssembly = NULL;          // CLR_RT_Assembly*               currentAssembly;
         bufferMap.clear();               // CLR_RT_ParseOptions::BufferMap bufferMap;
+        mappedFiles.clear();             // MappedFileList                 mappedFiles;
                                          //
         dumpStatistics = false;          // bool                           dumpStatistics;
                                          //
@@ -124,6 +217,13 @@ struct Settings : CLR_RT_ParseOptions
         fromAssembly = false;            // bool                           fromAssembly;
         fromImage = false;               // bool                           fromImage;
                                          // bool                           noByteCode;
+                                         //
+                                         // CLR_RT_StringSet               resources;
+                                         //
+        watchAssembly.clear();           // std::wstring                   watchAssembly;
+        watchOutput.clear();             // std::wstring                   watchOutput;
+        watchMinimize = false;           // bool                           watchMinimize;
+        watchResources.clear();          // CLR_RT_StringSet               watchResources;
     }
 
     //--//
@@ -152,6 +252,233 @@ struct Settings : CLR_RT_ParseOptions
         }
     }
 
+    static HRESULT MapFile(LPCWSTR szFile, MappedFile &file)
+    {
+        NANOCLR_HEADER();
+
+        LARGE_INTEGER size;
+
+        file.m_hMapping = NULL;
+        file.m_data = NULL;
+        file.m_size = 0;
+
+        file.m_hFile =
+            ::CreateFileW(szFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file.m_hFile == INVALID_HANDLE_VALUE)
+        {
+            NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FILE_IO, L"Cannot open '%s'\n", szFile);
+        }
+
+        if (::GetFileSizeEx(file.m_hFile, &size) == FALSE || size.QuadPart == 0 || size.HighPart != 0)
+        {
+            NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FILE_IO, L"Invalid size for '%s'\n", szFile);
+        }
+
+        //
+        // Copy-on-write, so the file is never modified even if the type system writes to the records.
+        //
+        file.m_hMapping = ::CreateFileMappingW(file.m_hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        if (file.m_hMapping == NULL)
+        {
+            NANOCLR_SET_AND_LEAVE(CLR_E_FILE_IO);
+        }
+
+        file.m_data = (CLR_UINT8 *)::MapViewOfFile(file.m_hMapping, FILE_MAP_COPY, 0, 0, 0);
+        if (file.m_data == NULL)
+        {
+            NANOCLR_SET_AND_LEAVE(CLR_E_FILE_IO);
+        }
+
+        file.m_size = (size_t)size.QuadPart;
+
+        NANOCLR_CLEANUP();
+
+        if (FAILED(hr))
+        {
+            UnmapFile(file);
+        }
+
+        NANOCLR_CLEANUP_END();
+    }
+
+    static void UnmapFile(MappedFile &file)
+    {
+        if (file.m_data)
+        {
+            ::UnmapViewOfFile(file.m_data);
+
+            file.m_data = NULL;
+        }
+
+        if (file.m_hMapping)
+        {
+            ::CloseHandle(file.m_hMapping);
+
+            file.m_hMapping = NULL;
+        }
+
+        if (file.m_hFile != INVALID_HANDLE_VALUE)
+        {
+            ::CloseHandle(file.m_hFile);
+
+            file.m_hFile = INVALID_HANDLE_VALUE;
+        }
+
+        file.m_size = 0;
+    }
+
+    //--//
+
+    static CLR_UINT32 HashAssemblyName(LPCSTR szName)
+    {
+        return SUPPORT_ComputeCRC(szName, (int)hal_strlen_s(szName), 0);
+    }
+
+    //
+    // Returns the directory of a database, or NULL if there's none or it doesn't match the file.
+    //
+    static const NanoDatabaseDirectoryFooter *GetDatabaseDirectory(MappedFile &file)
+    {
+        const NanoDatabaseDirectoryFooter *footer;
+        const NanoDatabaseDirectoryEntry *entries;
+        size_t end;
+
+        if (file.m_size < sizeof(NanoDatabaseDirectoryFooter))
+            return NULL;
+
+        end = file.m_size - sizeof(NanoDatabaseDirectoryFooter);
+        footer = (const NanoDatabaseDirectoryFooter *)&file.m_data[end];
+
+        if (footer->magicNumber != NanoDatabaseDirectoryFooter::MAGIC_NUMBER ||
+            footer->version != NanoDatabaseDirectoryFooter::VERSION || footer->offsetEntries > end ||
+            (CLR_UINT64)footer->numberOfEntries * sizeof(NanoDatabaseDirectoryEntry) > end - footer->offsetEntries)
+            return NULL;
+
+        entries = (const NanoDatabaseDirectoryEntry *)&file.m_data[footer->offsetEntries];
+
+        if (SUPPORT_ComputeCRC(entries, (int)(footer->numberOfEntries * sizeof(NanoDatabaseDirectoryEntry)), 0) !=
+            footer->crcEntries)
+            return NULL;
+
+        for (CLR_UINT32 i = 0; i < footer->numberOfEntries; i++)
+        {
+            if (entries[i].offset > footer->offsetEntries || entries[i].size < sizeof(CLR_RECORD_ASSEMBLY) ||
+                entries[i].size > footer->offsetEntries - entries[i].offset)
+                return NULL;
+        }
+
+        return footer;
+    }
+
+    //
+    // The header has to be sound and match the directory before the assembly CRC can be trusted to stay in the entry.
+    //
+    static bool ValidateDatabase_Entry(MappedFile &file, const NanoDatabaseDirectoryEntry &entry)
+    {
+        CLR_RECORD_ASSEMBLY *header = (CLR_RECORD_ASSEMBLY *)&file.m_data[entry.offset];
+
+        return header->GoodHeader() && header->TotalSize() == entry.size && header->assemblyCRC == entry.assemblyCRC &&
+               header->GoodAssembly();
+    }
+
+    static void ValidateDatabase_Entries(
+        MappedFile &file,
+        const NanoDatabaseDirectoryEntry *entries,
+        std::vector<HRESULT> &results,
+        LONG volatile *next)
+    {
+        while (true)
+        {
+            size_t pos = (size_t)(::InterlockedIncrement(next) - 1);
+
+            if (pos >= results.size())
+                break;
+
+            results[pos] = ValidateDatabase_Entry(file, entries[pos]) ? S_OK : CLR_E_FAIL;
+        }
+    }
+
+    //
+    // Lists the assemblies of a database. With a directory they are validated in parallel and any corruption is an
+    // error, without one the image is walked like the device does, stopping at the first invalid header.
+    //
+    HRESULT ListDatabase(LPCWSTR szFile, MappedFile &file, AssemblyHeaderVector &headers)
+    {
+        NANOCLR_HEADER();
+
+        const NanoDatabaseDirectoryFooter *footer = GetDatabaseDirectory(file);
+
+        if (footer)
+        {
+            const NanoDatabaseDirectoryEntry *entries =
+                (const NanoDatabaseDirectoryEntry *)&file.m_data[footer->offsetEntries];
+            std::vector<HRESULT> results(footer->numberOfEntries, S_OK);
+            std::vector<std::thread> workers;
+            LONG volatile next = 0;
+            size_t numWorkers = std::thread::hardware_concurrency();
+
+            if (numWorkers > results.size())
+                numWorkers = results.size();
+
+            for (size_t i = 1; i < numWorkers; i++)
+            {
+                workers.push_back(
+                    std::thread(ValidateDatabase_Entries, std::ref(file), entries, std::ref(results), &next));
+            }
+
+            ValidateDatabase_Entries(file, entries, results, &next);
+
+            for (size_t i = 0; i < workers.size(); i++)
+            {
+                workers[i].join();
+            }
+
+            for (size_t i = 0; i < results.size(); i++)
+            {
+                if (FAILED(results[i]))
+                {
+                    NANOCLR_MSG1_SET_AND_LEAVE(
+                        CLR_E_FAIL,
+                        L"Invalid assembly at offset 0x%08X of '%s'\n",
+                        entries[i].offset,
+                        szFile);
+                }
+
+                headers.push_back((CLR_RECORD_ASSEMBLY *)&file.m_data[entries[i].offset]);
+            }
+        }
+        else
+        {
+            CLR_RECORD_ASSEMBLY *header = (CLR_RECORD_ASSEMBLY *)&file.m_data[0];
+            CLR_UINT8 *dataEnd = &file.m_data[file.m_size];
+
+            //
+            // The header CRC covers TotalSize, which has to fit in the file before the assembly CRC can be computed
+            // over that many bytes.
+            //
+            while ((CLR_UINT8 *)(header + 1) <= dataEnd && header->GoodHeader())
+            {
+                if ((CLR_UINT8 *)header + header->TotalSize() > dataEnd)
+                {
+                    // header checksum passed, but not enough data in assembly
+                    _ASSERTE(FALSE);
+                    break;
+                }
+
+                if (header->GoodAssembly() == false)
+                {
+                    break;
+                }
+
+                headers.push_back(header);
+
+                header = (CLR_RECORD_ASSEMBLY *)ROUNDTOMULTIPLE((size_t)header + header->TotalSize(), CLR_UINT32);
+            }
+        }
+
+        NANOCLR_NOCLEANUP();
+    }
+
     HRESULT CheckAssemblyFormat(CLR_RECORD_ASSEMBLY *header, LPCWSTR src)
     {
         NANOCLR_HEADER();
@@ -233,6 +560,36 @@ struct Settings : CLR_RT_ParseOptions
         NANOCLR_NOCLEANUP_NOLABEL();
     }
 
+    HRESULT Cmd_HeapSize(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        int size = _wtoi(PARAM_EXTRACT_STRING(params, 0));
+
+        if (size <= 0 || (unsigned int)size > HAL_Windows::c_Memory_MaxSize / (1024 * 1024))
+        {
+            NANOCLR_MSG1_SET_AND_LEAVE(
+                CLR_E_INVALID_PARAMETER,
+                L"The heap size must be between 1 and %d MB\n",
+                HAL_Windows::c_Memory_MaxSize / (1024 * 1024));
+        }
+
+        NANOCLR_FOREACH_ASSEMBLY(g_CLR_RT_TypeSystem)
+        {
+            NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"-heapSize must come before any assembly is loaded\n");
+        }
+        NANOCLR_FOREACH_ASSEMBLY_END();
+
+        if (FAILED(HAL_Windows::Memory_Resize((unsigned int)size * 1024 * 1024)))
+        {
+            NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_OUT_OF_MEMORY, L"Cannot reserve two heaps of %d MB\n", size);
+        }
+
+        CLR_RT_Memory::Reset();
+
+        NANOCLR_NOCLEANUP();
+    }
+
     HRESULT Cmd_ResetHints(CLR_RT_ParseOptions::ParameterList *params = NULL)
     {
         NANOCLR_HEADER();
@@ -274,7 +631,9 @@ struct Settings : CLR_RT_ParseOptions
         if (!metaDataParser)
             NANOCLR_CHECK_HRESULT(metaDataCollention.CreateAssembly(metaDataParser));
 
-        NANOCLR_CHECK_HRESULT(metaDataParser->Analyze(PARAM_EXTRACT_STRING(params, 0)));
+        watchAssembly = PARAM_EXTRACT_STRING(params, 0);
+
+        NANOCLR_CHECK_HRESULT(metaDataParser->Analyze(watchAssembly.c_str()));
 
         NANOCLR_NOCLEANUP();
     }
@@ -339,6 +698,8 @@ struct Settings : CLR_RT_ParseOptions
             NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"MetaDataParser failed when minimizing\n");
         }
 
+        watchMinimize = true;
+
         NANOCLR_CHECK_HRESULT(metaDataParser->RemoveUnused());
 
         NANOCLR_CHECK_HRESULT(metaDataParser->VerifyConsistency());
@@ -399,6 +760,18 @@ struct Settings : CLR_RT_ParseOptions
     {
         NANOCLR_HEADER();
 
+        watchOutput = PARAM_EXTRACT_STRING(params, 0);
+        watchResources = resources;
+
+        NANOCLR_CHECK_HRESULT(Compile(watchOutput));
+
+        NANOCLR_NOCLEANUP();
+    }
+
+    HRESULT Compile(const std::wstring &szFile)
+    {
+        NANOCLR_HEADER();
+
         if (!metaDataParser)
         {
             NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"MetaDataParser failed when compiling\n");
@@ -415,9 +788,20 @@ struct Settings : CLR_RT_ParseOptions
             WatchAssemblyBuilder::CQuickRecord<BYTE> buf;
             MetaData::Parser prCopy = *metaDataParser;
 
-            std::wstring szFile = PARAM_EXTRACT_STRING(params, 0);
-
             lk.LoadGlobalStrings();
+            lk.SetFoldIdenticalMethods(foldMethods);
+            lk.SetOptimizeByteCode(optimizeByteCode);
+            lk.SetCompactLocals(compactLocals);
+
+            if (profileFile.size())
+            {
+                NANOCLR_CHECK_HRESULT(lk.LoadProfile(profileFile));
+            }
+
+            if (dumpStatistics)
+            {
+                MetaData::ByteCode::s_statistics.m_fEnabled = true;
+            }
 
             NANOCLR_CHECK_HRESULT(lk.Process(prCopy));
 
@@ -432,101 +816,416 @@ struct Settings : CLR_RT_ParseOptions
                 CLR_RT_FileStore::SaveFile(szFile.c_str(), (CLR_UINT8 *)buf.Ptr(), (DWORD)buf.Size()));
 
             NANOCLR_CHECK_HRESULT(lk.DumpPdbx(szFile.c_str()));
+
+            if (pdbxBinary)
+            {
+                NANOCLR_CHECK_HRESULT(lk.DumpPdbxBinary(szFile.c_str()));
+            }
+
+            if (sizeReportFile.size())
+            {
+                NANOCLR_CHECK_HRESULT(lk.DumpSizeReport(sizeReportFile, buf));
+            }
         }
 
         NANOCLR_NOCLEANUP();
     }
-    void AppendString(std::string &str, LPCSTR format, ...)
+
+    //--//
+
+    static bool Watch_GetLastWriteTime(const std::wstring &file, FILETIME &ft)
     {
-        char rgBuffer[512];
-        LPSTR szBuffer = rgBuffer;
-        size_t iBuffer = MAXSTRLEN(rgBuffer);
-        va_list arg;
+        WIN32_FILE_ATTRIBUTE_DATA fad;
 
-        va_start(arg, format);
+        if (::GetFileAttributesExW(file.c_str(), GetFileExInfoStandard, &fad) == FALSE)
+        {
+            return false;
+        }
 
-        CLR_SafeSprintfV(szBuffer, iBuffer, format, arg);
+        ft = fad.ftLastWriteTime;
 
-        str.append(rgBuffer);
+        return true;
     }
 
-    HRESULT Cmd_Load(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    //
+    // Inputs already watched keep the time seen before the last rebuild, so an edit saved while compiling still shows
+    // up as a change.
+    //
+    void Watch_CollectInputs(WatchFileMap &files)
     {
-        NANOCLR_HEADER();
+        CLR_RT_StringSet set;
+        WatchFileMap collected;
 
-        fromAssembly = false;
-        fromImage = true;
+        metaDataCollention.GetAssemblyFiles(set);
 
-        NANOCLR_CHECK_HRESULT(AllocateSystem());
+        set.insert(watchAssembly);
+        set.insert(watchResources.begin(), watchResources.end());
 
+        for (CLR_RT_StringSet::iterator it = set.begin(); it != set.end(); it++)
         {
-            LPCWSTR szName = PARAM_EXTRACT_STRING(params, 0);
-            CLR_RT_Buffer *buffer = new CLR_RT_Buffer();
-            bufferMap[szName] = buffer;
-            CLR_RECORD_ASSEMBLY *header;
-            CLR_RT_Assembly *assm;
+            WatchFileMapIter itOld = files.find(*it);
+            FILETIME &ft = collected[*it];
 
-            NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::LoadFile(szName, *buffer));
+            if (itOld != files.end())
+            {
+                ft = itOld->second;
+            }
+            else if (Watch_GetLastWriteTime(*it, ft) == false)
+            {
+                ft.dwLowDateTime = 0;
+                ft.dwHighDateTime = 0;
+            }
+        }
 
-            header = (CLR_RECORD_ASSEMBLY *)&(*buffer)[0];
-            NANOCLR_CHECK_HRESULT(CheckAssemblyFormat(header, szName));
+        files.swap(collected);
+    }
 
-            NANOCLR_CHECK_HRESULT(CLR_RT_Assembly::CreateInstance(header, assm));
+    static void Watch_FindChanges(WatchFileMap &files, CLR_RT_StringSet &changed)
+    {
+        for (WatchFileMapIter it = files.begin(); it != files.end(); it++)
+        {
+            FILETIME ft;
 
-            g_CLR_RT_TypeSystem.Link(assm);
-        }
+            // Files being rewritten can be missing for a while, wait for them to come back.
+            if (Watch_GetLastWriteTime(it->first, ft) && ::CompareFileTime(&ft, &it->second) != 0)
+            {
+                changed.insert(it->first);
 
-        NANOCLR_NOCLEANUP();
+                it->second = ft;
+            }
+        }
     }
 
-    HRESULT Cmd_LoadDatabase(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    HRESULT Watch_WaitForChanges(WatchFileMap &files, CLR_RT_StringSet &changed)
     {
         NANOCLR_HEADER();
 
-        fromAssembly = false;
-        fromImage = true;
-
-        NANOCLR_CHECK_HRESULT(AllocateSystem());
+        CLR_RT_StringSet dirs;
+        std::vector<HANDLE> handles;
 
+        for (WatchFileMapIter it = files.begin(); it != files.end(); it++)
         {
-            LPCWSTR szFile = PARAM_EXTRACT_STRING(params, 0);
-            CLR_RT_Buffer buffer;
-            CLR_RECORD_ASSEMBLY *header;
-            CLR_RECORD_ASSEMBLY *headerEnd;
-            std::wstring strName;
+            std::wstring dir = it->first;
+            std::wstring::size_type pos = dir.find_last_of(L"\\/");
 
-            NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::LoadFile(szFile, buffer));
+            if (pos == std::wstring::npos)
+            {
+                dir = L".";
+            }
+            else
+            {
+                dir.erase(pos + 1);
+            }
 
-            header = (CLR_RECORD_ASSEMBLY *)&buffer[0];
-            headerEnd = (CLR_RECORD_ASSEMBLY *)&buffer[buffer.size() - 1];
+            dirs.insert(dir);
+        }
 
-            while (header + 1 <= headerEnd && header->GoodAssembly())
-            {
-                CLR_RT_Buffer *bufferSub = new CLR_RT_Buffer();
-                CLR_RECORD_ASSEMBLY *headerSub;
-                CLR_RT_Assembly *assm;
+        if (dirs.size() > MAXIMUM_WAIT_OBJECTS)
+        {
+            NANOCLR_MSG_SET_AND_LEAVE(CLR_E_OUT_OF_RANGE, L"Too many directories to watch\n");
+        }
 
-                bufferSub->resize(header->TotalSize());
+        for (CLR_RT_StringSet::iterator it = dirs.begin(); it != dirs.end(); it++)
+        {
+            HANDLE h = ::FindFirstChangeNotificationW(
+                it->c_str(),
+                FALSE,
+                FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE);
 
-                headerSub = (CLR_RECORD_ASSEMBLY *)&(*bufferSub)[0];
+            if (h == INVALID_HANDLE_VALUE)
+            {
+                wprintf(L"Cannot watch directory '%s'\n", it->c_str());
 
-                if ((CLR_UINT8 *)header + header->TotalSize() > (CLR_UINT8 *)headerEnd)
-                {
-                    // checksum passed, but not enough data in assembly
-                    _ASSERTE(FALSE);
-                    break;
-                }
-                memcpy(headerSub, header, header->TotalSize());
+                NANOCLR_SET_AND_LEAVE(CLR_E_FILE_IO);
+            }
 
-                NANOCLR_CHECK_HRESULT(CLR_RT_Assembly::CreateInstance(headerSub, assm));
+            handles.push_back(h);
+        }
 
-                g_CLR_RT_TypeSystem.Link(assm);
+        //
+        // The notifications only cover what happens from now on, look for anything saved during the last rebuild.
+        //
+        Watch_FindChanges(files, changed);
 
-                CLR_RT_UnicodeHelper::ConvertFromUTF8(assm->m_szName, strName);
-                bufferMap[strName] = bufferSub;
+        while (changed.empty())
+        {
+            DWORD res = ::WaitForMultipleObjects((DWORD)handles.size(), &handles[0], FALSE, INFINITE);
 
-                header = (CLR_RECORD_ASSEMBLY *)ROUNDTOMULTIPLE((size_t)header + header->TotalSize(), CLR_UINT32);
+            if (res >= WAIT_OBJECT_0 + handles.size())
+            {
+                NANOCLR_SET_AND_LEAVE(CLR_E_FAIL);
             }
+
+            ::FindNextChangeNotification(handles[res - WAIT_OBJECT_0]);
+
+            //
+            // The compiler writes its output in several chunks, give it time to finish before looking at the files.
+            //
+            ::Sleep(c_WatchSettleTime);
+
+            Watch_FindChanges(files, changed);
+        }
+
+        NANOCLR_CLEANUP();
+
+        for (size_t i = 0; i < handles.size(); i++)
+        {
+            ::FindCloseChangeNotification(handles[i]);
+        }
+
+        NANOCLR_CLEANUP_END();
+    }
+
+    HRESULT Watch_Rebuild(const MetaData::Parser &prTemplate)
+    {
+        NANOCLR_HEADER();
+
+        NANOCLR_CHECK_HRESULT(metaDataCollention.CreateAssembly(metaDataParser));
+
+        metaDataParser->m_fVerboseMinimize = prTemplate.m_fVerboseMinimize;
+        metaDataParser->m_fNoByteCode = prTemplate.m_fNoByteCode;
+        metaDataParser->m_fNoAttributes = prTemplate.m_fNoAttributes;
+        metaDataParser->m_setFilter_ExcludeClassByName = prTemplate.m_setFilter_ExcludeClassByName;
+
+        NANOCLR_CHECK_HRESULT(metaDataParser->Analyze(watchAssembly.c_str()));
+
+        if (watchMinimize)
+        {
+            NANOCLR_CHECK_HRESULT(metaDataParser->RemoveUnused());
+
+            NANOCLR_CHECK_HRESULT(metaDataParser->VerifyConsistency());
+        }
+
+        resources = watchResources;
+
+        NANOCLR_CHECK_HRESULT(Compile(watchOutput));
+
+        NANOCLR_NOCLEANUP();
+    }
+
+    HRESULT Cmd_Watch(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        MetaData::Parser prTemplate(&metaDataCollention);
+        WatchFileMap files;
+
+        if (!metaDataParser || watchAssembly.empty() || watchOutput.empty())
+        {
+            NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"Watch requires a previous -parse and -compile\n");
+        }
+
+        prTemplate.m_fVerboseMinimize = metaDataParser->m_fVerboseMinimize;
+        prTemplate.m_fNoByteCode = metaDataParser->m_fNoByteCode;
+        prTemplate.m_fNoAttributes = metaDataParser->m_fNoAttributes;
+        prTemplate.m_setFilter_ExcludeClassByName = metaDataParser->m_setFilter_ExcludeClassByName;
+
+        wprintf(L"Watching '%s' for changes, press Ctrl+C to stop...\n", watchAssembly.c_str());
+
+        while (true)
+        {
+            CLR_RT_StringSet changed;
+            DWORD start;
+
+            Watch_CollectInputs(files);
+
+            //
+            // Only the assembly being compiled is analyzed again.
+            // The parsers for its dependencies stay in the collection and are reused, unless their file changed.
+            // Releasing the main parser also closes its metadata scope, so the compiler can overwrite the file.
+            //
+            metaDataCollention.ReleaseAssembly(metaDataParser);
+            metaDataParser = NULL;
+
+            NANOCLR_CHECK_HRESULT(Watch_WaitForChanges(files, changed));
+
+            for (CLR_RT_StringSet::iterator it = changed.begin(); it != changed.end(); it++)
+            {
+                wprintf(L"Detected change in '%s'\n", it->c_str());
+
+                metaDataCollention.ReleaseAssembly(*it);
+            }
+
+            start = ::GetTickCount();
+
+            hr = Watch_Rebuild(prTemplate);
+
+            if (SUCCEEDED(hr))
+            {
+                wprintf(L"Compiled '%s' in %u ms\n", watchOutput.c_str(), ::GetTickCount() - start);
+            }
+            else
+            {
+                ErrorReporting::Print(
+                    watchAssembly.c_str(),
+                    NULL,
+                    TRUE,
+                    0,
+                    L"%S (%S)",
+                    CLR_RT_DUMP::GETERRORMESSAGE(hr),
+                    CLR_RT_DUMP::GETERRORDETAIL());
+            }
+
+            fflush(stdout);
+        }
+
+        NANOCLR_NOCLEANUP();
+    }
+    void AppendString(std::string &str, LPCSTR format, ...)
+    {
+        char rgBuffer[512];
+        LPSTR szBuffer = rgBuffer;
+        size_t iBuffer = MAXSTRLEN(rgBuffer);
+        va_list arg;
+
+        va_start(arg, format);
+
+        CLR_SafeSprintfV(szBuffer, iBuffer, format, arg);
+
+        str.append(rgBuffer);
+    }
+
+    HRESULT Cmd_Load(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        fromAssembly = false;
+        fromImage = true;
+
+        NANOCLR_CHECK_HRESULT(AllocateSystem());
+
+        {
+            LPCWSTR szName = PARAM_EXTRACT_STRING(params, 0);
+            CLR_RT_Buffer *buffer = new CLR_RT_Buffer();
+            bufferMap[szName] = buffer;
+            CLR_RECORD_ASSEMBLY *header;
+            CLR_RT_Assembly *assm;
+
+            NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::LoadFile(szName, *buffer));
+
+            header = (CLR_RECORD_ASSEMBLY *)&(*buffer)[0];
+            NANOCLR_CHECK_HRESULT(CheckAssemblyFormat(header, szName));
+
+            NANOCLR_CHECK_HRESULT(CLR_RT_Assembly::CreateInstance(header, assm));
+
+            g_CLR_RT_TypeSystem.Link(assm);
+        }
+
+        NANOCLR_NOCLEANUP();
+    }
+
+    HRESULT Cmd_LoadDatabase(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        fromAssembly = false;
+        fromImage = true;
+
+        NANOCLR_CHECK_HRESULT(AllocateSystem());
+
+        {
+            LPCWSTR szFile = PARAM_EXTRACT_STRING(params, 0);
+            MappedFile file;
+            AssemblyHeaderVector headers;
+
+            NANOCLR_CHECK_HRESULT(MapFile(szFile, file));
+
+            //
+            // The assemblies are used in place, the mapping lives until the next reset.
+            //
+            mappedFiles.push_back(file);
+
+            NANOCLR_CHECK_HRESULT(ListDatabase(szFile, file, headers));
+
+            for (AssemblyHeaderVectorIter it = headers.begin(); it != headers.end(); it++)
+            {
+                CLR_RT_Assembly *assm;
+
+                NANOCLR_CHECK_HRESULT(CLR_RT_Assembly::CreateInstance(*it, assm));
+
+                g_CLR_RT_TypeSystem.Link(assm);
+            }
+        }
+
+        NANOCLR_NOCLEANUP();
+    }
+
+    //
+    // Loads a single assembly out of a database, straight through its directory when there's one.
+    //
+    HRESULT Cmd_LoadDatabaseAssembly(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        fromAssembly = false;
+        fromImage = true;
+
+        NANOCLR_CHECK_HRESULT(AllocateSystem());
+
+        {
+            LPCWSTR szFile = PARAM_EXTRACT_STRING(params, 0);
+            std::string strName;
+            std::string strHeaderName;
+            std::map<std::string, CLR_OFFSET> globals;
+            CLR_UINT32 nameHash;
+            MappedFile file;
+            const NanoDatabaseDirectoryFooter *footer;
+            AssemblyHeaderVector headers;
+
+            CLR_RT_Assembly::InitString(globals);
+            CLR_RT_UnicodeHelper::ConvertToUTF8(PARAM_EXTRACT_STRING(params, 1), strName);
+            nameHash = HashAssemblyName(strName.c_str());
+
+            NANOCLR_CHECK_HRESULT(MapFile(szFile, file));
+
+            mappedFiles.push_back(file);
+
+            footer = GetDatabaseDirectory(file);
+            if (footer)
+            {
+                const NanoDatabaseDirectoryEntry *entries =
+                    (const NanoDatabaseDirectoryEntry *)&file.m_data[footer->offsetEntries];
+
+                for (CLR_UINT32 i = 0; i < footer->numberOfEntries; i++)
+                {
+                    if (entries[i].nameHash != nameHash)
+                        continue;
+
+                    if (ValidateDatabase_Entry(file, entries[i]) == false)
+                    {
+                        NANOCLR_MSG1_SET_AND_LEAVE(
+                            CLR_E_FAIL,
+                            L"Invalid assembly at offset 0x%08X of '%s'\n",
+                            entries[i].offset,
+                            szFile);
+                    }
+
+                    headers.push_back((CLR_RECORD_ASSEMBLY *)&file.m_data[entries[i].offset]);
+                }
+            }
+            else
+            {
+                NANOCLR_CHECK_HRESULT(ListDatabase(szFile, file, headers));
+            }
+
+            for (AssemblyHeaderVectorIter it = headers.begin(); it != headers.end(); it++)
+            {
+                CLR_RECORD_ASSEMBLY *header = *it;
+                CLR_RT_Assembly *assm;
+
+                // Different names can share the hash, keep looking until the name matches
+                GetAssemblyName(header, globals, strHeaderName);
+                if (strHeaderName != strName)
+                    continue;
+
+                NANOCLR_CHECK_HRESULT(CLR_RT_Assembly::CreateInstance(header, assm));
+
+                g_CLR_RT_TypeSystem.Link(assm);
+
+                NANOCLR_SET_AND_LEAVE(S_OK);
+            }
+
+            NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FAIL, L"Cannot find assembly '%s'\n", PARAM_EXTRACT_STRING(params, 1));
         }
 
         NANOCLR_NOCLEANUP();
@@ -555,6 +1254,56 @@ struct Settings : CLR_RT_ParseOptions
         NANOCLR_NOCLEANUP();
     }
 
+    HRESULT Cmd_DumpJson(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        LPCWSTR szName = PARAM_EXTRACT_STRING(params, 0);
+
+        if (szName[0] == 0)
+            szName = NULL;
+
+        NANOCLR_CHECK_HRESULT(AllocateSystem());
+
+        NANOCLR_CHECK_HRESULT(JsonDump::Dump(szName, noByteCode));
+
+        NANOCLR_NOCLEANUP();
+    }
+
+    HRESULT Cmd_SizeReportDiff(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        NANOCLR_CHECK_HRESULT(WatchAssemblyBuilder::SizeReport::Diff(
+            PARAM_EXTRACT_STRING(params, 0),
+            PARAM_EXTRACT_STRING(params, 1),
+            PARAM_EXTRACT_STRING(params, 2)));
+
+        NANOCLR_NOCLEANUP();
+    }
+
+    HRESULT Cmd_DumpILStats(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        NANOCLR_CHECK_HRESULT(MetaData::ByteCode::s_statistics.Save(PARAM_EXTRACT_STRING(params, 0)));
+
+        NANOCLR_NOCLEANUP();
+    }
+
+    HRESULT Cmd_Benchmark(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        NANOCLR_CHECK_HRESULT(Benchmark::Run(
+            PARAM_EXTRACT_STRING(params, 0),
+            (CLR_UINT32)_wtoi(PARAM_EXTRACT_STRING(params, 1)),
+            PARAM_EXTRACT_STRING(params, 2),
+            benchmarkBaselineFile));
+
+        NANOCLR_NOCLEANUP();
+    }
+
     HRESULT Cmd_DumpDat(CLR_RT_ParseOptions::ParameterList *params = NULL)
     {
         NANOCLR_HEADER();
@@ -566,40 +1315,23 @@ struct Settings : CLR_RT_ParseOptions
 
         {
             LPCWSTR szFile = PARAM_EXTRACT_STRING(params, 0);
-            CLR_RT_Buffer buffer;
-            CLR_RECORD_ASSEMBLY *header;
-            CLR_RECORD_ASSEMBLY *headerEnd;
-            std::wstring strName;
+            MappedFile file;
+            AssemblyHeaderVector headers;
 
-            NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::LoadFile(szFile, buffer));
+            NANOCLR_CHECK_HRESULT(MapFile(szFile, file));
 
-            header = (CLR_RECORD_ASSEMBLY *)&buffer[0];
-            headerEnd = (CLR_RECORD_ASSEMBLY *)&buffer[buffer.size() - 1];
+            mappedFiles.push_back(file);
+
+            NANOCLR_CHECK_HRESULT(ListDatabase(szFile, file, headers));
 
             int number = 0;
 
-            while (header + 1 <= headerEnd && header->GoodAssembly())
+            for (AssemblyHeaderVectorIter it = headers.begin(); it != headers.end(); it++)
             {
-                CLR_RT_Buffer *bufferSub = new CLR_RT_Buffer();
-                CLR_RECORD_ASSEMBLY *headerSub;
+                CLR_RECORD_ASSEMBLY *header = *it;
                 CLR_RT_Assembly *assm;
 
-                bufferSub->resize(header->TotalSize());
-
-                headerSub = (CLR_RECORD_ASSEMBLY *)&(*bufferSub)[0];
-
-                if ((CLR_UINT8 *)header + header->TotalSize() > (CLR_UINT8 *)headerEnd)
-                {
-                    // checksum passed, but not enough data in assembly
-                    _ASSERTE(FALSE);
-                    break;
-                }
-                memcpy(headerSub, header, header->TotalSize());
-
-                NANOCLR_CHECK_HRESULT(CLR_RT_Assembly::CreateInstance(headerSub, assm));
-
-                // CLR_RT_UnicodeHelper::ConvertFromUTF8( assm->m_szName, strName );
-                // bufferMap[strName] = bufferSub;
+                NANOCLR_CHECK_HRESULT(CLR_RT_Assembly::CreateInstance(header, assm));
 
                 printf(
                     "Assembly %d: %s (%d.%d.%d.%d), size: %d\r\n",
@@ -610,9 +1342,6 @@ struct Settings : CLR_RT_ParseOptions
                     header->version.iBuildNumber,
                     header->version.iRevisionNumber,
                     header->TotalSize());
-
-                // jump to next assembly
-                header = (CLR_RECORD_ASSEMBLY *)ROUNDTOMULTIPLE((size_t)header + header->TotalSize(), CLR_UINT32);
             }
         }
 
@@ -634,321 +1363,908 @@ struct Settings : CLR_RT_ParseOptions
         }
         else
         {
-            NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"Failed to dump exports\n");
+            NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"Failed to dump exports\n");
+        }
+
+        NANOCLR_NOCLEANUP();
+    }
+
+    HRESULT
+    Cmd_GenerateSkeleton(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        LPCWSTR szFile = PARAM_EXTRACT_STRING(params, 0);
+        LPCWSTR szName = PARAM_EXTRACT_STRING(params, 1);
+        LPCWSTR szProj = PARAM_EXTRACT_STRING(params, 2);
+        LPCWSTR szNoInterop = PARAM_EXTRACT_STRING(params, 3);
+
+        BOOL codeGeneratorNoInterop = _wcsicmp(L"TRUE", szNoInterop) == 0;
+
+        std::string name;
+
+        NANOCLR_CHECK_HRESULT(AllocateSystem());
+
+        if (szFile[0] == 0)
+            szFile = NULL;
+
+        CLR_RT_UnicodeHelper::ConvertToUTF8(szName, name);
+
+        currentAssembly = g_CLR_RT_TypeSystem.FindAssembly(name.c_str(), NULL, false);
+        if (currentAssembly)
+        {
+            if (codeGeneratorNoInterop)
+            {
+                currentAssembly->GenerateSkeleton_NoInterop(szFile, szProj);
+            }
+            else
+            {
+                currentAssembly->GenerateSkeleton(szFile, szProj);
+            }
+        }
+
+        NANOCLR_NOCLEANUP();
+    }
+
+    HRESULT
+    Cmd_RefreshAssembly(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        LPCWSTR szName = PARAM_EXTRACT_STRING(params, 0);
+        LPCWSTR szFile = PARAM_EXTRACT_STRING(params, 1);
+        std::string name;
+
+        CLR_RT_UnicodeHelper::ConvertToUTF8(szName, name);
+
+        NANOCLR_CHECK_HRESULT(AllocateSystem());
+
+        currentAssembly = g_CLR_RT_TypeSystem.FindAssembly(name.c_str(), NULL, false);
+        if (currentAssembly)
+        {
+            CLR_UINT32 len = currentAssembly->m_header->TotalSize();
+
+            if (len % sizeof(CLR_UINT32))
+            {
+                len += sizeof(CLR_UINT32) - (len % sizeof(CLR_UINT32));
+            }
+
+            NANOCLR_CHECK_HRESULT(
+                CLR_RT_FileStore::SaveFile(szFile, (CLR_UINT8 *)currentAssembly->m_header, (DWORD)len));
+        }
+
+        NANOCLR_NOCLEANUP();
+    }
+
+#if defined(NANOCLR_JITTER)
+    HRESULT Cmd_Jit(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        LPCWSTR szName = PARAM_EXTRACT_STRING(params, 0);
+        std::string name;
+
+        CLR_RT_UnicodeHelper::ConvertToUTF8(szName, name);
+
+        NANOCLR_CHECK_HRESULT(AllocateSystem());
+
+        currentAssembly = g_CLR_RT_TypeSystem.FindAssembly(name.c_str(), NULL, false);
+        if (currentAssembly)
+        {
+            for (int i = 0; i < currentAssembly->m_pTablesSize[TBL_MethodDef]; i++)
+            {
+                CLR_RT_MethodDef_Index md;
+
+                md.Set(currentAssembly->m_idx, i);
+
+                NANOCLR_CHECK_HRESULT(g_CLR_RT_ExecutionEngine.Compile(md, CLR_RT_ExecutionEngine::c_Compile_CPP));
+            }
+        }
+
+        NANOCLR_NOCLEANUP();
+    }
+#endif
+
+    //
+    // The read-only part of -resolve and -generate_dependency, one assembly per worker.
+    //
+    static void ScanAssemblies_Worker(AssemblyScanVector &scans, bool fDependencies, LONG volatile *next)
+    {
+        while (true)
+        {
+            size_t pos = (size_t)(::InterlockedIncrement(next) - 1);
+
+            if (pos >= scans.size())
+                break;
+
+            AssemblyScan &scan = scans[pos];
+            CLR_RT_Assembly *assm = scan.m_assm;
+            const CLR_RECORD_ASSEMBLYREF *src = (const CLR_RECORD_ASSEMBLYREF *)assm->GetTable(TBL_AssemblyRef);
+
+            for (int i = 0; i < assm->m_pTablesSize[TBL_AssemblyRef]; i++, src++)
+            {
+                LPCSTR szName = assm->GetString(src->name);
+
+                scan.m_refs.push_back(g_CLR_RT_TypeSystem.FindAssembly(szName, &src->version, true));
+            }
+
+            if (fDependencies == false)
+                continue;
+
+            scan.m_hash = assm->ComputeAssemblyHash();
+            scan.m_typeNames.resize(assm->m_pTablesSize[TBL_TypeDef]);
+
+            for (int i = 0; i < assm->m_pTablesSize[TBL_TypeDef]; i++)
+            {
+                CLR_RT_TypeDef_Index td;
+                char rgBuffer[512];
+                LPSTR szBuffer = rgBuffer;
+                size_t iBuffer = MAXSTRLEN(rgBuffer);
+
+                td.Set(assm->m_idx, i);
+
+                g_CLR_RT_TypeSystem.BuildTypeName(td, szBuffer, iBuffer);
+
+                //
+                // Skip types used by the runtime.
+                //
+                if (strchr(rgBuffer, '<'))
+                    continue;
+                if (strchr(rgBuffer, '>'))
+                    continue;
+                if (strchr(rgBuffer, '$'))
+                    continue;
+
+                scan.m_typeNames[i] = rgBuffer;
+            }
+        }
+    }
+
+    static void ScanAssemblies(AssemblyScanVector &scans, bool fDependencies)
+    {
+        std::vector<std::thread> workers;
+        LONG volatile next = 0;
+        size_t numWorkers = std::thread::hardware_concurrency();
+
+        NANOCLR_FOREACH_ASSEMBLY(g_CLR_RT_TypeSystem)
+        {
+            AssemblyScan scan;
+
+            scan.m_assm = pASSM;
+            scan.m_hash = 0;
+
+            scans.push_back(scan);
+        }
+        NANOCLR_FOREACH_ASSEMBLY_END();
+
+        if (numWorkers > scans.size())
+            numWorkers = scans.size();
+
+        for (size_t i = 1; i < numWorkers; i++)
+        {
+            workers.push_back(std::thread(ScanAssemblies_Worker, std::ref(scans), fDependencies, &next));
+        }
+
+        ScanAssemblies_Worker(scans, fDependencies, &next);
+
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            workers[i].join();
+        }
+    }
+
+    HRESULT Cmd_Resolve(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        AssemblyScanVector scans;
+        bool fError = false;
+
+        NANOCLR_CHECK_HRESULT(AllocateSystem());
+
+        ScanAssemblies(scans, false);
+
+        for (AssemblyScanVectorIter it = scans.begin(); it != scans.end(); it++)
+        {
+            const CLR_RECORD_ASSEMBLYREF *src = (const CLR_RECORD_ASSEMBLYREF *)it->m_assm->GetTable(TBL_AssemblyRef);
+
+            for (size_t i = 0; i < it->m_refs.size(); i++, src++)
+            {
+                if (it->m_refs[i] == NULL)
+                {
+                    printf(
+                        "Missing assembly: %s (%d.%d.%d.%d)\r\n",
+                        it->m_assm->GetString(src->name),
+                        src->version.iMajorVersion,
+                        src->version.iMinorVersion,
+                        src->version.iBuildNumber,
+                        src->version.iRevisionNumber);
+
+                    fError = true;
+                }
+            }
+        }
+
+        if (fError)
+            NANOCLR_SET_AND_LEAVE(CLR_E_ENTRY_NOT_FOUND);
+
+        // linking updates the type system, so it stays on this thread
+        NANOCLR_CHECK_HRESULT(g_CLR_RT_TypeSystem.ResolveAll());
+
+        NANOCLR_NOCLEANUP();
+    }
+
+    //--//
+
+    HRESULT Cmd_DiffPatch(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        LPCWSTR szOrig = PARAM_EXTRACT_STRING(params, 0);
+        LPCWSTR szNew = PARAM_EXTRACT_STRING(params, 1);
+        LPCWSTR szFile = PARAM_EXTRACT_STRING(params, 2);
+        MetaData::Reparser::Assembly orig;
+        MetaData::Reparser::Assembly patched;
+        MetaData::Reparser::Assembly patch;
+        WIN32_FILE_ATTRIBUTE_DATA fad;
+        size_t size;
+
+        NANOCLR_CHECK_HRESULT(AllocateSystem());
+
+        if (::GetFileAttributesExW(szNew, GetFileExInfoStandard, &fad) == FALSE)
+        {
+            NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FILE_IO, L"Cannot open '%s'\n", szNew);
+        }
+
+        //
+        // The Reparser reports the elements it can't patch by throwing their description.
+        //
+        try
+        {
+            NANOCLR_CHECK_HRESULT(orig.Load(szOrig));
+            NANOCLR_CHECK_HRESULT(patched.Load(szNew));
+
+            NANOCLR_CHECK_HRESULT(patch.CreateDiff(&orig, &patched, true));
+        }
+        catch (std::string &str)
+        {
+            NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FAIL, L"%S\n", str.c_str());
+        }
+
+        NANOCLR_CHECK_HRESULT(patch.ListPatch(szFile, size));
+
+        wprintf(L"Patch: about %d bytes, against %d bytes for a full redeploy\n", (int)size, (int)fad.nFileSizeLow);
+
+        NANOCLR_NOCLEANUP();
+    }
+
+    //--//
+
+    HRESULT Cmd_GenerateDependency__OutputAssembly(
+        CLR_XmlUtil xml,
+        IXMLDOMNode *node,
+        IXMLDOMNodePtr &assmNode,
+        LPCWSTR szTag,
+        CLR_RT_Assembly *assm,
+        CLR_UINT32 hash)
+    {
+        NANOCLR_HEADER();
+
+        std::wstring name;
+        WCHAR rgBuffer[1024];
+        bool fFound;
+
+        CLR_RT_UnicodeHelper::ConvertFromUTF8(assm->m_szName, name);
+        swprintf(
+            rgBuffer,
+            ARRAYSIZE(rgBuffer),
+            L"%d.%d.%d.%d",
+            assm->m_header->version.iMajorVersion,
+            assm->m_header->version.iMinorVersion,
+            assm->m_header->version.iBuildNumber,
+            assm->m_header->version.iRevisionNumber);
+
+        NANOCLR_CHECK_HRESULT(xml.CreateNode(szTag, &assmNode, node));
+
+        NANOCLR_CHECK_HRESULT(xml.PutAttribute(NULL, L"Name", name, fFound, assmNode));
+        NANOCLR_CHECK_HRESULT(xml.PutAttribute(NULL, L"Version", rgBuffer, fFound, assmNode));
+        NANOCLR_CHECK_HRESULT(xml.PutAttribute(NULL, L"Hash", WatchAssemblyBuilder::ToHex(hash), fFound, assmNode));
+        NANOCLR_CHECK_HRESULT(
+            xml.PutAttribute(NULL, L"Flags", WatchAssemblyBuilder::ToHex(assm->m_header->flags), fFound, assmNode));
+
+        NANOCLR_NOCLEANUP();
+    }
+
+    HRESULT
+    Cmd_GenerateDependency(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        LPCWSTR szFile = PARAM_EXTRACT_STRING(params, 0);
+        CLR_XmlUtil xml;
+        AssemblyScanVector scans;
+        std::map<CLR_RT_Assembly *, CLR_UINT32> hashes;
+
+        //
+        // Hashes and type names are computed up front on all cores, the XML document is then built on this thread.
+        //
+        ScanAssemblies(scans, true);
+
+        for (AssemblyScanVectorIter it = scans.begin(); it != scans.end(); it++)
+        {
+            hashes[it->m_assm] = it->m_hash;
+        }
+
+        NANOCLR_CHECK_HRESULT(xml.New(L"AssemblyGraph"));
+
+        for (AssemblyScanVectorIter it = scans.begin(); it != scans.end(); it++)
+        {
+            IXMLDOMNodePtr assmNode;
+            CLR_RT_TypeDef_CrossReference *dst = it->m_assm->m_pCrossReference_TypeDef;
+
+            NANOCLR_CHECK_HRESULT(
+                Cmd_GenerateDependency__OutputAssembly(xml, NULL, assmNode, L"Assembly", it->m_assm, it->m_hash));
+
+            for (size_t i = 0; i < it->m_refs.size(); i++)
+            {
+                IXMLDOMNodePtr assmRefNode;
+                CLR_RT_Assembly *assmRef = it->m_refs[i];
+
+                if (!assmRef)
+                    NANOCLR_SET_AND_LEAVE(CLR_E_NULL_REFERENCE);
+
+                NANOCLR_CHECK_HRESULT(Cmd_GenerateDependency__OutputAssembly(
+                    xml,
+                    assmNode,
+                    assmRefNode,
+                    L"AssemblyRef",
+                    assmRef,
+                    hashes[assmRef]));
+            }
+
+            for (size_t i = 0; i < it->m_typeNames.size(); i++)
+            {
+                IXMLDOMNodePtr typeNode;
+                std::wstring name;
+                bool fFound;
+
+                if (it->m_typeNames[i].empty())
+                    continue;
+
+                CLR_RT_UnicodeHelper::ConvertFromUTF8(it->m_typeNames[i].c_str(), name);
+
+                NANOCLR_CHECK_HRESULT(xml.CreateNode(L"Type", &typeNode, assmNode));
+
+                NANOCLR_CHECK_HRESULT(xml.PutAttribute(NULL, L"Name", name, fFound, typeNode));
+                NANOCLR_CHECK_HRESULT(
+                    xml.PutAttribute(NULL, L"Hash", WatchAssemblyBuilder::ToHex(dst[i].m_hash), fFound, typeNode));
+            }
+        }
+
+        NANOCLR_CHECK_HRESULT(xml.Save(szFile));
+
+        NANOCLR_NOCLEANUP();
+    }
+
+    //--//
+
+    //
+    // Reads one assembly of the database straight into its slot of the output image, checking its CRCs.
+    // The header is checked first, so a truncated file can't make the assembly CRC run into the next slot.
+    // The file has to hold exactly the assembly: the device walks the image by TotalSize() and the directory records
+    // the file size, trailing bytes would break both.
+    //
+    static void CreateDatabase_ReadFiles(DatabaseEntryVector &entries, CLR_RT_Buffer &database, LONG volatile *next)
+    {
+        while (true)
+        {
+            size_t pos = (size_t)(::InterlockedIncrement(next) - 1);
+
+            if (pos >= entries.size())
+                break;
+
+            DatabaseEntry &entry = entries[pos];
+            CLR_RECORD_ASSEMBLY *header = (CLR_RECORD_ASSEMBLY *)&database[entry.m_offset];
+            HANDLE hFile;
+            DWORD read = 0;
+
+            hFile = ::CreateFileW(
+                entry.m_file.c_str(),
+                GENERIC_READ,
+                FILE_SHARE_READ,
+                NULL,
+                OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL,
+                NULL);
+            if (hFile == INVALID_HANDLE_VALUE)
+            {
+                entry.m_hr = CLR_E_FILE_IO;
+                continue;
+            }
+
+            if (::ReadFile(hFile, header, (DWORD)entry.m_size, &read, NULL) == FALSE || read != entry.m_size)
+            {
+                entry.m_hr = CLR_E_FILE_IO;
+            }
+            else if (
+                entry.m_size < sizeof(CLR_RECORD_ASSEMBLY) || header->GoodHeader() == false ||
+                header->TotalSize() != entry.m_size || header->GoodAssembly() == false)
+            {
+                entry.m_hr = CLR_E_FAIL;
+            }
+            else
+            {
+                entry.m_hr = S_OK;
+            }
+
+            ::CloseHandle(hFile);
+        }
+    }
+
+    HRESULT
+    Cmd_CreateDatabase(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    {
+        NANOCLR_HEADER();
+
+        CLR_RT_StringVector vec;
+        CLR_RT_StringSet seen;
+        DatabaseEntryVector entries;
+        std::vector<std::thread> workers;
+        LONG volatile next = 0;
+        size_t numWorkers = std::thread::hardware_concurrency();
+        CLR_RT_Buffer database;
+        StringPoolMap pool;
+        size_t pos = 0;
+
+        NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::ExtractTokensFromFile(PARAM_EXTRACT_STRING(params, 0), vec));
+
+        //
+        // Delete duplicate assemblies, keeping the first occurrence, and lay out the image from the file sizes.
+        //
+        for (size_t j = 0; j < vec.size(); j++)
+        {
+            WIN32_FILE_ATTRIBUTE_DATA fad;
+            DatabaseEntry entry;
+
+            if (seen.insert(vec[j]).second == false)
+                continue;
+
+            if (::GetFileAttributesExW(vec[j].c_str(), GetFileExInfoStandard, &fad) == FALSE ||
+                fad.nFileSizeHigh != 0)
+            {
+                NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FILE_IO, L"Cannot open '%s'\n", vec[j].c_str());
+            }
+
+            entry.m_file = vec[j];
+            entry.m_offset = pos;
+            entry.m_size = fad.nFileSizeLow;
+            entry.m_hr = S_OK;
+
+            entries.push_back(entry);
+
+            pos = ROUNDTOMULTIPLE(pos + entry.m_size, CLR_UINT32);
+        }
+
+        //
+        // Add a group of zeros at the end, the device will stop at that point.
+        //
+        pos += sizeof(CLR_UINT32);
+
+        if (databaseDirectory)
+        {
+            database.resize(
+                pos + entries.size() * sizeof(NanoDatabaseDirectoryEntry) + sizeof(NanoDatabaseDirectoryFooter));
+        }
+        else
+        {
+            database.resize(pos);
         }
 
-        NANOCLR_NOCLEANUP();
-    }
-
-    HRESULT
-    Cmd_GenerateSkeleton(CLR_RT_ParseOptions::ParameterList *params = NULL)
-    {
-        NANOCLR_HEADER();
-
-        LPCWSTR szFile = PARAM_EXTRACT_STRING(params, 0);
-        LPCWSTR szName = PARAM_EXTRACT_STRING(params, 1);
-        LPCWSTR szProj = PARAM_EXTRACT_STRING(params, 2);
-        LPCWSTR szNoInterop = PARAM_EXTRACT_STRING(params, 3);
+        if (numWorkers > entries.size())
+            numWorkers = entries.size();
 
-        BOOL codeGeneratorNoInterop = _wcsicmp(L"TRUE", szNoInterop) == 0;
+        for (size_t i = 1; i < numWorkers; i++)
+        {
+            workers.push_back(std::thread(CreateDatabase_ReadFiles, std::ref(entries), std::ref(database), &next));
+        }
 
-        std::string name;
+        CreateDatabase_ReadFiles(entries, database, &next);
 
-        NANOCLR_CHECK_HRESULT(AllocateSystem());
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            workers[i].join();
+        }
 
-        if (szFile[0] == 0)
-            szFile = NULL;
+        for (DatabaseEntryVectorIter it = entries.begin(); it != entries.end(); it++)
+        {
+            CLR_RECORD_ASSEMBLY *header = (CLR_RECORD_ASSEMBLY *)&database[it->m_offset];
 
-        CLR_RT_UnicodeHelper::ConvertToUTF8(szName, name);
+            if (it->m_hr == CLR_E_FILE_IO)
+            {
+                NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FILE_IO, L"Cannot read '%s'\n", it->m_file.c_str());
+            }
 
-        currentAssembly = g_CLR_RT_TypeSystem.FindAssembly(name.c_str(), NULL, false);
-        if (currentAssembly)
-        {
-            if (codeGeneratorNoInterop)
+            if (FAILED(it->m_hr))
             {
-                currentAssembly->GenerateSkeleton_NoInterop(szFile, szProj);
+                NANOCLR_MSG1_SET_AND_LEAVE(
+                    CLR_E_FAIL,
+                    L"Invalid assembly format for '%s', or its size doesn't match its header\n",
+                    it->m_file.c_str());
             }
-            else
+
+            if (stringPoolFile.size())
             {
-                currentAssembly->GenerateSkeleton(szFile, szProj);
+                NANOCLR_CHECK_HRESULT(CollectStringPool(header, pool));
             }
         }
 
-        NANOCLR_NOCLEANUP();
-    }
+        if (databaseDirectory)
+        {
+            NanoDatabaseDirectoryEntry *dst = (NanoDatabaseDirectoryEntry *)&database[pos];
+            NanoDatabaseDirectoryFooter *footer =
+                (NanoDatabaseDirectoryFooter *)&database[database.size() - sizeof(NanoDatabaseDirectoryFooter)];
+            std::map<std::string, CLR_OFFSET> globals;
+            std::string strName;
 
-    HRESULT
-    Cmd_RefreshAssembly(CLR_RT_ParseOptions::ParameterList *params = NULL)
-    {
-        NANOCLR_HEADER();
+            CLR_RT_Assembly::InitString(globals);
 
-        LPCWSTR szName = PARAM_EXTRACT_STRING(params, 0);
-        LPCWSTR szFile = PARAM_EXTRACT_STRING(params, 1);
-        std::string name;
+            for (DatabaseEntryVectorIter it = entries.begin(); it != entries.end(); it++, dst++)
+            {
+                CLR_RECORD_ASSEMBLY *header = (CLR_RECORD_ASSEMBLY *)&database[it->m_offset];
 
-        CLR_RT_UnicodeHelper::ConvertToUTF8(szName, name);
+                GetAssemblyName(header, globals, strName);
 
-        NANOCLR_CHECK_HRESULT(AllocateSystem());
+                dst->nameHash = HashAssemblyName(strName.c_str());
+                dst->version = header->version;
+                dst->offset = (CLR_UINT32)it->m_offset;
+                dst->size = (CLR_UINT32)it->m_size;
+                dst->assemblyCRC = header->assemblyCRC;
+            }
 
-        currentAssembly = g_CLR_RT_TypeSystem.FindAssembly(name.c_str(), NULL, false);
-        if (currentAssembly)
+            footer->numberOfEntries = (CLR_UINT32)entries.size();
+            footer->offsetEntries = (CLR_UINT32)pos;
+            footer->crcEntries = SUPPORT_ComputeCRC(
+                &database[pos],
+                (int)(entries.size() * sizeof(NanoDatabaseDirectoryEntry)),
+                0);
+            footer->version = NanoDatabaseDirectoryFooter::VERSION;
+            footer->magicNumber = NanoDatabaseDirectoryFooter::MAGIC_NUMBER;
+        }
+
+        NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::SaveFile(PARAM_EXTRACT_STRING(params, 1), database));
+
+        if (stringPoolFile.size())
         {
-            CLR_UINT32 len = currentAssembly->m_header->TotalSize();
+            NANOCLR_CHECK_HRESULT(SaveStringPool(pool));
+        }
 
-            if (len % sizeof(CLR_UINT32))
+        NANOCLR_NOCLEANUP();
+    }
+
+    //
+    // The linker keeps the offsets in the string table of an assembly below 0x8000, higher indices point to the
+    // well-known strings compiled into the firmware.
+    //
+    static void GetAssemblyName(
+        CLR_RECORD_ASSEMBLY *header,
+        std::map<std::string, CLR_OFFSET> &globals,
+        std::string &strName)
+    {
+        if (header->assemblyName > 0x7FFF)
+        {
+            for (std::map<std::string, CLR_OFFSET>::iterator it = globals.begin(); it != globals.end(); it++)
             {
-                len += sizeof(CLR_UINT32) - (len % sizeof(CLR_UINT32));
+                if (it->second == header->assemblyName)
+                {
+                    strName = it->first;
+                    return;
+                }
             }
-
-            NANOCLR_CHECK_HRESULT(
-                CLR_RT_FileStore::SaveFile(szFile, (CLR_UINT8 *)currentAssembly->m_header, (DWORD)len));
         }
 
-        NANOCLR_NOCLEANUP();
+        strName = (LPCSTR)header + header->startOfTables[TBL_Strings] + header->assemblyName;
     }
 
-#if defined(NANOCLR_JITTER)
-    HRESULT Cmd_Jit(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    //
+    // Counts, for each string of the deployment, how many assemblies carry a copy of it in their string table.
+    //
+    HRESULT CollectStringPool(CLR_RECORD_ASSEMBLY *header, StringPoolMap &pool)
     {
         NANOCLR_HEADER();
 
-        LPCWSTR szName = PARAM_EXTRACT_STRING(params, 0);
-        std::string name;
-
-        CLR_RT_UnicodeHelper::ConvertToUTF8(szName, name);
+        LPCSTR ptr;
+        LPCSTR ptrEnd;
 
-        NANOCLR_CHECK_HRESULT(AllocateSystem());
+        ptr = (LPCSTR)header + header->startOfTables[TBL_Strings];
+        ptrEnd = ptr + header->SizeOfTable(TBL_Strings);
 
-        currentAssembly = g_CLR_RT_TypeSystem.FindAssembly(name.c_str(), NULL, false);
-        if (currentAssembly)
+        //
+        // 'ldstr ""' leaves an empty string in the middle of the table, skip it and carry on.
+        //
+        while (ptr < ptrEnd)
         {
-            for (int i = 0; i < currentAssembly->m_pTablesSize[TBL_MethodDef]; i++)
-            {
-                CLR_RT_MethodDef_Index md;
-
-                md.Set(currentAssembly->m_idx, i);
+            size_t len = strnlen(ptr, ptrEnd - ptr);
 
-                NANOCLR_CHECK_HRESULT(g_CLR_RT_ExecutionEngine.Compile(md, CLR_RT_ExecutionEngine::c_Compile_CPP));
+            if (len)
+            {
+                pool[std::string(ptr, len)]++;
             }
+
+            ptr += len + 1;
         }
 
         NANOCLR_NOCLEANUP();
     }
-#endif
 
-    HRESULT Cmd_Resolve(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    //
+    // The device can only redirect string indices to the well-known strings table built into the firmware, so the
+    // pool is saved in the -loadStrings format, ready for -generateStringsTable. Once the firmware and the assemblies
+    // are rebuilt against it, each shared string is stored once instead of once per assembly.
+    //
+    HRESULT SaveStringPool(StringPoolMap &pool)
     {
         NANOCLR_HEADER();
 
-        bool fError = false;
+        std::map<std::string, CLR_OFFSET> globals;
+        CLR_RT_Buffer buffer;
+        size_t numShared = 0;
+        size_t sizeShared = 0;
+        size_t sizeSaved = 0;
 
-        NANOCLR_CHECK_HRESULT(AllocateSystem());
+        CLR_RT_Assembly::InitString(globals);
 
-        NANOCLR_FOREACH_ASSEMBLY(g_CLR_RT_TypeSystem)
+        for (StringPoolMapIter it = pool.begin(); it != pool.end(); it++)
         {
-            const CLR_RECORD_ASSEMBLYREF *src = (const CLR_RECORD_ASSEMBLYREF *)pASSM->GetTable(TBL_AssemblyRef);
-            for (int i = 0; i < pASSM->m_pTablesSize[TBL_AssemblyRef]; i++, src++)
-            {
-                LPCSTR szName = pASSM->GetString(src->name);
+            const std::string &str = it->first;
+            size_t len = str.size() + 1;
 
-                if (g_CLR_RT_TypeSystem.FindAssembly(szName, &src->version, true) == NULL)
-                {
-                    printf(
-                        "Missing assembly: %s (%d.%d.%d.%d)\r\n",
-                        szName,
-                        src->version.iMajorVersion,
-                        src->version.iMinorVersion,
-                        src->version.iBuildNumber,
-                        src->version.iRevisionNumber);
+            if (it->second < 2 || globals.find(str) != globals.end())
+                continue;
 
-                    fError = true;
-                }
-            }
+            // Don't pool generated strings, they are specific to one assembly
+            if (str.find("$$method0x") == 0 || str.find("<PrivateImplementationDetails>{") == 0 ||
+                str.find("__StaticArrayInitTypeSize=") == 0)
+                continue;
+
+            buffer.insert(buffer.end(), str.c_str(), str.c_str() + len);
+
+            numShared++;
+            sizeShared += len;
+            sizeSaved += (it->second - 1) * len;
         }
-        NANOCLR_FOREACH_ASSEMBLY_END();
 
-        if (fError)
-            NANOCLR_SET_AND_LEAVE(CLR_E_ENTRY_NOT_FOUND);
+        NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::SaveFile(stringPoolFile.c_str(), buffer));
 
-        NANOCLR_CHECK_HRESULT(g_CLR_RT_TypeSystem.ResolveAll());
+        wprintf(
+            L"String pool: %d strings shared across assemblies, %d bytes, saving %d bytes of flash\n",
+            (int)numShared,
+            (int)sizeShared,
+            (int)sizeSaved);
 
         NANOCLR_NOCLEANUP();
     }
 
     //--//
 
-    HRESULT Cmd_GenerateDependency__OutputAssembly(
-        CLR_XmlUtil xml,
-        IXMLDOMNode *node,
-        IXMLDOMNodePtr &assmNode,
-        LPCWSTR szTag,
-        CLR_RT_Assembly *assm)
+    HRESULT PlanDeployment_Load(
+        LPCWSTR szFile,
+        MappedFile &file,
+        DeploymentAssemblyMap &assemblies,
+        AssemblyNameVector &order)
     {
         NANOCLR_HEADER();
 
-        std::wstring name;
-        WCHAR rgBuffer[1024];
-        bool fFound;
+        AssemblyHeaderVector headers;
 
-        CLR_RT_UnicodeHelper::ConvertFromUTF8(assm->m_szName, name);
-        swprintf(
-            rgBuffer,
-            ARRAYSIZE(rgBuffer),
-            L"%d.%d.%d.%d",
-            assm->m_header->version.iMajorVersion,
-            assm->m_header->version.iMinorVersion,
-            assm->m_header->version.iBuildNumber,
-            assm->m_header->version.iRevisionNumber);
+        NANOCLR_CHECK_HRESULT(MapFile(szFile, file));
 
-        NANOCLR_CHECK_HRESULT(xml.CreateNode(szTag, &assmNode, node));
+        mappedFiles.push_back(file);
 
-        NANOCLR_CHECK_HRESULT(xml.PutAttribute(NULL, L"Name", name, fFound, assmNode));
-        NANOCLR_CHECK_HRESULT(xml.PutAttribute(NULL, L"Version", rgBuffer, fFound, assmNode));
-        NANOCLR_CHECK_HRESULT(xml.PutAttribute(
-            NULL,
-            L"Hash",
-            WatchAssemblyBuilder::ToHex(assm->ComputeAssemblyHash()),
-            fFound,
-            assmNode));
-        NANOCLR_CHECK_HRESULT(
-            xml.PutAttribute(NULL, L"Flags", WatchAssemblyBuilder::ToHex(assm->m_header->flags), fFound, assmNode));
+        NANOCLR_CHECK_HRESULT(ListDatabase(szFile, file, headers));
+
+        for (AssemblyHeaderVectorIter it = headers.begin(); it != headers.end(); it++)
+        {
+            DeploymentAssembly da;
+            CLR_RT_Assembly *assm;
+
+            NANOCLR_CHECK_HRESULT(CLR_RT_Assembly::CreateInstance(*it, assm));
+
+            da.m_header = *it;
+            da.m_hash = assm->ComputeAssemblyHash();
+            da.m_offset = (CLR_UINT8 *)*it - file.m_data;
+
+            assemblies[assm->m_szName] = da;
+            order.push_back(assm->m_szName);
+        }
 
         NANOCLR_NOCLEANUP();
     }
 
-    HRESULT
-    Cmd_GenerateDependency(CLR_RT_ParseOptions::ParameterList *params = NULL)
+    static void PlanDeployment_AddChunk(DeltaChunkVector &chunks, size_t offset, size_t size)
+    {
+        if (chunks.size() && chunks.back().offset + chunks.back().size == offset)
+        {
+            chunks.back().size += (CLR_UINT32)size;
+        }
+        else
+        {
+            NanoDatabaseDeltaChunk chunk;
+
+            chunk.offset = (CLR_UINT32)offset;
+            chunk.size = (CLR_UINT32)size;
+
+            chunks.push_back(chunk);
+        }
+    }
+
+    //
+    // An assembly can stay in flash only if the very same image sits at the very same offset in the old database.
+    // Everything else, including identical assemblies shifted by a change ahead of them, has to be written again.
+    //
+    HRESULT Cmd_PlanDeployment(CLR_RT_ParseOptions::ParameterList *params = NULL)
     {
         NANOCLR_HEADER();
 
-        LPCWSTR szFile = PARAM_EXTRACT_STRING(params, 0);
-        CLR_XmlUtil xml;
+        LPCWSTR szOld = PARAM_EXTRACT_STRING(params, 0);
+        LPCWSTR szNew = PARAM_EXTRACT_STRING(params, 1);
+        LPCWSTR szPlan = PARAM_EXTRACT_STRING(params, 2);
+        LPCWSTR szDelta = PARAM_EXTRACT_STRING(params, 3);
+        MappedFile fileOld;
+        MappedFile fileNew;
+        DeploymentAssemblyMap assembliesOld;
+        DeploymentAssemblyMap assembliesNew;
+        AssemblyNameVector orderOld;
+        AssemblyNameVector orderNew;
+        DeltaChunkVector chunks;
+        CLR_RT_Buffer delta;
+        NanoDatabaseDeltaHeader *header;
+        size_t endOfAssemblies = 0;
+        size_t sizeOfDelta = 0;
+        size_t pos;
+        FILE *stream = NULL;
 
-        NANOCLR_CHECK_HRESULT(xml.New(L"AssemblyGraph"));
+        fromAssembly = false;
+        fromImage = true;
 
-        NANOCLR_FOREACH_ASSEMBLY(g_CLR_RT_TypeSystem)
-        {
-            IXMLDOMNodePtr assmNode;
+        NANOCLR_CHECK_HRESULT(AllocateSystem());
+
+        NANOCLR_CHECK_HRESULT(PlanDeployment_Load(szOld, fileOld, assembliesOld, orderOld));
+        NANOCLR_CHECK_HRESULT(PlanDeployment_Load(szNew, fileNew, assembliesNew, orderNew));
 
-            NANOCLR_CHECK_HRESULT(Cmd_GenerateDependency__OutputAssembly(xml, NULL, assmNode, L"Assembly", pASSM));
+        if (_wfopen_s(&stream, szPlan, L"w") != 0)
+        {
+            NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FILE_IO, L"Cannot open '%s'\n", szPlan);
+        }
 
+        //
+        // Walk the new database in flash order, so the chunks come out sorted.
+        //
+        for (AssemblyNameVectorIter it = orderNew.begin(); it != orderNew.end(); it++)
+        {
+            DeploymentAssembly &da = assembliesNew[*it];
+            DeploymentAssemblyMapIter itOld = assembliesOld.find(*it);
+            CLR_RECORD_ASSEMBLY *hdr = da.m_header;
+            size_t offset = da.m_offset;
+            size_t size = ROUNDTOMULTIPLE(hdr->TotalSize(), CLR_UINT32);
+            LPCSTR szAction;
+
+            //
+            // The assembly CRC doesn't cover the header, so its CRC has to match as well for the image to be the same.
+            //
+            if (itOld == assembliesOld.end())
             {
-                const CLR_RECORD_ASSEMBLYREF *src = (const CLR_RECORD_ASSEMBLYREF *)pASSM->GetTable(TBL_AssemblyRef);
-                for (int i = 0; i < pASSM->m_pTablesSize[TBL_AssemblyRef]; i++, src++)
-                {
-                    IXMLDOMNodePtr assmRefNode;
-                    CLR_RT_Assembly *assmRef =
-                        g_CLR_RT_TypeSystem.FindAssembly(pASSM->GetString(src->name), &src->version, true);
-                    if (!assmRef)
-                        NANOCLR_SET_AND_LEAVE(CLR_E_NULL_REFERENCE);
-
-                    NANOCLR_CHECK_HRESULT(
-                        Cmd_GenerateDependency__OutputAssembly(xml, assmNode, assmRefNode, L"AssemblyRef", assmRef));
-                }
+                szAction = "add";
             }
-
+            else if (
+                itOld->second.m_hash != da.m_hash || itOld->second.m_header->headerCRC != hdr->headerCRC ||
+                itOld->second.m_header->assemblyCRC != hdr->assemblyCRC ||
+                itOld->second.m_header->TotalSize() != hdr->TotalSize())
+            {
+                szAction = "update";
+            }
+            else if (itOld->second.m_offset != offset)
             {
-                const CLR_RECORD_TYPEDEF *src = pASSM->GetTypeDef(0);
-                CLR_RT_TypeDef_CrossReference *dst = pASSM->m_pCrossReference_TypeDef;
+                szAction = "move";
+            }
+            else
+            {
+                szAction = "keep";
+            }
 
-                for (int i = 0; i < pASSM->m_pTablesSize[TBL_TypeDef]; i++, src++, dst++)
-                {
-                    IXMLDOMNodePtr typeNode;
-                    CLR_RT_TypeDef_Index td;
-                    td.Set(pASSM->m_idx, i);
-                    char rgBuffer[512];
-                    LPSTR szBuffer = rgBuffer;
-                    size_t iBuffer = MAXSTRLEN(rgBuffer);
-                    std::wstring name;
-                    bool fFound;
-
-                    g_CLR_RT_TypeSystem.BuildTypeName(td, szBuffer, iBuffer);
-
-                    //
-                    // Skip types used by the runtime.
-                    //
-                    if (strchr(rgBuffer, '<'))
-                        continue;
-                    if (strchr(rgBuffer, '>'))
-                        continue;
-                    if (strchr(rgBuffer, '$'))
-                        continue;
+            if (strcmp(szAction, "keep"))
+            {
+                PlanDeployment_AddChunk(chunks, offset, size);
 
-                    CLR_RT_UnicodeHelper::ConvertFromUTF8(rgBuffer, name);
+                sizeOfDelta += size;
+            }
 
-                    NANOCLR_CHECK_HRESULT(xml.CreateNode(L"Type", &typeNode, assmNode));
+            fprintf(
+                stream,
+                "%-6s %s %d.%d.%d.%d offset 0x%08X size %d\n",
+                szAction,
+                it->c_str(),
+                hdr->version.iMajorVersion,
+                hdr->version.iMinorVersion,
+                hdr->version.iBuildNumber,
+                hdr->version.iRevisionNumber,
+                (CLR_UINT32)offset,
+                (int)size);
+
+            endOfAssemblies = offset + size;
+        }
 
-                    NANOCLR_CHECK_HRESULT(xml.PutAttribute(NULL, L"Name", name, fFound, typeNode));
-                    NANOCLR_CHECK_HRESULT(
-                        xml.PutAttribute(NULL, L"Hash", WatchAssemblyBuilder::ToHex(dst->m_hash), fFound, typeNode));
-                }
+        for (AssemblyNameVectorIter it = orderOld.begin(); it != orderOld.end(); it++)
+        {
+            if (assembliesNew.find(*it) == assembliesNew.end())
+            {
+                fprintf(stream, "%-6s %s\n", "remove", it->c_str());
             }
         }
-        NANOCLR_FOREACH_ASSEMBLY_END();
 
-        NANOCLR_CHECK_HRESULT(xml.Save(szFile));
+        //
+        // The terminator, and the directory if any, only need writing when they differ from what's in flash.
+        //
+        if (fileNew.m_size > endOfAssemblies)
+        {
+            size_t size = fileNew.m_size - endOfAssemblies;
 
-        NANOCLR_NOCLEANUP();
-    }
+            if (fileOld.m_size < fileNew.m_size ||
+                memcmp(&fileOld.m_data[endOfAssemblies], &fileNew.m_data[endOfAssemblies], size))
+            {
+                PlanDeployment_AddChunk(chunks, endOfAssemblies, size);
 
-    //--//
+                sizeOfDelta += size;
+            }
+        }
 
-    HRESULT
-    Cmd_CreateDatabase(CLR_RT_ParseOptions::ParameterList *params = NULL)
-    {
-        NANOCLR_HEADER();
+        fprintf(
+            stream,
+            "deploy %d bytes in %d chunks, out of %d\n",
+            (int)sizeOfDelta,
+            (int)chunks.size(),
+            (int)fileNew.m_size);
 
-        CLR_RT_StringVector vec;
-        CLR_RT_StringVectorIter iter;
-        CLR_RT_StringVectorIter current;
-        CLR_RT_Buffer database;
-        size_t pos;
+        //--//
 
-        NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::ExtractTokensFromFile(PARAM_EXTRACT_STRING(params, 0), vec));
+        pos = sizeof(NanoDatabaseDeltaHeader) + chunks.size() * sizeof(NanoDatabaseDeltaChunk);
+
+        delta.resize(pos + sizeOfDelta);
+
+        header = (NanoDatabaseDeltaHeader *)&delta[0];
+        header->magicNumber = NanoDatabaseDeltaHeader::MAGIC_NUMBER;
+        header->version = NanoDatabaseDeltaHeader::VERSION;
+        header->sizeOfImage = (CLR_UINT32)fileNew.m_size;
+        header->crcOfImage = SUPPORT_ComputeCRC(fileNew.m_data, (int)fileNew.m_size, 0);
+        header->numberOfChunks = (CLR_UINT32)chunks.size();
 
-        // Delete duplicate assemblies
-        current = vec.begin();
-        while (current != vec.end())
+        if (chunks.size())
         {
-            iter = current;
-            iter++;
-            while (iter != vec.end())
-            {
-                if (0 == (*current).compare(*iter))
-                {
-                    iter = vec.erase(iter);
-                }
-                else
-                {
-                    iter++;
-                }
-            }
-            if (current != vec.end())
-                current++;
+            memcpy(&delta[sizeof(NanoDatabaseDeltaHeader)], &chunks[0], chunks.size() * sizeof(NanoDatabaseDeltaChunk));
         }
 
-        for (size_t j = 0; j < vec.size(); j++)
+        for (DeltaChunkVectorIter it = chunks.begin(); it != chunks.end(); it++)
         {
-            CLR_RT_Buffer buffer;
+            memcpy(&delta[pos], &fileNew.m_data[it->offset], it->size);
 
-            NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::LoadFile(vec[j].c_str(), buffer));
+            pos += it->size;
+        }
 
-            pos = ROUNDTOMULTIPLE(database.size(), CLR_UINT32);
+        NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::SaveFile(szDelta, delta));
 
-            database.resize(pos + buffer.size());
+        wprintf(
+            L"Deployment: %d bytes in %d chunks, out of %d\n",
+            (int)sizeOfDelta,
+            (int)chunks.size(),
+            (int)fileNew.m_size);
 
-            memcpy(&database[pos], &buffer[0], buffer.size());
-        }
+        NANOCLR_CLEANUP();
 
-        //
-        // Add a group of zeros at the end, the device will stop at that point.
-        //
-        pos = ROUNDTOMULTIPLE(database.size(), CLR_UINT32);
-        database.resize(pos + sizeof(CLR_UINT32));
+        if (stream)
         {
-            NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::SaveFile(PARAM_EXTRACT_STRING(params, 1), database));
+            fclose(stream);
         }
-        NANOCLR_NOCLEANUP();
+
+        NANOCLR_CLEANUP_END();
     }
 
     void Usage()
@@ -978,10 +2294,54 @@ struct Settings : CLR_RT_ParseOptions
 
         OPTION_SET(&dumpStatistics, L"-ILstats", L"Dumps statistics about IL code");
 
+        OPTION_CALL(
+            Cmd_DumpILStats,
+            L"-ILstatsDump",
+            L"Saves the opcode n-grams, operands and branch distances of everything compiled with -ILstats");
+        PARAM_GENERIC(L"<file>", L"CSV output file, or JSON if the name ends in .json");
+
+        OPTION_SET(&pdbxBinary, L"-pdbxBinary", L"Also generates a binary .pdbxb file next to the .pdbx");
+
+        OPTION_SET(&foldMethods, L"-foldMethods", L"Shares the ByteCode of consecutive methods with identical bodies");
+
+        OPTION_SET(
+            &optimizeByteCode,
+            L"-optimizeByteCode",
+            L"Removes nops, unreachable code and redundant branches from the ByteCode");
+
+        OPTION_SET(
+            &compactLocals,
+            L"-compactLocals",
+            L"Lets local variables of the same type share a slot when their lifetimes don't overlap");
+
+        OPTION_STRING(
+            &profileFile,
+            L"-profile",
+            L"Lays out the hottest methods first, using hit counts collected on a device",
+            L"<file>",
+            L"One method per line (CLR token or full signature, with types by name) and its hit count");
+
+        OPTION_STRING(
+            &sizeReportFile,
+            L"-sizeReport",
+            L"Charges every byte of the compiled assembly to a namespace, type, method or resource",
+            L"<file>",
+            L"CSV output file");
+
+        OPTION_STRING(
+            &benchmarkBaselineFile,
+            L"-benchmarkBaseline",
+            L"Makes -benchmark fail when a phase is slower or bigger than in a previous run",
+            L"<file>",
+            L"Results of the previous run");
+
         //--//
 
         OPTION_CALL(Cmd_Reset, L"-reset", L"Clears all previous configuration");
 
+        OPTION_CALL(Cmd_HeapSize, L"-heapSize", L"Sets the most memory each managed heap can grow to");
+        PARAM_GENERIC(L"<MB>", L"Size in megabytes, 128 by default, 512 at most");
+
         //--//
 
         OPTION_CALL(Cmd_ResetHints, L"-resetHints", L"Clears all previous DLL hints");
@@ -1002,6 +2362,14 @@ struct Settings : CLR_RT_ParseOptions
 
         //--//
 
+        OPTION_CALL(
+            Cmd_DiffPatch,
+            L"-diff_patch",
+            L"Compares two versions of an assembly, lists what a patch would hold and estimates its size");
+        PARAM_GENERIC(L"<orig>", L"Assembly on the device, formatted for nanoCLR");
+        PARAM_GENERIC(L"<new>", L"Updated assembly, formatted for nanoCLR");
+        PARAM_GENERIC(L"<file>", L"Listing of the patch content");
+
         OPTION_SET(&patchToReboot, L"-patchReboot", L"Marks the patch as needing a reboot");
         OPTION_STRING(
             &patchNative,
@@ -1021,7 +2389,10 @@ struct Settings : CLR_RT_ParseOptions
 
         OPTION_CALL(Cmd_NoAttributes, L"-noAttributes", L"Skips any attribute present in the assembly");
 
-        OPTION_CALL(Cmd_ExcludeClassByName, L"-excludeClassByName", L"Removes a class from an assembly");
+        OPTION_CALL(
+            Cmd_ExcludeClassByName,
+            L"-excludeClassByName",
+            L"Removes a class from an assembly, a trailing '*' removes all the classes with that prefix");
         PARAM_GENERIC(L"<class>", L"Class to exclude");
 
         OPTION_CALL(Cmd_Minimize, L"-minimize", L"Minimizes the assembly, removing unwanted elements");
@@ -1041,15 +2412,43 @@ struct Settings : CLR_RT_ParseOptions
         OPTION_CALL(Cmd_Compile, L"-compile", L"Compiles an assembly into the nanoCLR format");
         PARAM_GENERIC(L"<file>", L"Generated filename");
 
+        OPTION_CALL(
+            Cmd_Watch,
+            L"-watch",
+            L"Watches the parsed assembly, its resources and dependencies, recompiling when they change");
+
         OPTION_CALL(Cmd_Load, L"-load", L"Loads an assembly formatted for nanoCLR");
         PARAM_GENERIC(L"<file>", L"File to load");
 
         OPTION_CALL(Cmd_LoadDatabase, L"-loadDatabase", L"Loads a set of assemblies");
         PARAM_GENERIC(L"<file>", L"Image to load");
 
+        OPTION_CALL(Cmd_LoadDatabaseAssembly, L"-loadDatabaseAssembly", L"Loads one assembly out of a database");
+        PARAM_GENERIC(L"<file>", L"Image to load from");
+        PARAM_GENERIC(L"<name>", L"Name of the assembly");
+
         OPTION_CALL(Cmd_DumpAll, L"-dump_all", L"Generates a report of an assembly's metadata");
         PARAM_GENERIC(L"<file>", L"Report file");
 
+        OPTION_CALL(
+            Cmd_DumpJson,
+            L"-dump_json",
+            L"Generates a machine-readable JSON report of the metadata of all the loaded assemblies");
+        PARAM_GENERIC(L"<file>", L"Report file");
+
+        OPTION_CALL(Cmd_SizeReportDiff, L"-sizeReportDiff", L"Compares two reports generated by -sizeReport");
+        PARAM_GENERIC(L"<old>", L"Report of the previous build");
+        PARAM_GENERIC(L"<new>", L"Report of the current build");
+        PARAM_GENERIC(L"<file>", L"CSV output file");
+
+        OPTION_CALL(
+            Cmd_Benchmark,
+            L"-benchmark",
+            L"Times the parse and compile phases on synthetic assemblies of the given shapes");
+        PARAM_GENERIC(L"<config>", L"e.g. types=100,methods=20,signatures=50,strings=2,eh=1,resources=16;types=1000");
+        PARAM_GENERIC(L"<iterations>", L"Runs per configuration");
+        PARAM_GENERIC(L"<file>", L"CSV output file");
+
         OPTION_CALL(Cmd_DumpDat, L"-dump_dat", L"dumps the pe files in a dat file together with their size");
         PARAM_GENERIC(L"<file>", L"Dat file");
 
@@ -1103,6 +2502,27 @@ struct Settings : CLR_RT_ParseOptions
         OPTION_CALL(Cmd_CreateDatabase, L"-create_database", L"Creates file database for a device");
         PARAM_GENERIC(L"<config>", L"File containing the Bill of Materials");
         PARAM_GENERIC(L"<file>", L"Output file");
+
+        OPTION_STRING(
+            &stringPoolFile,
+            L"-stringPool",
+            L"Collects the strings shared by the assemblies of -create_database, in -loadStrings format",
+            L"<file>",
+            L"Output file");
+
+        OPTION_CALL(
+            Cmd_PlanDeployment,
+            L"-plan_deployment",
+            L"Lists what changes between two databases, and extracts the parts of the new one to write to flash");
+        PARAM_GENERIC(L"<old>", L"Database on the device");
+        PARAM_GENERIC(L"<new>", L"Database to deploy");
+        PARAM_GENERIC(L"<plan>", L"Output file for the plan");
+        PARAM_GENERIC(L"<delta>", L"Output file for the delta");
+
+        OPTION_SET(
+            &databaseDirectory,
+            L"-databaseDirectory",
+            L"Appends a directory of the assemblies after the end of -create_database images");
     }
 };
 
@@ -1148,7 +2568,8 @@ int _tmain(int argc, _TCHAR *argv[])
     wprintf(L"For documentation, report issues and support visit our GitHub "
             L"repo: www.GitHub.com\\nanoFramework\r\n\r\n");
 
-    NANOCLR_CHECK_HRESULT(HAL_Windows::Memory_Resize(64 * 1024 * 1024));
+    // the heaps are committed as they get used, the cap only costs address space
+    NANOCLR_CHECK_HRESULT(HAL_Windows::Memory_Resize(128 * 1024 * 1024));
     // TODO check if we are still using this.....
     // HAL_Init_Custom_Heap();
 
@@ -35,46 +35,104 @@ HAL_SYSTEM_CONFIG HalSystemConfig = {
     {0, 0}, // { FLASH_MEMORY_Base, FLASH_MEMORY_Size },
 };
 
+//
+// Both heaps only reserve their address space, s_Memory_Length bytes each, and commit it in c_Memory_CommitChunk steps
+// the first time a page is touched, from a vectored exception handler. Commands that barely use the managed heap
+// start without paying for it. The address space is reserved by Memory_Resize, so a size that doesn't fit is reported
+// there.
+// Any access inside the heaps commits memory, wild or stale pointers included, like the fully committed heaps did
+// before. Every new chunk is filled with 0xEA, so reads of memory that was never written still stand out.
+//
+// Every commit starts as a first-chance access violation: a debugger set to break on those stops once per chunk, tell
+// it to continue or let it pass them to the program.
+// The heaps must never be handed to kernel-mode APIs, ReadFile/WriteFile and the like: they fail with ERROR_NOACCESS
+// on an uncommitted page instead of faulting, so the handler never gets a chance to commit it.
+//
+static const size_t c_Memory_CommitChunk = 1024 * 1024;
+
 static unsigned char *s_Memory_Start = NULL;
 static unsigned int s_Memory_Length = 1024 * 1024 * 10;
+static UINT8 *s_CustomHeap_Start = NULL;
+static PVOID s_Memory_Handler = NULL;
+static std::mutex s_Memory_Lock;
 
-void HeapLocation(unsigned char *&BaseAddress, unsigned int &SizeInBytes)
+static bool local_CommitChunk(unsigned char *start, unsigned char *address)
 {
-    if (!s_Memory_Start)
+    std::lock_guard<std::mutex> lock(s_Memory_Lock);
+
+    MEMORY_BASIC_INFORMATION mbi;
+    unsigned char *chunk;
+    size_t length;
+
+    if (start == NULL || address < start || address >= start + s_Memory_Length)
     {
-        s_Memory_Start =
-            (unsigned char *)::VirtualAlloc(NULL, s_Memory_Length, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        return false;
+    }
 
-        if (s_Memory_Start)
-        {
-            memset(s_Memory_Start, 0xEA, s_Memory_Length);
-        }
+    // another thread may have faulted on the same chunk and committed it already
+    if (::VirtualQuery(address, &mbi, sizeof(mbi)) && mbi.State == MEM_COMMIT)
+    {
+        return true;
+    }
+
+    chunk = start + ((address - start) & ~(c_Memory_CommitChunk - 1));
+    length = start + s_Memory_Length - chunk;
 
-        HalSystemConfig.RAM1.Base = (UINT32)(size_t)s_Memory_Start;
-        HalSystemConfig.RAM1.Size = (UINT32)(size_t)s_Memory_Length;
+    if (length > c_Memory_CommitChunk)
+        length = c_Memory_CommitChunk;
+
+    if (::VirtualAlloc(chunk, length, MEM_COMMIT, PAGE_READWRITE) == NULL)
+    {
+        return false;
     }
 
-    BaseAddress = s_Memory_Start;
-    SizeInBytes = s_Memory_Length;
-}
+    memset(chunk, 0xEA, length);
 
-static UINT8 *s_CustomHeap_Start = NULL;
+    return true;
+}
 
-void CustomHeapLocation(unsigned char *&BaseAddress, unsigned int &SizeInBytes)
+static LONG CALLBACK local_CommitOnAccess(PEXCEPTION_POINTERS info)
 {
-    if (!s_CustomHeap_Start)
+    EXCEPTION_RECORD *rec = info->ExceptionRecord;
+
+    if (rec->ExceptionCode == EXCEPTION_ACCESS_VIOLATION && rec->NumberParameters >= 2)
     {
-        s_CustomHeap_Start =
-            (unsigned char *)::VirtualAlloc(NULL, s_Memory_Length, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        unsigned char *address = (unsigned char *)rec->ExceptionInformation[1];
 
-        if (s_CustomHeap_Start)
+        if (local_CommitChunk(s_Memory_Start, address) || local_CommitChunk(s_CustomHeap_Start, address))
         {
-            memset(s_CustomHeap_Start, 0xEA, s_Memory_Length);
+            return EXCEPTION_CONTINUE_EXECUTION;
         }
     }
 
+    return EXCEPTION_CONTINUE_SEARCH;
+}
+
+static unsigned char *local_Reserve()
+{
+    unsigned char *start = (unsigned char *)::VirtualAlloc(NULL, s_Memory_Length, MEM_RESERVE, PAGE_READWRITE);
+
+    if (start && s_Memory_Handler == NULL)
+    {
+        s_Memory_Handler = ::AddVectoredExceptionHandler(1, local_CommitOnAccess);
+    }
+
+    return start;
+}
+
+//
+// Memory_Resize has already reserved both heaps, an empty heap is returned if that failed.
+//
+void HeapLocation(unsigned char *&BaseAddress, unsigned int &SizeInBytes)
+{
+    BaseAddress = s_Memory_Start;
+    SizeInBytes = s_Memory_Start ? s_Memory_Length : 0;
+}
+
+void CustomHeapLocation(unsigned char *&BaseAddress, unsigned int &SizeInBytes)
+{
     BaseAddress = s_CustomHeap_Start;
-    SizeInBytes = s_Memory_Length;
+    SizeInBytes = s_CustomHeap_Start ? s_Memory_Length : 0;
 }
 
 //--//
@@ -97,7 +155,37 @@ HRESULT HAL_Windows::Memory_Resize(unsigned int size)
         s_CustomHeap_Start = NULL;
     }
 
+    if (size == 0 || size > c_Memory_MaxSize)
+    {
+        NANOCLR_SET_AND_LEAVE(CLR_E_OUT_OF_RANGE);
+    }
+
     s_Memory_Length = size;
 
-    NANOCLR_NOCLEANUP_NOLABEL();
+    s_Memory_Start = local_Reserve();
+    s_CustomHeap_Start = local_Reserve();
+
+    if (s_Memory_Start == NULL || s_CustomHeap_Start == NULL)
+    {
+        if (s_Memory_Start)
+        {
+            ::VirtualFree(s_Memory_Start, 0, MEM_RELEASE);
+
+            s_Memory_Start = NULL;
+        }
+
+        if (s_CustomHeap_Start)
+        {
+            ::VirtualFree(s_CustomHeap_Start, 0, MEM_RELEASE);
+
+            s_CustomHeap_Start = NULL;
+        }
+
+        NANOCLR_SET_AND_LEAVE(CLR_E_OUT_OF_MEMORY);
+    }
+
+    HalSystemConfig.RAM1.Base = (UINT32)(size_t)s_Memory_Start;
+    HalSystemConfig.RAM1.Size = (UINT32)(size_t)s_Memory_Length;
+
+    NANOCLR_NOCLEANUP();
 }
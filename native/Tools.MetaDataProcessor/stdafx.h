@@ -29,6 +29,7 @@
 
 #include "AssemblyParser.h"
 #include "WatchAssemblyBuilder.h"
+#include "AssemblyReparser.h"
 
 #include <nanoCLR_Checks.h>
 #include <nanoCLR_Runtime.h>
@@ -43,7 +44,10 @@
 #include <nanoCLR_Win32.h>
 
 #include "HAL_Windows.h"
+#include "JsonDump_Win32.h"
+#include "Benchmark_Win32.h"
 
 #include <mutex>
+#include <thread>
 
 // TODO: reference additional headers your program requires here
@@ -1350,23 +1350,13 @@ MetaData::CustomAttribute::CustomAttribute(Parser *holder)
                            // ValueMap          m_valuesVariable;
 }
 
-HRESULT MetaData::CustomAttribute::Parse()
+HRESULT MetaData::CustomAttribute::Parse(const AttributeConstructor *&ctor)
 {
     NANOCLR_HEADER();
 
-    Parser *prDst;
-    MethodDef *mdDst;
+    NANOCLR_CHECK_HRESULT(m_holder->ResolveAttributeConstructor(m_tkType, ctor));
 
-    NANOCLR_CHECK_HRESULT(m_holder->m_holder->ResolveMethodDef(m_holder, m_tkType, prDst, mdDst));
-
-    {
-        Parser *prDst2;
-        TypeDef *tdDst2;
-
-        NANOCLR_CHECK_HRESULT(m_holder->m_holder->ResolveTypeDef(prDst, mdDst->m_td, prDst2, tdDst2));
-
-        m_nameOfAttributeClass = tdDst2->m_name.c_str();
-    }
+    m_nameOfAttributeClass = ctor->m_nameOfAttributeClass;
 
     {
         CustomAttribute::Reader reader(m_blob);
@@ -1382,41 +1372,11 @@ HRESULT MetaData::CustomAttribute::Parse()
             NANOCLR_SET_AND_LEAVE(CLR_E_PARSER_BAD_CUSTOM_ATTRIBUTE);
         }
 
-        for (TypeSignatureIter itTS = mdDst->m_method.m_lstParams.begin(); itTS != mdDst->m_method.m_lstParams.end();
-             itTS++)
+        for (size_t i = 0; i < ctor->m_params.size(); i++)
         {
             CustomAttribute::Value v;
-            TypeSignature &sig = *itTS;
-            bool fEnum = false;
-
-            if (sig.m_opt == ELEMENT_TYPE_VALUETYPE)
-            {
-                Parser *prDst2;
-                TypeDef *tdDst2;
-
-                NANOCLR_CHECK_HRESULT(m_holder->m_holder->ResolveTypeDef(sig.m_holder, sig.m_token, prDst2, tdDst2));
-
-                if (IsNilToken(tdDst2->m_extends) == false)
-                {
-                    std::wstring *name;
-
-                    if (TypeFromToken(tdDst2->m_extends) == mdtTypeDef)
-                    {
-                        name = &prDst2->m_mapDef_Type.find(tdDst2->m_extends)->second.m_name;
-                    }
-                    else
-                    {
-                        name = &prDst2->m_mapRef_Type[tdDst2->m_extends].m_name;
-                    }
-
-                    if (*name == L"System.Enum")
-                    {
-                        fEnum = true;
-                    }
-                }
-            }
 
-            v.m_opt = (CorSerializationType)(fEnum ? ELEMENT_TYPE_I4 : sig.m_opt);
+            v.m_opt = ctor->m_params[i];
 
             if (v.Parse(reader) == false)
             {
@@ -1541,6 +1501,9 @@ MetaData::Parser::Parser(Collection *holder)
     // PELoader                         m_pe;
     m_output = stdout; // FILE*                            m_output;
     m_toclose = NULL;  // FILE*                            m_toclose;
+    //
+    // ExcludeFilter                    m_filterExcludeClassByName;
+    // AttributeConstructorMap          m_mapAttributeConstructors;
 }
 
 MetaData::Parser::~Parser()
@@ -2758,36 +2721,35 @@ HRESULT MetaData::Parser::Analyze(LPCWSTR szFileName)
         {
             CustomAttributeMapIter itCA2 = itCA++;
             CustomAttribute &ca = itCA2->second;
+            const AttributeConstructor *ctor;
             bool fErase = false;
 
-            NANOCLR_CHECK_HRESULT(ca.Parse());
+            NANOCLR_CHECK_HRESULT(ca.Parse(ctor));
 
-            if (ca.m_nameOfAttributeClass == L"Microsoft.SPOT.NativeProfilerAttribute")
+            switch (ctor->m_kind)
             {
-                m_setAttributes_Methods_NativeProfiler.insert(ca.m_tkObj);
-                fErase = true;
-            }
+                case AttributeConstructor::AC_NativeProfiler:
+                    m_setAttributes_Methods_NativeProfiler.insert(ca.m_tkObj);
+                    fErase = true;
+                    break;
 
-            if (ca.m_nameOfAttributeClass == L"Microsoft.SPOT.GloballySynchronizedAttribute")
-            {
-                m_setAttributes_Methods_GloballySynchronized.insert(ca.m_tkObj);
-                fErase = true;
-            }
+                case AttributeConstructor::AC_GloballySynchronized:
+                    m_setAttributes_Methods_GloballySynchronized.insert(ca.m_tkObj);
+                    fErase = true;
+                    break;
 
-            if (ca.m_nameOfAttributeClass == L"Microsoft.SPOT.FieldNoReflectionAttribute" ||
-                ca.m_nameOfAttributeClass == L"System.Reflection.FieldNoReflectionAttribute")
-            {
-                m_setAttributes_Fields_NoReflection.insert(ca.m_tkObj);
-                fErase = true;
-            }
+                case AttributeConstructor::AC_FieldNoReflection:
+                    m_setAttributes_Fields_NoReflection.insert(ca.m_tkObj);
+                    fErase = true;
+                    break;
 
-            if (ca.m_nameOfAttributeClass == L"Microsoft.SPOT.PublishInApplicationDirectoryAttribute")
-            {
-                m_setAttributes_Types_PublishInApplicationDirectory.insert(ca.m_tkObj);
-                fErase = true;
+                case AttributeConstructor::AC_PublishInApplicationDirectory:
+                    m_setAttributes_Types_PublishInApplicationDirectory.insert(ca.m_tkObj);
+                    fErase = true;
+                    break;
             }
 
-            if (m_setFilter_ExcludeClassByName.find(ca.m_nameOfAttributeClass) != m_setFilter_ExcludeClassByName.end())
+            if (ctor->m_fExcluded)
             {
                 fErase = true;
             }
@@ -2817,19 +2779,182 @@ HRESULT MetaData::Parser::Analyze(LPCWSTR szFileName)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-HRESULT MetaData::Parser::CanIncludeMember(mdToken tk, mdToken tm)
+void MetaData::ExcludeFilter::Compile(const CLR_RT_StringSet &set)
 {
-    NANOCLR_HEADER();
+    m_names.clear();
+    m_trie.clear();
 
-    if (m_setFilter_ExcludeClassByName.size() > 0)
+    for (CLR_RT_StringSet::const_iterator it = set.begin(); it != set.end(); it++)
     {
-        std::wstring str;
-        TokenToString(tk, str);
+        const std::wstring &str = *it;
+        size_t len = str.size();
 
-        if (m_setFilter_ExcludeClassByName.find(str) != m_setFilter_ExcludeClassByName.end())
+        if (len > 0 && str[len - 1] == L'*')
         {
-            NANOCLR_SET_AND_LEAVE(S_FALSE);
+            size_t node = 0;
+
+            if (m_trie.empty())
+            {
+                m_trie.push_back(TrieNode());
+            }
+
+            for (size_t i = 0; i < len - 1; i++)
+            {
+                std::map<WCHAR, size_t>::iterator itChild = m_trie[node].m_children.find(str[i]);
+
+                if (itChild != m_trie[node].m_children.end())
+                {
+                    node = itChild->second;
+                }
+                else
+                {
+                    m_trie.push_back(TrieNode());
+
+                    m_trie[node].m_children[str[i]] = m_trie.size() - 1;
+                    node = m_trie.size() - 1;
+                }
+            }
+
+            m_trie[node].m_fEnd = true;
+        }
+        else
+        {
+            m_names.insert(NameMap::value_type(Hash(0, str.c_str(), len), str));
+        }
+    }
+}
+
+void MetaData::ExcludeFilter::Begin(Match &m) const
+{
+    m.m_hash = 0;
+    m.m_node = m_trie.empty() ? c_NoNode : 0;
+    m.m_fPrefix = m_trie.empty() ? false : m_trie[0].m_fEnd;
+}
+
+void MetaData::ExcludeFilter::Feed(Match &m, LPCWSTR str, size_t len) const
+{
+    m.m_hash = Hash(m.m_hash, str, len);
+
+    for (size_t i = 0; i < len && m.m_node != c_NoNode && m.m_fPrefix == false; i++)
+    {
+        const std::map<WCHAR, size_t> &children = m_trie[m.m_node].m_children;
+        std::map<WCHAR, size_t>::const_iterator it = children.find(str[i]);
+
+        if (it == children.end())
+        {
+            m.m_node = c_NoNode;
         }
+        else
+        {
+            m.m_node = it->second;
+            m.m_fPrefix = m_trie[m.m_node].m_fEnd;
+        }
+    }
+}
+
+//
+// FNV-1a, fed piece by piece it gives the same value as over the whole name.
+//
+CLR_UINT64 MetaData::ExcludeFilter::Hash(CLR_UINT64 hash, LPCWSTR str, size_t len)
+{
+    if (hash == 0)
+    {
+        hash = 0xCBF29CE484222325ULL;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (CLR_UINT64)str[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+//--//
+
+//
+// Same name as TokenToString builds for a TypeDef: the enclosing types, separated by '+', then the name.
+//
+void MetaData::Parser::ExcludeFilter_Feed(mdTypeDef td, ExcludeFilter::Match &m)
+{
+    TypeDefMapIter it = m_mapDef_Type.find(td);
+    if (it == m_mapDef_Type.end())
+        return;
+
+    TypeDef &def = it->second;
+
+    if (IsNilToken(def.m_enclosingClass) == false)
+    {
+        ExcludeFilter_Feed(def.m_enclosingClass, m);
+
+        m_filterExcludeClassByName.Feed(m, L"+", 1);
+    }
+
+    m_filterExcludeClassByName.Feed(m, def.m_name.c_str(), def.m_name.size());
+}
+
+//
+// Compares the full name of a TypeDef with the first 'len' characters of 'name', from the end.
+//
+bool MetaData::Parser::ExcludeFilter_Equals(mdTypeDef td, LPCWSTR name, size_t len)
+{
+    TypeDefMapIter it = m_mapDef_Type.find(td);
+    if (it == m_mapDef_Type.end())
+        return len == 0;
+
+    TypeDef &def = it->second;
+    size_t lenName = def.m_name.size();
+
+    if (len < lenName || wmemcmp(&name[len - lenName], def.m_name.c_str(), lenName) != 0)
+        return false;
+
+    len -= lenName;
+
+    if (IsNilToken(def.m_enclosingClass))
+        return len == 0;
+
+    if (len == 0 || name[len - 1] != L'+')
+        return false;
+
+    return ExcludeFilter_Equals(def.m_enclosingClass, name, len - 1);
+}
+
+bool MetaData::Parser::IsExcludedByName(mdTypeDef td)
+{
+    ExcludeFilter::Match m;
+
+    if (m_filterExcludeClassByName.IsEmpty())
+        return false;
+
+    m_filterExcludeClassByName.Begin(m);
+
+    ExcludeFilter_Feed(td, m);
+
+    if (m.m_fPrefix)
+        return true;
+
+    std::pair<ExcludeFilter::NameMapConstIter, ExcludeFilter::NameMapConstIter> range =
+        m_filterExcludeClassByName.m_names.equal_range(m.m_hash);
+
+    for (ExcludeFilter::NameMapConstIter it = range.first; it != range.second; it++)
+    {
+        if (ExcludeFilter_Equals(td, it->second.c_str(), it->second.size()))
+            return true;
+    }
+
+    return false;
+}
+
+//--//
+
+HRESULT MetaData::Parser::CanIncludeMember(mdToken tk, mdToken tm)
+{
+    NANOCLR_HEADER();
+
+    if (IsExcludedByName(tk))
+    {
+        NANOCLR_SET_AND_LEAVE(S_FALSE);
     }
 
     NANOCLR_NOCLEANUP();
@@ -2996,6 +3121,97 @@ HRESULT MetaData::Parser::BuildDependencyList(mdToken tk, mdTokenSet &set)
     NANOCLR_NOCLEANUP();
 }
 
+//--//
+
+typedef std::unordered_map<std::wstring, MetaData::AttributeConstructor::Kind> AttributeKindMap;
+
+static AttributeKindMap BuildAttributeKinds()
+{
+    AttributeKindMap kinds;
+
+    kinds[L"Microsoft.SPOT.NativeProfilerAttribute"] = MetaData::AttributeConstructor::AC_NativeProfiler;
+    kinds[L"Microsoft.SPOT.GloballySynchronizedAttribute"] = MetaData::AttributeConstructor::AC_GloballySynchronized;
+    kinds[L"Microsoft.SPOT.FieldNoReflectionAttribute"] = MetaData::AttributeConstructor::AC_FieldNoReflection;
+    kinds[L"System.Reflection.FieldNoReflectionAttribute"] = MetaData::AttributeConstructor::AC_FieldNoReflection;
+    kinds[L"Microsoft.SPOT.PublishInApplicationDirectoryAttribute"] =
+        MetaData::AttributeConstructor::AC_PublishInApplicationDirectory;
+
+    return kinds;
+}
+
+//
+// Attributes of the same class share the constructor token, so the constructor, its class and the types of its
+// parameters are resolved on the first instance only.
+//
+HRESULT MetaData::Parser::ResolveAttributeConstructor(mdToken tk, const AttributeConstructor *&ctor)
+{
+    NANOCLR_HEADER();
+
+    static const AttributeKindMap s_kinds = BuildAttributeKinds();
+
+    AttributeConstructorMapIter it = m_mapAttributeConstructors.find(tk);
+
+    if (it == m_mapAttributeConstructors.end())
+    {
+        AttributeConstructor ac;
+        AttributeKindMap::const_iterator itKind;
+        Parser *prDst;
+        MethodDef *mdDst;
+        Parser *prDst2;
+        TypeDef *tdDst2;
+
+        NANOCLR_CHECK_HRESULT(m_holder->ResolveMethodDef(this, tk, prDst, mdDst));
+        NANOCLR_CHECK_HRESULT(m_holder->ResolveTypeDef(prDst, mdDst->m_td, prDst2, tdDst2));
+
+        ac.m_nameOfAttributeClass = tdDst2->m_name;
+
+        for (TypeSignatureIter itTS = mdDst->m_method.m_lstParams.begin(); itTS != mdDst->m_method.m_lstParams.end();
+             itTS++)
+        {
+            TypeSignature &sig = *itTS;
+            bool fEnum = false;
+
+            if (sig.m_opt == ELEMENT_TYPE_VALUETYPE)
+            {
+                NANOCLR_CHECK_HRESULT(m_holder->ResolveTypeDef(sig.m_holder, sig.m_token, prDst2, tdDst2));
+
+                if (IsNilToken(tdDst2->m_extends) == false)
+                {
+                    std::wstring *name;
+
+                    if (TypeFromToken(tdDst2->m_extends) == mdtTypeDef)
+                    {
+                        name = &prDst2->m_mapDef_Type.find(tdDst2->m_extends)->second.m_name;
+                    }
+                    else
+                    {
+                        name = &prDst2->m_mapRef_Type[tdDst2->m_extends].m_name;
+                    }
+
+                    if (*name == L"System.Enum")
+                    {
+                        fEnum = true;
+                    }
+                }
+            }
+
+            ac.m_params.push_back((CorSerializationType)(fEnum ? ELEMENT_TYPE_I4 : sig.m_opt));
+        }
+
+        itKind = s_kinds.find(ac.m_nameOfAttributeClass);
+
+        ac.m_kind = (itKind != s_kinds.end()) ? itKind->second : AttributeConstructor::AC_Generic;
+        ac.m_fExcluded =
+            m_setFilter_ExcludeClassByName.find(ac.m_nameOfAttributeClass) != m_setFilter_ExcludeClassByName.end();
+
+        it = m_mapAttributeConstructors.insert(AttributeConstructorMap::value_type(tk, ac)).first;
+    }
+
+    ctor = &it->second;
+
+    NANOCLR_NOCLEANUP();
+}
+
 HRESULT MetaData::Parser::IncludeAttributes(mdToken tk, mdTokenSet &set)
 {
     NANOCLR_HEADER();
@@ -3041,18 +3257,15 @@ HRESULT MetaData::Parser::IncludeAttributes(mdToken tk, mdTokenSet &set)
 
         if (ca.m_tkObj == tk)
         {
-            Parser *prDst;
-            MethodDef *mdDst;
-            TypeDef *tdDst;
+            const AttributeConstructor *ctor;
             bool fIgnore;
 
-            NANOCLR_CHECK_HRESULT(m_holder->ResolveMethodDef(this, ca.m_tkType, prDst, mdDst));
-            NANOCLR_CHECK_HRESULT(m_holder->ResolveTypeDef(prDst, mdDst->m_td, prDst, tdDst));
+            NANOCLR_CHECK_HRESULT(ResolveAttributeConstructor(ca.m_tkType, ctor));
 
             fIgnore = false;
             for (int i = 0; i < (int)(ARRAYSIZE(ignoreAttributes)); i++)
             {
-                if (wcscmp(tdDst->m_name.c_str(), ignoreAttributes[i]) == 0)
+                if (wcscmp(ctor->m_nameOfAttributeClass.c_str(), ignoreAttributes[i]) == 0)
                 {
                     fIgnore = true;
                     break;
@@ -3076,16 +3289,18 @@ HRESULT MetaData::Parser::RemoveUnused()
     mdTokenSet set;
     mdTokenSet setNew;
 
+    m_filterExcludeClassByName.Compile(m_setFilter_ExcludeClassByName);
+
     for (TypeDefMapIter itTypeDef = m_mapDef_Type.begin(); itTypeDef != m_mapDef_Type.end(); itTypeDef++)
     {
         mdToken tk = itTypeDef->second.m_td;
         TypeDef &td = itTypeDef->second;
 
-        std::wstring str;
-        TokenToString(tk, str);
-
-        if (m_setFilter_ExcludeClassByName.find(str) != m_setFilter_ExcludeClassByName.end())
+        if (IsExcludedByName(tk))
         {
+            std::wstring str;
+            TokenToString(tk, str);
+
             wprintf(L"Excluding %s\n", str.c_str());
             continue;
         }
@@ -3608,6 +3823,45 @@ HRESULT MetaData::Collection::CreateAssembly(Parser *&pr)
     NANOCLR_NOCLEANUP_NOLABEL();
 }
 
+void MetaData::Collection::ReleaseAssembly(Parser *pr)
+{
+    for (AssembliesMapIter it = m_mapAssemblies.begin(); it != m_mapAssemblies.end(); it++)
+    {
+        if (it->second == pr)
+        {
+            m_mapAssemblies.erase(it);
+            break;
+        }
+    }
+
+    delete pr;
+}
+
+void MetaData::Collection::ReleaseAssembly(const std::wstring &file)
+{
+    AssembliesMapIter it = m_mapAssemblies.find(file);
+
+    if (it != m_mapAssemblies.end())
+    {
+        delete it->second;
+
+        m_mapAssemblies.erase(it);
+    }
+}
+
+void MetaData::Collection::GetAssemblyFiles(CLR_RT_StringSet &files)
+{
+    for (AssembliesMapIter itASSM = m_mapAssemblies.begin(); itASSM != m_mapAssemblies.end(); itASSM++)
+    {
+        files.insert(itASSM->first);
+    }
+
+    for (LoadHintsMapIter itLH = m_mapLoadHints.begin(); itLH != m_mapLoadHints.end(); itLH++)
+    {
+        files.insert(itLH->second);
+    }
+}
+
 //--//
 
 bool MetaData::Collection::IsAssemblyToken(Parser *pr, mdToken tk)
@@ -329,114 +329,148 @@ void MetaData::Parser::Dump_CloseDevice()
     m_output = stdout;
 }
 
-void MetaData::Parser::Dump_PrintSigForType(TypeSignature &sig)
+//
+// With fTypeNames, classes and value types are rendered by name instead of by token, so the string stays the same
+// across builds of the assembly.
+//
+void MetaData::Parser::SigToString(TypeSignature &sig, std::wstring &str, bool fTypeNames)
 {
+    WCHAR buffer[32];
+    std::wstring strType;
+
     switch (sig.m_opt)
     {
         case ELEMENT_TYPE_VOID:
-            fwprintf(m_output, L"VOID");
+            str.append(L"VOID");
             break;
         case ELEMENT_TYPE_BOOLEAN:
-            fwprintf(m_output, L"BOOLEAN");
+            str.append(L"BOOLEAN");
             break;
         case ELEMENT_TYPE_CHAR:
-            fwprintf(m_output, L"CHAR");
+            str.append(L"CHAR");
             break;
         case ELEMENT_TYPE_I1:
-            fwprintf(m_output, L"I1");
+            str.append(L"I1");
             break;
         case ELEMENT_TYPE_U1:
-            fwprintf(m_output, L"U1");
+            str.append(L"U1");
             break;
         case ELEMENT_TYPE_I2:
-            fwprintf(m_output, L"I2");
+            str.append(L"I2");
             break;
         case ELEMENT_TYPE_U2:
-            fwprintf(m_output, L"U2");
+            str.append(L"U2");
             break;
         case ELEMENT_TYPE_I4:
-            fwprintf(m_output, L"I4");
+            str.append(L"I4");
             break;
         case ELEMENT_TYPE_U4:
-            fwprintf(m_output, L"U4");
+            str.append(L"U4");
             break;
         case ELEMENT_TYPE_I8:
-            fwprintf(m_output, L"I8");
+            str.append(L"I8");
             break;
         case ELEMENT_TYPE_U8:
-            fwprintf(m_output, L"U8");
+            str.append(L"U8");
             break;
         case ELEMENT_TYPE_R4:
-            fwprintf(m_output, L"R4");
+            str.append(L"R4");
             break;
         case ELEMENT_TYPE_R8:
-            fwprintf(m_output, L"R8");
+            str.append(L"R8");
             break;
         case ELEMENT_TYPE_STRING:
-            fwprintf(m_output, L"STRING");
+            str.append(L"STRING");
             break;
         case ELEMENT_TYPE_PTR:
-            fwprintf(m_output, L"PTR ");
+            str.append(L"PTR ");
             break;
         case ELEMENT_TYPE_BYREF:
-            fwprintf(m_output, L"BYREF ");
+            str.append(L"BYREF ");
             break;
         case ELEMENT_TYPE_VALUETYPE:
-            fwprintf(m_output, L"VALUETYPE [%08x]", sig.m_token);
-            break;
         case ELEMENT_TYPE_CLASS:
-            fwprintf(m_output, L"CLASS [%08x]", sig.m_token);
+            str.append(sig.m_opt == ELEMENT_TYPE_VALUETYPE ? L"VALUETYPE " : L"CLASS ");
+
+            if (fTypeNames)
+            {
+                TokenToString(sig.m_token, strType);
+                str.append(strType);
+            }
+            else
+            {
+                swprintf_s(buffer, ARRAYSIZE(buffer), L"[%08x]", sig.m_token);
+                str.append(buffer);
+            }
             break;
         case ELEMENT_TYPE_ARRAY:
-            fwprintf(m_output, L"ARRAY!!");
+            str.append(L"ARRAY!!");
             break;
         case ELEMENT_TYPE_TYPEDBYREF:
-            fwprintf(m_output, L"TYPEDBYREF!!");
+            str.append(L"TYPEDBYREF!!");
             break;
         case ELEMENT_TYPE_I:
-            fwprintf(m_output, L"I");
+            str.append(L"I");
             break;
         case ELEMENT_TYPE_U:
-            fwprintf(m_output, L"U");
+            str.append(L"U");
             break;
         case ELEMENT_TYPE_FNPTR:
-            fwprintf(m_output, L"FNPTR!!");
+            str.append(L"FNPTR!!");
             break;
         case ELEMENT_TYPE_OBJECT:
-            fwprintf(m_output, L"OBJECT");
+            str.append(L"OBJECT");
             break;
         case ELEMENT_TYPE_SZARRAY:
-            fwprintf(m_output, L"SZARRAY ");
+            str.append(L"SZARRAY ");
             break;
 
         case ELEMENT_TYPE_SENTINEL:
-            fwprintf(m_output, L"SENTINEL!!");
+            str.append(L"SENTINEL!!");
             break;
         case ELEMENT_TYPE_PINNED:
-            fwprintf(m_output, L"PINNED!!");
+            str.append(L"PINNED!!");
             break;
     }
 
     if (sig.m_sub)
-        Dump_PrintSigForType(*sig.m_sub);
+        SigToString(*sig.m_sub, str, fTypeNames);
 }
 
-void MetaData::Parser::Dump_PrintSigForMethod(MethodSignature &sig)
+void MetaData::Parser::SigToString(MethodSignature &sig, std::wstring &str, bool fTypeNames)
 {
-    Dump_PrintSigForType(sig.m_retValue);
+    SigToString(sig.m_retValue, str, fTypeNames);
 
-    fwprintf(m_output, L"(");
+    str.append(L"(");
 
     for (TypeSignatureIter it = sig.m_lstParams.begin(); it != sig.m_lstParams.end();)
     {
-        fwprintf(m_output, L" ");
+        str.append(L" ");
 
-        Dump_PrintSigForType(*it++);
+        SigToString(*it++, str, fTypeNames);
 
-        fwprintf(m_output, (it == sig.m_lstParams.end()) ? L" " : L",");
+        str.append((it == sig.m_lstParams.end()) ? L" " : L",");
     }
 
-    fwprintf(m_output, L")");
+    str.append(L")");
+}
+
+void MetaData::Parser::Dump_PrintSigForType(TypeSignature &sig)
+{
+    std::wstring str;
+
+    SigToString(sig, str, false);
+
+    fwprintf(m_output, L"%s", str.c_str());
+}
+
+void MetaData::Parser::Dump_PrintSigForMethod(MethodSignature &sig)
+{
+    std::wstring str;
+
+    SigToString(sig, str, false);
+
+    fwprintf(m_output, L"%s", str.c_str());
 }
 
 void MetaData::Parser::Dump_PrintSigForLocalVar(LocalVarSignature &sig)
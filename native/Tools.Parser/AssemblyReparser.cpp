@@ -6,6 +6,108 @@
 
 #define NOTCOMPATIBLE_MASKED(src, dst, mask) ((src) & (mask)) != ((dst) & (mask))
 
+//
+// Refs and Defs of the same entity share a kind, since they share a display string.
+//
+enum StructuralHashKind
+{
+    HASH_TypeSignature = 1,
+    HASH_MethodSignature,
+    HASH_LocalVarSignature,
+    HASH_Assembly,
+    HASH_Type,
+    HASH_NestedType,
+    HASH_Field,
+    HASH_Method,
+    HASH_Attribute,
+    HASH_TypeSpec,
+    HASH_String,
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline CLR_UINT64 StructuralHash_Rotate(CLR_UINT64 val, int bits)
+{
+    return (val << bits) | (val >> (64 - bits));
+}
+
+static inline CLR_UINT64 StructuralHash_Finalize(CLR_UINT64 val)
+{
+    val ^= val >> 33;
+    val *= 0xFF51AFD7ED558CCDULL;
+    val ^= val >> 33;
+    val *= 0xC4CEB9FE1A85EC53ULL;
+    val ^= val >> 33;
+
+    return val;
+}
+
+void MetaData::Reparser::StructuralHash::Begin(CLR_UINT32 kind)
+{
+    m_hi = 0x9E3779B97F4A7C15ULL ^ kind;
+    m_lo = 0xC2B2AE3D27D4EB4FULL + kind;
+}
+
+void MetaData::Reparser::StructuralHash::Add(CLR_UINT64 val)
+{
+    m_lo ^= val;
+    m_lo *= 0x87C37B91114253D5ULL;
+    m_lo = StructuralHash_Rotate(m_lo, 31);
+
+    m_hi += m_lo;
+    m_hi *= 0x4CF5AD432745937FULL;
+    m_hi = StructuralHash_Rotate(m_hi, 27);
+}
+
+void MetaData::Reparser::StructuralHash::Add(LPCSTR val, size_t len)
+{
+    CLR_UINT64 chunk;
+
+    Add((CLR_UINT64)len);
+
+    while (len >= sizeof(chunk))
+    {
+        memcpy(&chunk, val, sizeof(chunk));
+        Add(chunk);
+
+        val += sizeof(chunk);
+        len -= sizeof(chunk);
+    }
+
+    if (len)
+    {
+        chunk = 0;
+        memcpy(&chunk, val, len);
+        Add(chunk);
+    }
+}
+
+void MetaData::Reparser::StructuralHash::Add(const StructuralHash &val)
+{
+    Add(val.m_hi);
+    Add(val.m_lo);
+}
+
+void MetaData::Reparser::StructuralHash::End()
+{
+    m_hi += m_lo;
+    m_lo += m_hi;
+
+    m_hi = StructuralHash_Finalize(m_hi);
+    m_lo = StructuralHash_Finalize(m_lo);
+
+    m_hi += m_lo;
+    m_lo += m_hi;
+
+    //
+    // All zeros marks a hash not computed yet.
+    //
+    if (IsEmpty())
+    {
+        m_lo = 1;
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 MetaData::Reparser::TypeSignaturePtr::TypeSignaturePtr()
@@ -163,6 +265,24 @@ void MetaData::Reparser::TypeSignature::BuildString()
     }
 }
 
+void MetaData::Reparser::TypeSignature::BuildHash()
+{
+    m_hash.Begin(HASH_TypeSignature);
+    m_hash.Add((CLR_UINT64)m_opt);
+
+    if (!!m_sub)
+    {
+        m_hash.Add(m_sub->GetHash());
+    }
+
+    if (!!m_token)
+    {
+        m_hash.Add(m_token->GetHash());
+    }
+
+    m_hash.End();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void MetaData::Reparser::MethodSignature::Parse(Assembly *holder, CLR_RT_Assembly *assm, CLR_PMETADATA &pSigBlob)
@@ -203,11 +323,25 @@ void MetaData::Reparser::MethodSignature::BuildString()
     m_displayString += fFirst ? " ()" : " )";
 }
 
+void MetaData::Reparser::MethodSignature::BuildHash()
+{
+    m_hash.Begin(HASH_MethodSignature);
+    m_hash.Add(m_retValue.GetHash());
+    m_hash.Add((CLR_UINT64)m_lstParams.size());
+
+    for (TypeSignatureIter it = m_lstParams.begin(); it != m_lstParams.end(); it++)
+    {
+        m_hash.Add(it->GetHash());
+    }
+
+    m_hash.End();
+}
+
 //--//
 
 bool MetaData::Reparser::MethodSignature::operator==(MethodSignature &sig)
 {
-    return this->GetDisplayString() == sig.GetDisplayString();
+    return this->GetHash() == sig.GetHash();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -249,11 +383,24 @@ void MetaData::Reparser::LocalVarSignature::BuildString()
     }
 }
 
+void MetaData::Reparser::LocalVarSignature::BuildHash()
+{
+    m_hash.Begin(HASH_LocalVarSignature);
+    m_hash.Add((CLR_UINT64)m_lstVars.size());
+
+    for (TypeSignatureIter it = m_lstVars.begin(); it != m_lstVars.end(); it++)
+    {
+        m_hash.Add(it->GetHash());
+    }
+
+    m_hash.End();
+}
+
 //--//
 
 bool MetaData::Reparser::LocalVarSignature::operator==(LocalVarSignature &sig)
 {
-    return this->GetDisplayString() == sig.GetDisplayString();
+    return this->GetHash() == sig.GetHash();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -274,7 +421,7 @@ MetaData::Reparser::BaseElement::BaseElement()
 
 bool MetaData::Reparser::BaseElement::operator==(BaseElement &be)
 {
-    return this->GetDisplayString() == be.GetDisplayString();
+    return this->GetHash() == be.GetHash();
 }
 
 const std::string &MetaData::Reparser::BaseElement::GetDisplayString()
@@ -287,6 +434,16 @@ const std::string &MetaData::Reparser::BaseElement::GetDisplayString()
     return m_displayString;
 }
 
+const MetaData::Reparser::StructuralHash &MetaData::Reparser::BaseElement::GetHash()
+{
+    if (m_hash.IsEmpty())
+    {
+        BuildHash();
+    }
+
+    return m_hash;
+}
+
 //--//
 
 void MetaData::Reparser::AssemblyRef::Parse(
@@ -303,6 +460,11 @@ void MetaData::Reparser::AssemblyRef::BuildString()
     MetaData::Reparser::Assembly::BuildString(m_displayString, m_name.c_str(), m_version);
 }
 
+void MetaData::Reparser::AssemblyRef::BuildHash()
+{
+    MetaData::Reparser::Assembly::BuildHash(m_hash, m_name.c_str(), m_version);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void MetaData::Reparser::TypeRef::Parse(BaseToken *container, CLR_RT_Assembly *assm, const CLR_RECORD_TYPEREF *src)
@@ -344,6 +506,24 @@ void MetaData::Reparser::TypeRef::BuildString()
     }
 }
 
+void MetaData::Reparser::TypeRef::BuildHash()
+{
+    if (m_scope->GetTableOfInstance() == TBL_AssemblyRef)
+    {
+        m_hash.Begin(HASH_Type);
+        m_hash.Add(m_scope->GetHash());
+        m_hash.Add(m_nameSpace);
+    }
+    else
+    {
+        m_hash.Begin(HASH_NestedType);
+        m_hash.Add(m_scope->GetHash());
+    }
+
+    m_hash.Add(m_name);
+    m_hash.End();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void MetaData::Reparser::FieldRef::Parse(BaseToken *container, CLR_RT_Assembly *assm, const CLR_RECORD_FIELDREF *src)
@@ -367,6 +547,15 @@ void MetaData::Reparser::FieldRef::BuildString()
     m_displayString += m_sig.GetDisplayString();
 }
 
+void MetaData::Reparser::FieldRef::BuildHash()
+{
+    m_hash.Begin(HASH_Field);
+    m_hash.Add(m_container->GetHash());
+    m_hash.Add(m_name);
+    m_hash.Add(m_sig.GetHash());
+    m_hash.End();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void MetaData::Reparser::MethodRef::Parse(BaseToken *container, CLR_RT_Assembly *assm, const CLR_RECORD_METHODREF *src)
@@ -389,6 +578,15 @@ void MetaData::Reparser::MethodRef::BuildString()
     m_displayString += m_sig.GetDisplayString();
 }
 
+void MetaData::Reparser::MethodRef::BuildHash()
+{
+    m_hash.Begin(HASH_Method);
+    m_hash.Add(m_container->GetHash());
+    m_hash.Add(m_name);
+    m_hash.Add(m_sig.GetHash());
+    m_hash.End();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void MetaData::Reparser::TypeDef::Parse(BaseToken *container, CLR_RT_Assembly *assm, const CLR_RECORD_TYPEDEF *src)
@@ -463,7 +661,7 @@ void MetaData::Reparser::TypeDef::ParseField(BaseTokenPtrList &lst, CLR_RT_Assem
 bool MetaData::Reparser::TypeDef::IsCompatible(TypeDef *ptr)
 {
     //
-    // Compare by display string, this include enclosingType, nameSpace, and name.
+    // Compare by structural hash, this includes enclosingType, nameSpace, and name.
     //
     if (*this != *ptr)
         return false;
@@ -510,6 +708,24 @@ void MetaData::Reparser::TypeDef::BuildString()
     }
 }
 
+void MetaData::Reparser::TypeDef::BuildHash()
+{
+    if (!m_enclosingType)
+    {
+        m_hash.Begin(HASH_Type);
+        m_hash.Add(m_holder->GetHash());
+        m_hash.Add(m_nameSpace);
+    }
+    else
+    {
+        m_hash.Begin(HASH_NestedType);
+        m_hash.Add(m_enclosingType->GetHash());
+    }
+
+    m_hash.Add(m_name);
+    m_hash.End();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void MetaData::Reparser::FieldDef::Parse(BaseToken *container, CLR_RT_Assembly *assm, const CLR_RECORD_FIELDDEF *src)
@@ -528,7 +744,7 @@ void MetaData::Reparser::FieldDef::Parse(BaseToken *container, CLR_RT_Assembly *
     {
         CLR_PMETADATA ptrSrc = assm->GetSignature(src->defaultValue);
         CLR_UINT32 lenSrc;
-        TINYCLR_READ_UNALIGNED_UINT16(lenSrc, ptrSrc);
+        NANOCLR_READ_UNALIGNED_UINT16(lenSrc, ptrSrc);
 
         m_defaultValue.resize(lenSrc);
         memcpy(&m_defaultValue[0], ptrSrc, lenSrc);
@@ -559,6 +775,15 @@ void MetaData::Reparser::FieldDef::BuildString()
     m_displayString += m_sig.GetDisplayString();
 }
 
+void MetaData::Reparser::FieldDef::BuildHash()
+{
+    m_hash.Begin(HASH_Field);
+    m_hash.Add(m_container->GetHash());
+    m_hash.Add(m_name);
+    m_hash.Add(m_sig.GetHash());
+    m_hash.End();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void MetaData::Reparser::MethodDef::Parse(BaseToken *container, CLR_RT_Assembly *assm, const CLR_RECORD_METHODDEF *src)
@@ -592,7 +817,7 @@ void MetaData::Reparser::MethodDef::Parse(BaseToken *container, CLR_RT_Assembly
         CLR_OFFSET start;
         CLR_OFFSET end;
 
-        if (assm->FindMethodBoundaries(CLR_DataFromTk(m_tk), start, end))
+        if (WatchAssemblyBuilder::FindMethodBoundaries(assm, CLR_DataFromTk(m_tk), start, end))
         {
             CLR_PMETADATA pStart = assm->GetByteCode(start);
             CLR_PMETADATA pEnd = assm->GetByteCode(end);
@@ -629,7 +854,7 @@ void MetaData::Reparser::MethodDef::Parse(BaseToken *container, CLR_RT_Assembly
 bool MetaData::Reparser::MethodDef::IsCompatible(MethodDef *ptr)
 {
     //
-    // Compare by display string, this include container, name, sig.
+    // Compare by structural hash, this includes container, name, sig.
     //
     if (*this != *ptr)
         return false;
@@ -744,6 +969,15 @@ void MetaData::Reparser::MethodDef::BuildString()
     m_displayString += m_sig.GetDisplayString();
 }
 
+void MetaData::Reparser::MethodDef::BuildHash()
+{
+    m_hash.Begin(HASH_Method);
+    m_hash.Add(m_container->GetHash());
+    m_hash.Add(m_name);
+    m_hash.Add(m_sig.GetHash());
+    m_hash.End();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 MetaData::Reparser::Attribute::Reader::Reader(CLR_RT_Assembly *assm, CLR_PMETADATA sig)
@@ -901,6 +1135,14 @@ void MetaData::Reparser::Attribute::BuildString()
     m_displayString += m_constructor->GetDisplayString();
 }
 
+void MetaData::Reparser::Attribute::BuildHash()
+{
+    m_hash.Begin(HASH_Attribute);
+    m_hash.Add(m_owner->GetHash());
+    m_hash.Add(m_constructor->GetHash());
+    m_hash.End();
+}
+
 bool MetaData::Reparser::Attribute::IsCompatible(Attribute *ptr)
 {
     if (Assembly::CompareObject(m_owner, ptr->m_owner) == false)
@@ -952,6 +1194,13 @@ void MetaData::Reparser::TypeSpec::BuildString()
     m_displayString += m_sig.GetDisplayString();
 }
 
+void MetaData::Reparser::TypeSpec::BuildHash()
+{
+    m_hash.Begin(HASH_TypeSpec);
+    m_hash.Add(m_sig.GetHash());
+    m_hash.End();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void MetaData::Reparser::String::Parse(BaseToken *container, CLR_RT_Assembly *assm, LPCSTR src)
@@ -970,6 +1219,13 @@ void MetaData::Reparser::String::BuildString()
     m_displayString += m_value;
 }
 
+void MetaData::Reparser::String::BuildHash()
+{
+    m_hash.Begin(HASH_String);
+    m_hash.Add(m_value);
+    m_hash.End();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static LPCSTR TokenToString(mdToken tk)
@@ -1031,17 +1287,27 @@ void MetaData::Reparser::Assembly::BuildString(std::string &value, LPCSTR szName
     // value += buf;
 }
 
+void MetaData::Reparser::Assembly::BuildHash(StructuralHash &value, LPCSTR szName, const CLR_RECORD_VERSION &ver)
+{
+    //
+    // Like the display string, the version is not part of the identity.
+    //
+    value.Begin(HASH_Assembly);
+    value.Add(szName, strlen(szName));
+    value.End();
+}
+
 //--//
 
 HRESULT MetaData::Reparser::Assembly::Load(LPCWSTR szFile)
 {
-    TINYCLR_HEADER();
+    NANOCLR_HEADER();
 
     CLR_RT_Buffer buffer;
     CLR_RECORD_ASSEMBLY *header;
     CLR_RT_Assembly *assm = NULL;
 
-    TINYCLR_CHECK_HRESULT(CLR_RT_FileStore::LoadFile(szFile, buffer));
+    NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::LoadFile(szFile, buffer));
 
     m_assemblyFile = szFile;
 
@@ -1056,10 +1322,10 @@ HRESULT MetaData::Reparser::Assembly::Load(LPCWSTR szFile)
         }
         wprintf(L"\n");
 
-        TINYCLR_SET_AND_LEAVE(CLR_E_FAIL);
+        NANOCLR_SET_AND_LEAVE(CLR_E_FAIL);
     }
 
-    TINYCLR_CHECK_HRESULT(CLR_RT_Assembly::CreateInstance(header, assm));
+    NANOCLR_CHECK_HRESULT(CLR_RT_Assembly::CreateInstance(header, assm));
 
     m_name = assm->m_szName;
     m_version = assm->m_header->version;
@@ -1075,7 +1341,7 @@ HRESULT MetaData::Reparser::Assembly::Load(LPCWSTR szFile)
         {                                                                                                              \
             if (Parse(assm, CLR_TkFromType(tbl, i)) == NULL)                                                           \
             {                                                                                                          \
-                TINYCLR_SET_AND_LEAVE(CLR_E_FAIL);                                                                     \
+                NANOCLR_SET_AND_LEAVE(CLR_E_FAIL);                                                                     \
             }                                                                                                          \
         }                                                                                                              \
     }
@@ -1090,9 +1356,10 @@ HRESULT MetaData::Reparser::Assembly::Load(LPCWSTR szFile)
 
     //
     // Analyze bytecode.
+    // Parse() adds objects while walking, so walk the ordered token map, which keeps its iterators valid.
     //
     {
-        for (StringToObjectIter it = m_lookupStringToObject.begin(); it != m_lookupStringToObject.end(); it++)
+        for (TokenToObjectIter it = m_lookupTokenToObject.begin(); it != m_lookupTokenToObject.end(); it++)
         {
             MethodDef *md = it->second.CastTo(MethodDef());
             if (md)
@@ -1123,14 +1390,14 @@ HRESULT MetaData::Reparser::Assembly::Load(LPCWSTR szFile)
 
     //--//
 
-    TINYCLR_CLEANUP();
+    NANOCLR_CLEANUP();
 
     if (assm)
     {
         assm->MarkDead();
     }
 
-    TINYCLR_CLEANUP_END();
+    NANOCLR_CLEANUP_END();
 }
 
 //--//
@@ -1143,114 +1410,167 @@ void MetaData::Reparser::Assembly::Dump()
     }
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////////
-
-HRESULT MetaData::Reparser::Assembly::Compare_TypeDef(
-    Assembly *other,
-    StringSet *equal,
-    StringSet *changed,
-    StringSet *missing)
+//
+// Lists the content of a patch built by CreateDiff, with an estimate of its size in the nanoCLR format: the records,
+// the ByteCode and EH tables of the methods and the strings, on top of the assembly header.
+//
+HRESULT MetaData::Reparser::Assembly::ListPatch(LPCWSTR szFile, size_t &size)
 {
-    TINYCLR_HEADER();
+    NANOCLR_HEADER();
 
-    std::string value;
-    mdTokenSet res;
+    StringSet strings;
+    FILE *stream = NULL;
 
-    if (equal)
-        equal->clear();
-    if (changed)
-        changed->clear();
-    if (missing)
-        missing->clear();
+    if (_wfopen_s(&stream, szFile, L"w") != 0)
+    {
+        NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FILE_IO, L"Cannot open '%s'\n", szFile);
+    }
 
-    REPARSER_TABLE_ENUM_BEGIN(this, TypeDef)
+    size = sizeof(CLR_RECORD_ASSEMBLY);
+
+    for (TokenToObjectIter it = m_lookupTokenToObject.begin(); it != m_lookupTokenToObject.end(); it++)
     {
-        const std::string &str = rec->GetDisplayString();
-        TypeDef *rec2 = other->FindObject(str, TypeDef());
+        BaseToken *ptr = it->second;
+        LPCSTR szKind = IsAPatch(ptr) ? "patch" : (IsAFullObject(ptr) ? "create" : "ref");
 
-        if (rec2 == NULL)
-        {
-            if (missing)
-                missing->insert(str);
-        }
-        else
+        switch (ptr->GetTableOfInstance())
         {
-            if (rec->IsCompatible(rec2) == false)
+            case TBL_AssemblyRef:
+                size += sizeof(CLR_RECORD_ASSEMBLYREF);
+                break;
+
+            case TBL_TypeRef:
+                size += sizeof(CLR_RECORD_TYPEREF);
+                break;
+
+            case TBL_FieldRef:
+                size += sizeof(CLR_RECORD_FIELDREF);
+                break;
+
+            case TBL_MethodRef:
+                size += sizeof(CLR_RECORD_METHODREF);
+                break;
+
+            case TBL_TypeDef:
+            {
+                TypeDef *td = (TypeDef *)ptr;
+
+                strings.insert(td->m_name);
+                strings.insert(td->m_nameSpace);
+
+                size += sizeof(CLR_RECORD_TYPEDEF);
+            }
+            break;
+
+            case TBL_FieldDef:
             {
-                if (changed)
-                    changed->insert(str);
+                FieldDef *fd = (FieldDef *)ptr;
+
+                strings.insert(fd->m_name);
+
+                size += sizeof(CLR_RECORD_FIELDDEF) + fd->m_defaultValue.size();
             }
-            else
+            break;
+
+            case TBL_MethodDef:
             {
-                if (equal)
-                    equal->insert(str);
+                MethodDef *md = (MethodDef *)ptr;
+
+                strings.insert(md->m_name);
+
+                size += sizeof(CLR_RECORD_METHODDEF) + md->m_byteCode.size();
+
+                if (md->m_eh.size())
+                {
+                    size += md->m_eh.size() * sizeof(CLR_RECORD_EH) + 1;
+                }
             }
+            break;
+
+            case TBL_Attributes:
+                size += sizeof(CLR_RECORD_ATTRIBUTE);
+                break;
+
+            case TBL_TypeSpec:
+                size += sizeof(CLR_RECORD_TYPESPEC);
+                break;
+
+            case TBL_Strings:
+                strings.insert(((String *)ptr)->m_value);
+                break;
         }
+
+        fprintf(
+            stream,
+            "%-6s %s : %s\n",
+            szKind,
+            TokenToString((CLR_UINT32)it->first),
+            ptr->GetDisplayString().c_str());
     }
-    REPARSER_TABLE_ENUM_END();
 
-    TINYCLR_NOCLEANUP_NOLABEL();
+    for (StringSetIter it = strings.begin(); it != strings.end(); it++)
+    {
+        size += it->size() + 1;
+    }
+
+    NANOCLR_CLEANUP();
+
+    if (stream)
+    {
+        fclose(stream);
+    }
+
+    NANOCLR_CLEANUP_END();
 }
 
-HRESULT MetaData::Reparser::Assembly::Compare_FieldDef(
-    Assembly *other,
-    StringSet *equal,
-    StringSet *changed,
-    StringSet *missing)
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum CompareResult
 {
-    TINYCLR_HEADER();
+    COMPARE_Missing,
+    COMPARE_Changed,
+    COMPARE_Equal,
+};
 
-    std::string value;
-    mdTokenSet res;
+template <class T> static CLR_UINT32 CompareRecord_Table(T *rec, MetaData::Reparser::Assembly *other)
+{
+    T *rec2 = other->FindObject(rec->GetHash(), T());
 
-    if (equal)
-        equal->clear();
-    if (changed)
-        changed->clear();
-    if (missing)
-        missing->clear();
+    if (rec2 == NULL)
+        return COMPARE_Missing;
 
-    REPARSER_TABLE_ENUM_BEGIN(this, FieldDef)
+    return rec->IsCompatible(rec2) ? COMPARE_Equal : COMPARE_Changed;
+}
+
+//--//
+
+//
+// Hashes are built lazily, compute them all before the objects are shared between threads.
+//
+void MetaData::Reparser::Assembly::PrepareCompare()
+{
+    for (TokenToObjectIter it = m_lookupTokenToObject.begin(); it != m_lookupTokenToObject.end(); it++)
     {
-        const std::string &str = rec->GetDisplayString();
-        FieldDef *rec2 = other->FindObject(str, FieldDef());
+        MethodDef *md = it->second.CastTo(MethodDef());
+
+        it->second->GetHash();
 
-        if (rec2 == NULL)
+        if (md)
         {
-            if (missing)
-                missing->insert(str);
-        }
-        else
-        {
-            if (rec->IsCompatible(rec2) == false)
-            {
-                if (changed)
-                    changed->insert(str);
-            }
-            else
-            {
-                if (equal)
-                    equal->insert(str);
-            }
+            md->m_locals.GetHash();
         }
     }
-    REPARSER_TABLE_ENUM_END();
-
-    TINYCLR_NOCLEANUP_NOLABEL();
 }
 
-HRESULT MetaData::Reparser::Assembly::Compare_MethodDef(
+void MetaData::Reparser::Assembly::QueueCompare(
+    CompareJobVector &jobs,
+    CLR_TABLESENUM tbl,
     Assembly *other,
-    StringSet *equal,
-    StringSet *changed,
-    StringSet *missing)
+    HashSet *equal,
+    HashSet *changed,
+    HashSet *missing)
 {
-    TINYCLR_HEADER();
-
-    std::string value;
-    mdTokenSet res;
-
     if (equal)
         equal->clear();
     if (changed)
@@ -1258,80 +1578,102 @@ HRESULT MetaData::Reparser::Assembly::Compare_MethodDef(
     if (missing)
         missing->clear();
 
-    REPARSER_TABLE_ENUM_BEGIN(this, MethodDef)
+    for (TokenToObjectIter it = m_lookupTokenToObject.begin(); it != m_lookupTokenToObject.end(); it++)
     {
-        const std::string &str = rec->GetDisplayString();
-        MethodDef *rec2 = other->FindObject(str, MethodDef());
-
-        if (rec2 == NULL)
+        if (CLR_TypeFromTk((CLR_UINT32)it->first) == tbl)
         {
-            if (missing)
-                missing->insert(str);
-        }
-        else
-        {
-            if (rec->IsCompatible(rec2) == false)
-            {
-                if (changed)
-                    changed->insert(str);
-            }
-            else
-            {
-                if (equal)
-                    equal->insert(str);
-            }
+            CompareJob job;
+
+            job.m_rec = it->second;
+            job.m_other = other;
+            job.m_equal = equal;
+            job.m_changed = changed;
+            job.m_missing = missing;
+            job.m_result = COMPARE_Missing;
+
+            jobs.push_back(job);
         }
     }
-    REPARSER_TABLE_ENUM_END();
+}
 
-    TINYCLR_NOCLEANUP_NOLABEL();
+CLR_UINT32 MetaData::Reparser::Assembly::CompareRecord(BaseToken *rec, Assembly *other)
+{
+    switch (rec->GetTableOfInstance())
+    {
+        case TBL_TypeDef:
+            return CompareRecord_Table((TypeDef *)rec, other);
+        case TBL_FieldDef:
+            return CompareRecord_Table((FieldDef *)rec, other);
+        case TBL_MethodDef:
+            return CompareRecord_Table((MethodDef *)rec, other);
+        case TBL_Attributes:
+            return CompareRecord_Table((Attribute *)rec, other);
+    }
+
+    return COMPARE_Missing;
 }
 
-HRESULT MetaData::Reparser::Assembly::Compare_Attribute(
-    Assembly *other,
-    StringSet *equal,
-    StringSet *changed,
-    StringSet *missing)
+void MetaData::Reparser::Assembly::CompareWorker(CompareJobVector &jobs, LONG volatile *next)
 {
-    TINYCLR_HEADER();
+    while (true)
+    {
+        size_t pos = (size_t)(::InterlockedIncrement(next) - 1);
 
-    std::string value;
-    mdTokenSet res;
+        if (pos >= jobs.size())
+            break;
 
-    if (equal)
-        equal->clear();
-    if (changed)
-        changed->clear();
-    if (missing)
-        missing->clear();
+        CompareJob &job = jobs[pos];
+
+        job.m_result = CompareRecord(job.m_rec, job.m_other);
+    }
+}
+
+void MetaData::Reparser::Assembly::RunCompare(CompareJobVector &jobs)
+{
+    std::vector<std::thread> workers;
+    LONG volatile next = 0;
+    size_t numWorkers = std::thread::hardware_concurrency();
+
+    if (numWorkers > jobs.size())
+        numWorkers = jobs.size();
 
-    REPARSER_TABLE_ENUM_BEGIN(this, Attribute)
+    for (size_t i = 1; i < numWorkers; i++)
     {
-        const std::string &str = rec->GetDisplayString();
-        Attribute *rec2 = other->FindObject(str, Attribute());
+        workers.push_back(std::thread(&MetaData::Reparser::Assembly::CompareWorker, std::ref(jobs), &next));
+    }
+
+    CompareWorker(jobs, &next);
+
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+
+    //
+    // Merge in queue order, the sets don't depend on which worker compared what.
+    //
+    for (CompareJobIter it = jobs.begin(); it != jobs.end(); it++)
+    {
+        HashSet *set = NULL;
 
-        if (rec2 == NULL)
+        switch (it->m_result)
         {
-            if (missing)
-                missing->insert(str);
+            case COMPARE_Missing:
+                set = it->m_missing;
+                break;
+            case COMPARE_Changed:
+                set = it->m_changed;
+                break;
+            case COMPARE_Equal:
+                set = it->m_equal;
+                break;
         }
-        else
+
+        if (set)
         {
-            if (rec->IsCompatible(rec2) == false)
-            {
-                if (changed)
-                    changed->insert(str);
-            }
-            else
-            {
-                if (equal)
-                    equal->insert(str);
-            }
+            set->insert(it->m_rec->GetHash());
         }
     }
-    REPARSER_TABLE_ENUM_END();
-
-    TINYCLR_NOCLEANUP_NOLABEL();
 }
 
 //--//
@@ -1362,7 +1704,7 @@ MetaData::Reparser::BaseToken *MetaData::Reparser::Assembly::Parse(
                                                                                                                        \
         rec->Parse(container, assm, p);                                                                                \
                                                                                                                        \
-        m_lookupStringToObject[rec->GetDisplayString()] = rec;                                                         \
+        m_lookupHashToObject[rec->GetHash()] = rec;                                                                    \
                                                                                                                        \
         return rec;                                                                                                    \
     }
@@ -1388,7 +1730,7 @@ MetaData::Reparser::BaseToken *MetaData::Reparser::Assembly::Parse(
 
         rec->Parse(container, assm, str);
 
-        m_lookupStringToObject[rec->GetDisplayString()] = rec;
+        m_lookupHashToObject[rec->GetHash()] = rec;
 
         return rec;
     }
@@ -1416,11 +1758,11 @@ const MetaData::Reparser::BaseTokenPtr &MetaData::Reparser::Assembly::FindObject
 
 //--//
 
-const MetaData::Reparser::BaseTokenPtr &MetaData::Reparser::Assembly::FindObject(const std::string &value) const
+const MetaData::Reparser::BaseTokenPtr &MetaData::Reparser::Assembly::FindObject(const StructuralHash &value) const
 {
-    StringToObjectConstIter it = m_lookupStringToObject.find(value);
+    HashToObjectConstIter it = m_lookupHashToObject.find(value);
 
-    if (it != m_lookupStringToObject.end())
+    if (it != m_lookupHashToObject.end())
     {
         return it->second;
     }
@@ -1434,11 +1776,21 @@ const MetaData::Reparser::BaseTokenPtr &MetaData::Reparser::Assembly::FindObject
 
 //--//
 
-void MetaData::Reparser::Assembly::DumpError(LPCSTR fmt, StringSet &set) const
+void MetaData::Reparser::Assembly::DumpError(LPCSTR fmt, HashSet &set) const
 {
+    StringSet strings;
+
     printf(fmt, set.size());
 
-    for (StringSetIter it = set.begin(); it != set.end(); it++)
+    //
+    // Display strings are only rendered for diagnostics, sorted to keep the report stable.
+    //
+    for (HashSetIter it = set.begin(); it != set.end(); it++)
+    {
+        strings.insert(FindObject(*it)->GetDisplayString());
+    }
+
+    for (StringSetIter it = strings.begin(); it != strings.end(); it++)
     {
         printf("  %s\n", it->c_str());
     }
@@ -1448,19 +1800,19 @@ void MetaData::Reparser::Assembly::DumpError(LPCSTR fmt, StringSet &set) const
 
 //--//
 
-HRESULT MetaData::Reparser::Assembly::DiffData::Compute(CompareFtn ftn, Assembly *orig, Assembly *patched)
+void MetaData::Reparser::Assembly::DiffData::Queue(
+    CompareJobVector &jobs,
+    CLR_TABLESENUM tbl,
+    Assembly *orig,
+    Assembly *patched)
 {
-    TINYCLR_HEADER();
-
-    TINYCLR_CHECK_HRESULT((orig->*ftn)(patched, &m_setEqual, &m_setChanged, &m_setDeleted));
-    TINYCLR_CHECK_HRESULT((patched->*ftn)(orig, NULL, NULL, &m_setAdded));
-
-    TINYCLR_NOCLEANUP();
+    orig->QueueCompare(jobs, tbl, patched, &m_setEqual, &m_setChanged, &m_setDeleted);
+    patched->QueueCompare(jobs, tbl, orig, NULL, NULL, &m_setAdded);
 }
 
 HRESULT MetaData::Reparser::Assembly::CreateDiff(Assembly *orig, Assembly *patched, bool fForceAssemblyRef)
 {
-    TINYCLR_HEADER();
+    NANOCLR_HEADER();
 
     DiffData diffTypes;
     DiffData diffFields;
@@ -1477,10 +1829,26 @@ HRESULT MetaData::Reparser::Assembly::CreateDiff(Assembly *orig, Assembly *patch
     m_assemblyPatched = patched;
 
     //
-    // Compare Types.
+    // The comparisons of all the tables are independent, run them up front on all the cores.
+    // The checks below still go table by table, in the same order as before.
     //
-    TINYCLR_CHECK_HRESULT(diffTypes.Compute(&MetaData::Reparser::Assembly::Compare_TypeDef, orig, patched));
+    {
+        CompareJobVector jobs;
+
+        orig->PrepareCompare();
+        patched->PrepareCompare();
+
+        diffTypes.Queue(jobs, TBL_TypeDef, orig, patched);
+        diffFields.Queue(jobs, TBL_FieldDef, orig, patched);
+        diffMethods.Queue(jobs, TBL_MethodDef, orig, patched);
+        diffAttributes.Queue(jobs, TBL_Attributes, orig, patched);
+
+        RunCompare(jobs);
+    }
 
+    //
+    // Check Types.
+    //
     if (diffTypes.m_setChanged.size() > 0)
     {
         orig->DumpError("FAILURE: %d type(s) changed:\n", diffTypes.m_setChanged);
@@ -1497,25 +1865,24 @@ HRESULT MetaData::Reparser::Assembly::CreateDiff(Assembly *orig, Assembly *patch
     }
 
     if (fFail)
-        TINYCLR_SET_AND_LEAVE(CLR_E_INVALID_PARAMETER);
+        NANOCLR_SET_AND_LEAVE(CLR_E_INVALID_PARAMETER);
 
     //--//
 
     //
-    // Compare Fields.
+    // Check Fields.
     //
-    TINYCLR_CHECK_HRESULT(diffFields.Compute(&MetaData::Reparser::Assembly::Compare_FieldDef, orig, patched));
 
     //
     // Allow new fields in new types.
     //
     {
-        for (StringSetIter it = diffFields.m_setAdded.begin(); it != diffFields.m_setAdded.end();)
+        for (HashSetIter it = diffFields.m_setAdded.begin(); it != diffFields.m_setAdded.end();)
         {
-            StringSetIter it2 = it++;
+            HashSetIter it2 = it++;
             FieldDef *fd = patched->FindObject(*it2, FieldDef());
 
-            if (diffTypes.m_setAdded.find(fd->m_container->GetDisplayString()) != diffTypes.m_setAdded.end())
+            if (diffTypes.m_setAdded.find(fd->m_container->GetHash()) != diffTypes.m_setAdded.end())
             {
                 diffFields.m_setAdded.erase(it2);
             }
@@ -1539,25 +1906,24 @@ HRESULT MetaData::Reparser::Assembly::CreateDiff(Assembly *orig, Assembly *patch
     }
 
     if (fFail)
-        TINYCLR_SET_AND_LEAVE(CLR_E_INVALID_PARAMETER);
+        NANOCLR_SET_AND_LEAVE(CLR_E_INVALID_PARAMETER);
 
     //--//
 
     //
-    // Compare Methods.
+    // Check Methods.
     //
-    TINYCLR_CHECK_HRESULT(diffMethods.Compute(&MetaData::Reparser::Assembly::Compare_MethodDef, orig, patched));
 
     //
     // Allow new methods in new types.
     //
     {
-        for (StringSetIter it = diffMethods.m_setAdded.begin(); it != diffMethods.m_setAdded.end();)
+        for (HashSetIter it = diffMethods.m_setAdded.begin(); it != diffMethods.m_setAdded.end();)
         {
-            StringSetIter it2 = it++;
+            HashSetIter it2 = it++;
             MethodDef *md = patched->FindObject(*it2, MethodDef());
 
-            if (diffTypes.m_setAdded.find(md->m_container->GetDisplayString()) != diffTypes.m_setAdded.end())
+            if (diffTypes.m_setAdded.find(md->m_container->GetHash()) != diffTypes.m_setAdded.end())
             {
                 diffMethods.m_setAdded.erase(it2);
             }
@@ -1580,29 +1946,28 @@ HRESULT MetaData::Reparser::Assembly::CreateDiff(Assembly *orig, Assembly *patch
     }
 
     if (fFail)
-        TINYCLR_SET_AND_LEAVE(CLR_E_INVALID_PARAMETER);
+        NANOCLR_SET_AND_LEAVE(CLR_E_INVALID_PARAMETER);
 
     //--//
 
     if (fFail)
-        TINYCLR_SET_AND_LEAVE(CLR_E_INVALID_PARAMETER);
+        NANOCLR_SET_AND_LEAVE(CLR_E_INVALID_PARAMETER);
 
     //--//
 
     //
-    // Compare Attributes.
+    // Check Attributes.
     //
-    TINYCLR_CHECK_HRESULT(diffAttributes.Compute(&MetaData::Reparser::Assembly::Compare_Attribute, orig, patched));
 
     //
     // Allow new attributes in new types.
     //
     {
-        for (StringSetIter it = diffAttributes.m_setAdded.begin(); it != diffAttributes.m_setAdded.end();)
+        for (HashSetIter it = diffAttributes.m_setAdded.begin(); it != diffAttributes.m_setAdded.end();)
         {
-            StringSetIter it2 = it++;
+            HashSetIter it2 = it++;
             Attribute *attr = patched->FindObject(*it2, Attribute());
-            std::string str;
+            StructuralHash hash;
 
             switch (attr->m_owner->GetTableOfInstance())
             {
@@ -1610,7 +1975,7 @@ HRESULT MetaData::Reparser::Assembly::CreateDiff(Assembly *orig, Assembly *patch
                 {
                     TypeDef *td = attr->m_owner.CastTo(TypeDef());
 
-                    str = td->GetDisplayString();
+                    hash = td->GetHash();
                 }
                 break;
 
@@ -1618,7 +1983,7 @@ HRESULT MetaData::Reparser::Assembly::CreateDiff(Assembly *orig, Assembly *patch
                 {
                     FieldDef *fd = attr->m_owner.CastTo(FieldDef());
 
-                    str = fd->m_container->GetDisplayString();
+                    hash = fd->m_container->GetHash();
                 }
                 break;
 
@@ -1626,12 +1991,12 @@ HRESULT MetaData::Reparser::Assembly::CreateDiff(Assembly *orig, Assembly *patch
                 {
                     MethodDef *md = attr->m_owner.CastTo(MethodDef());
 
-                    str = md->m_container->GetDisplayString();
+                    hash = md->m_container->GetHash();
                 }
                 break;
             }
 
-            if (diffTypes.m_setAdded.find(str) != diffTypes.m_setAdded.end())
+            if (diffTypes.m_setAdded.find(hash) != diffTypes.m_setAdded.end())
             {
                 diffAttributes.m_setAdded.erase(it2);
             }
@@ -1655,7 +2020,7 @@ HRESULT MetaData::Reparser::Assembly::CreateDiff(Assembly *orig, Assembly *patch
     }
 
     if (fFail)
-        TINYCLR_SET_AND_LEAVE(CLR_E_INVALID_PARAMETER);
+        NANOCLR_SET_AND_LEAVE(CLR_E_INVALID_PARAMETER);
 
     //--//
 
@@ -1672,7 +2037,7 @@ HRESULT MetaData::Reparser::Assembly::CreateDiff(Assembly *orig, Assembly *patch
     // Create the objects that need to be added to the patch assembly, for now just as place holders.
     //
     {
-        for (StringSetIter it = diffTypes.m_setAdded.begin(); it != diffTypes.m_setAdded.end(); it++)
+        for (HashSetIter it = diffTypes.m_setAdded.begin(); it != diffTypes.m_setAdded.end(); it++)
         {
             TypeDef *td = patched->FindObject(*it, TypeDef());
             BaseToken *ptrNew = AddToCreate(td, NULL);
@@ -1689,7 +2054,7 @@ HRESULT MetaData::Reparser::Assembly::CreateDiff(Assembly *orig, Assembly *patch
     // Create the objects that need to be changed in the patch assembly, for now just as place holders.
     //
     {
-        for (StringSetIter it = diffMethods.m_setChanged.begin(); it != diffMethods.m_setChanged.end(); it++)
+        for (HashSetIter it = diffMethods.m_setChanged.begin(); it != diffMethods.m_setChanged.end(); it++)
         {
             MethodDef *md = patched->FindObject(*it, MethodDef());
 
@@ -1709,7 +2074,7 @@ HRESULT MetaData::Reparser::Assembly::CreateDiff(Assembly *orig, Assembly *patch
 
     //--//
 
-    TINYCLR_NOCLEANUP();
+    NANOCLR_NOCLEANUP();
 }
 
 //--//
@@ -1730,7 +2095,7 @@ bool MetaData::Reparser::Assembly::CompareObject(const BaseTokenPtr &ptrOrig, co
         if (!ptrPatched)
             return false;
 
-        return ptrOrig->GetDisplayString() == ptrPatched->GetDisplayString();
+        return ptrOrig->GetHash() == ptrPatched->GetHash();
     }
 }
 
@@ -1756,7 +2121,7 @@ bool MetaData::Reparser::Assembly::CompareObjects(const BaseTokenPtrList &lstOri
 
 MetaData::Reparser::BaseToken *MetaData::Reparser::Assembly::AddToCreate(BaseToken *ptr, BaseToken *container)
 {
-    const std::string &str = ptr->GetDisplayString();
+    const StructuralHash &hash = ptr->GetHash();
     BaseToken *ptrNew = NULL;
 
     switch (ptr->GetTableOfInstance())
@@ -1841,17 +2206,17 @@ MetaData::Reparser::BaseToken *MetaData::Reparser::Assembly::AddToCreate(BaseTok
         break;
 
         default:
-            throw(std::string("Patch of non-supported element: ") + str);
+            throw(std::string("Patch of non-supported element: ") + ptr->GetDisplayString());
     }
 
     ptrNew->Init(this, CLR_TkFromType(ptrNew->GetTableOfInstance(), (CLR_UINT32)m_lookupTokenToObject.size()));
 
-    ptrNew->m_displayString = str;
+    ptrNew->m_hash = hash;
     ptrNew->m_patched = ptr;
 
     m_lookupTokenToObject[ptrNew->m_tk] = ptrNew;
-    m_lookupStringToObject[str] = ptrNew;
-    m_lookupStringToObjectToCreate[str] = ptrNew;
+    m_lookupHashToObject[hash] = ptrNew;
+    m_lookupHashToObjectToCreate[hash] = ptrNew;
 
     m_objectsToProcess.push_back(ptrNew);
 
@@ -1873,9 +2238,9 @@ MetaData::Reparser::TypeDef *MetaData::Reparser::Assembly::AddToPatch(TypeDef *p
     if (!ptr)
         return NULL;
 
-    const std::string &str = ptr->GetDisplayString();
-    StringToObjectConstIter it = m_lookupStringToObjectToPatch.find(str);
-    if (it != m_lookupStringToObjectToPatch.end())
+    const StructuralHash &hash = ptr->GetHash();
+    HashToObjectConstIter it = m_lookupHashToObjectToPatch.find(hash);
+    if (it != m_lookupHashToObjectToPatch.end())
     {
         return it->second.CastTo(TypeDef());
     }
@@ -1906,7 +2271,7 @@ MetaData::Reparser::TypeDef *MetaData::Reparser::Assembly::AddToPatch(TypeDef *p
     tdNew->m_flags = ptr->m_flags | CLR_RECORD_TYPEDEF::TD_Patched;
 
     m_lookupTokenToObject[tdNew->m_tk] = tdNew;
-    m_lookupStringToObjectToPatch[str] = tdNew;
+    m_lookupHashToObjectToPatch[hash] = tdNew;
 
     m_objectsToProcess.push_back(tdNew);
 
@@ -1918,9 +2283,9 @@ MetaData::Reparser::MethodDef *MetaData::Reparser::Assembly::AddToPatch(MethodDe
     if (!ptr)
         return NULL;
 
-    const std::string &str = ptr->GetDisplayString();
-    StringToObjectConstIter it = m_lookupStringToObjectToPatch.find(str);
-    if (it != m_lookupStringToObjectToPatch.end())
+    const StructuralHash &hash = ptr->GetHash();
+    HashToObjectConstIter it = m_lookupHashToObjectToPatch.find(hash);
+    if (it != m_lookupHashToObjectToPatch.end())
     {
         return it->second.CastTo(MethodDef());
     }
@@ -1951,7 +2316,7 @@ MetaData::Reparser::MethodDef *MetaData::Reparser::Assembly::AddToPatch(MethodDe
     ////mdNew->m_sig;
 
     m_lookupTokenToObject[mdNew->m_tk] = mdNew;
-    m_lookupStringToObjectToPatch[str] = mdNew;
+    m_lookupHashToObjectToPatch[hash] = mdNew;
 
     m_objectsToProcess.push_back(mdNew);
 
@@ -1960,8 +2325,7 @@ MetaData::Reparser::MethodDef *MetaData::Reparser::Assembly::AddToPatch(MethodDe
 
 bool MetaData::Reparser::Assembly::IsAPatch(BaseToken *ptr) const
 {
-    for (StringToObjectConstIter it = m_lookupStringToObjectToPatch.begin(); it != m_lookupStringToObjectToPatch.end();
-         it++)
+    for (HashToObjectConstIter it = m_lookupHashToObjectToPatch.begin(); it != m_lookupHashToObjectToPatch.end(); it++)
     {
         if (it->second == ptr)
             return true;
@@ -1972,8 +2336,8 @@ bool MetaData::Reparser::Assembly::IsAPatch(BaseToken *ptr) const
 
 bool MetaData::Reparser::Assembly::IsAFullObject(BaseToken *ptr) const
 {
-    for (StringToObjectConstIter it = m_lookupStringToObjectToCreate.begin();
-         it != m_lookupStringToObjectToCreate.end();
+    for (HashToObjectConstIter it = m_lookupHashToObjectToCreate.begin();
+         it != m_lookupHashToObjectToCreate.end();
          it++)
     {
         if (it->second == ptr)
@@ -2049,7 +2413,7 @@ void MetaData::Reparser::Assembly::Resolve(Assembly *orig, Assembly *patched)
 
                 if (!md->m_container)
                 {
-                    md->m_container = FindObject(mdPatch->m_container->GetDisplayString());
+                    md->m_container = FindObject(mdPatch->m_container->GetHash());
                 }
 
                 Clone(md->m_locals, mdPatch->m_locals);
@@ -2075,14 +2439,15 @@ void MetaData::Reparser::Assembly::Resolve(Assembly *orig, Assembly *patched)
                 throw(std::string("Patch of non-supported element: "));
         }
 
-        m_lookupStringToObject[ptr->GetDisplayString()] = ptr;
+        m_lookupHashToObject[ptr->GetHash()] = ptr;
     }
 
     //
     // Copy bytecode.
+    // Clone() adds objects while walking, so walk the ordered token map, which keeps its iterators valid.
     //
     {
-        for (StringToObjectIter it = m_lookupStringToObject.begin(); it != m_lookupStringToObject.end(); it++)
+        for (TokenToObjectIter it = m_lookupTokenToObject.begin(); it != m_lookupTokenToObject.end(); it++)
         {
             MethodDef *md = it->second.CastTo(MethodDef());
             if (md)
@@ -2111,10 +2476,10 @@ void MetaData::Reparser::Assembly::Resolve(Assembly *orig, Assembly *patched)
     }
 
     //
-    // Link fields and methods to types.
+    // Link fields and methods to types, in token order.
     //
     {
-        for (StringToObjectIter it = m_lookupStringToObject.begin(); it != m_lookupStringToObject.end(); it++)
+        for (TokenToObjectIter it = m_lookupTokenToObject.begin(); it != m_lookupTokenToObject.end(); it++)
         {
             TypeDef *td = it->second.CastTo(TypeDef());
 
@@ -2127,8 +2492,7 @@ void MetaData::Reparser::Assembly::Resolve(Assembly *orig, Assembly *patched)
                 td->m_methods_Virtual.clear();
                 td->m_methods_Instance.clear();
 
-                for (StringToObjectIter it2 = m_lookupStringToObject.begin(); it2 != m_lookupStringToObject.end();
-                     it2++)
+                for (TokenToObjectIter it2 = m_lookupTokenToObject.begin(); it2 != m_lookupTokenToObject.end(); it2++)
                 {
                     MethodDef *md = it2->second.CastTo(MethodDef());
                     if (md)
@@ -2180,16 +2544,16 @@ MetaData::Reparser::BaseToken *MetaData::Reparser::Assembly::Clone(BaseToken *pt
     if (!ptr)
         return NULL;
 
-    const std::string &str = ptr->GetDisplayString();
-    StringToObjectConstIter it = m_lookupStringToObject.find(str);
+    const StructuralHash &hash = ptr->GetHash();
+    HashToObjectConstIter it = m_lookupHashToObject.find(hash);
     BaseToken *ptrNew = NULL;
 
-    if (it != m_lookupStringToObject.end())
+    if (it != m_lookupHashToObject.end())
     {
         return it->second;
     }
 
-    // printf( "Cloning: %s\n", str.c_str() );
+    // printf( "Cloning: %s\n", ptr->GetDisplayString().c_str() );
 
     //--//
 
@@ -2333,16 +2697,16 @@ MetaData::Reparser::BaseToken *MetaData::Reparser::Assembly::Clone(BaseToken *pt
         break;
 
         default:
-            throw(std::string("Patch of non-supported element: ") + str);
+            throw(std::string("Patch of non-supported element: ") + ptr->GetDisplayString());
     }
 
     ptrNew->Init(this, CLR_TkFromType(ptrNew->GetTableOfInstance(), (CLR_UINT32)m_lookupTokenToObject.size()));
 
-    ptrNew->m_displayString = str;
+    ptrNew->m_hash = hash;
     ptrNew->m_patched = ptr;
 
     m_lookupTokenToObject[ptrNew->m_tk] = ptrNew;
-    m_lookupStringToObject[str] = ptrNew;
+    m_lookupHashToObject[hash] = ptrNew;
 
     return ptrNew;
 }
@@ -33,6 +33,7 @@ HRESULT MetaData::ByteCode::Parse(const TypeDef &td, const MethodDef &md, COR_IL
             mapOffsetToIndex_Start[offset] = (CLR_INT32)i;
 
             ref.m_ipOffset = offset;
+            ref.m_originalIndex = (CLR_UINT32)i;
             offset += ref.m_ipLength;
 
             mapOffsetToIndex_End[offset] = (CLR_INT32)i;
@@ -408,6 +409,11 @@ void MetaData::ByteCode::DumpDistributionStats()
     {
         wprintf(L"Distribution: Size : %d %d\n", it->first, it->second);
     }
+
+    if (s_statistics.m_fEnabled)
+    {
+        s_statistics.Dump(20);
+    }
 }
 
 void MetaData::ByteCode::DumpOpcode(size_t index, LogicalOpcodeDesc &ref)
@@ -24,6 +24,7 @@ MetaData::ByteCode::LogicalOpcodeDesc::LogicalOpcodeDesc(
     m_stackDiff = ol.StackChanges();       // CLR_INT32                  m_stackDiff;
                                            //
     m_references = 0;                      // CLR_UINT32                 m_references;
+    m_originalIndex = 0;                   // CLR_UINT32                 m_originalIndex;
                                            //
     m_index = 0;                           // CLR_UINT32                 m_index;
     m_token = mdTokenNil;                  // mdToken                    m_token;
@@ -0,0 +1,699 @@
+//
+// Copyright (c) 2017 The nanoFramework project contributors
+// Portions Copyright (c) Microsoft Corporation.  All rights reserved.
+// See LICENSE file in the project root for full license information.
+//
+
+#include "stdafx.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//
+// To add a rewrite, implement it as a Peephole_ method and list it here.
+// Rules run in order, the whole list is repeated until none of them finds anything left to do.
+//
+const MetaData::ByteCode::PeepholeRule MetaData::ByteCode::c_PeepholeRules[] = {
+    {L"BranchChains", &MetaData::ByteCode::Peephole_BranchChains},
+    {L"Unreachable", &MetaData::ByteCode::Peephole_Unreachable},
+    {L"Nop", &MetaData::ByteCode::Peephole_Nop},
+    {L"DupPop", &MetaData::ByteCode::Peephole_DupPop},
+    {NULL, NULL}};
+
+//
+// Runs after ConvertTokens, on the logical opcodes with branch targets still expressed as opcode indexes.
+// Opcodes are only ever removed, never reordered, so the pdbx IL map can still be built through m_originalIndex.
+//
+HRESULT MetaData::ByteCode::Optimize(size_t &numRemoved)
+{
+    NANOCLR_HEADER();
+
+    size_t numChanges;
+
+    numRemoved = 0;
+
+    do
+    {
+        numChanges = 0;
+
+        for (const PeepholeRule *rule = c_PeepholeRules; rule->m_pass; rule++)
+        {
+            OpcodeMask pinned;
+            OpcodeMask remove(m_opcodes.size(), false);
+            size_t num;
+
+            ComputePinned(pinned);
+
+            num = (this->*(rule->m_pass))(pinned, remove);
+            if (num == 0)
+                continue;
+
+            numChanges += num;
+
+            for (size_t i = 0; i < remove.size(); i++)
+            {
+                if (remove[i])
+                {
+                    if (pinned[i])
+                    {
+                        wprintf(L"Method: %s\n", m_name.c_str());
+                        wprintf(L"Peephole rule %s removed a pinned opcode at %d\n", rule->m_name, (int)i);
+
+                        NANOCLR_SET_AND_LEAVE(CLR_E_FAIL);
+                    }
+
+                    numRemoved++;
+                }
+            }
+
+            NANOCLR_CHECK_HRESULT(RemoveOpcodes(remove));
+        }
+    } while (numChanges > 0);
+
+    NANOCLR_NOCLEANUP();
+}
+
+//--//
+
+//
+// Pinned opcodes delimit exception blocks; keeping them in place keeps the EH table valid without having to move
+// block boundaries around. The last opcode is pinned too, so every branch target still has an opcode to land on.
+//
+void MetaData::ByteCode::ComputePinned(OpcodeMask &pinned)
+{
+    pinned.assign(m_opcodes.size(), false);
+
+    if (m_opcodes.size() > 0)
+    {
+        pinned[m_opcodes.size() - 1] = true;
+    }
+
+    for (size_t i = 0; i < m_exceptions.size(); i++)
+    {
+        LogicalExceptionBlock &leb = m_exceptions[i];
+
+        pinned[leb.m_TryIndex] = true;
+        pinned[leb.m_TryIndexEnd] = true;
+        pinned[leb.m_HandlerIndex] = true;
+        pinned[leb.m_HandlerIndexEnd] = true;
+
+        if (leb.m_Flags == COR_ILEXCEPTION_CLAUSE_FILTER)
+        {
+            pinned[leb.m_FilterIndex] = true;
+        }
+    }
+}
+
+bool MetaData::ByteCode::IsInSameProtectedRegions(size_t left, size_t right)
+{
+    for (size_t i = 0; i < m_exceptions.size(); i++)
+    {
+        LogicalExceptionBlock &leb = m_exceptions[i];
+        CLR_INT32 l = (CLR_INT32)left;
+        CLR_INT32 r = (CLR_INT32)right;
+
+        if ((leb.m_TryIndex <= l && l <= leb.m_TryIndexEnd) != (leb.m_TryIndex <= r && r <= leb.m_TryIndexEnd))
+            return false;
+
+        if ((leb.m_HandlerIndex <= l && l <= leb.m_HandlerIndexEnd) !=
+            (leb.m_HandlerIndex <= r && r <= leb.m_HandlerIndexEnd))
+            return false;
+
+        if (leb.m_Flags == COR_ILEXCEPTION_CLAUSE_FILTER)
+        {
+            if ((leb.m_FilterIndex <= l && l < leb.m_HandlerIndex) !=
+                (leb.m_FilterIndex <= r && r < leb.m_HandlerIndex))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+//
+// A removed opcode hands its incoming branches over to the next opcode that survives.
+//
+HRESULT MetaData::ByteCode::RemoveOpcodes(const OpcodeMask &remove)
+{
+    NANOCLR_HEADER();
+
+    size_t len = m_opcodes.size();
+    std::vector<CLR_INT32> remap(len);
+    LogicalOpcodeDescVector opcodes;
+    CLR_INT32 pos = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        remap[i] = pos;
+
+        if (!remove[i])
+            pos++;
+    }
+
+    opcodes.reserve(pos);
+
+    for (i = 0; i < len; i++)
+    {
+        LogicalOpcodeDesc &ref = m_opcodes[i];
+
+        if (remove[i])
+        {
+            if (remap[i] >= pos)
+                NANOCLR_SET_AND_LEAVE(CLR_E_FAIL);
+
+            continue;
+        }
+
+        for (size_t j = 0; j < ref.m_targets.size(); j++)
+        {
+            ref.m_targets[j] = remap[ref.m_targets[j]];
+        }
+
+        opcodes.push_back(ref);
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        if (remove[i])
+        {
+            opcodes[remap[i]].m_references += m_opcodes[i].m_references;
+        }
+    }
+
+    for (i = 0; i < m_exceptions.size(); i++)
+    {
+        LogicalExceptionBlock &leb = m_exceptions[i];
+
+        leb.m_TryIndex = remap[leb.m_TryIndex];
+        leb.m_TryIndexEnd = remap[leb.m_TryIndexEnd];
+        leb.m_HandlerIndex = remap[leb.m_HandlerIndex];
+        leb.m_HandlerIndexEnd = remap[leb.m_HandlerIndexEnd];
+
+        if (leb.m_Flags == COR_ILEXCEPTION_CLAUSE_FILTER)
+        {
+            leb.m_FilterIndex = remap[leb.m_FilterIndex];
+        }
+    }
+
+    m_opcodes.swap(opcodes);
+
+    NANOCLR_NOCLEANUP();
+}
+
+//--//
+
+//
+// Opcodes are only ever removed or shortened, so the distance in the original IL is an upper bound of the one
+// GenerateOldIL will compute for the branch.
+//
+static bool local_IsInShortBranchRange(
+    const MetaData::ByteCode::LogicalOpcodeDesc &ref,
+    const MetaData::ByteCode::LogicalOpcodeDesc &refTarget)
+{
+    CLR_INT32 diff = (CLR_INT32)refTarget.m_ipOffset - (CLR_INT32)(ref.m_ipOffset + ref.m_ipLength);
+
+    return diff >= -0x80 && diff <= 0x7F;
+}
+
+//
+// Retargets branches landing on an unconditional 'br' to the final destination of the chain, then drops any 'br'
+// left jumping to the opcode right after it.
+// 'leave' is not touched, it has to run the finally blocks on its way out.
+// Short forms follow the chain only as far as their 8-bit offset still reaches.
+//
+size_t MetaData::ByteCode::Peephole_BranchChains(const OpcodeMask &pinned, OpcodeMask &remove)
+{
+    size_t len = m_opcodes.size();
+    size_t num = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        LogicalOpcodeDesc &ref = m_opcodes[i];
+
+        if ((ref.m_ol->m_flags & CLR_RT_OpcodeLookup::ATTRIB_HAS_TARGET) == 0)
+            continue;
+
+        if (ref.m_op == CEE_LEAVE || ref.m_op == CEE_LEAVE_S)
+            continue;
+
+        for (size_t j = 0; j < ref.m_targets.size(); j++)
+        {
+            CLR_INT32 target = ref.m_targets[j];
+            size_t hops = 0;
+
+            while (true)
+            {
+                LogicalOpcodeDesc &refTarget = m_opcodes[target];
+
+                //
+                // A loop made only of branches, leave it alone.
+                //
+                if (hops++ == len)
+                {
+                    target = ref.m_targets[j];
+                    break;
+                }
+
+                if (refTarget.m_op != CEE_BR && refTarget.m_op != CEE_BR_S)
+                    break;
+
+                if (refTarget.m_targets[0] == target || !IsInSameProtectedRegions(i, refTarget.m_targets[0]))
+                    break;
+
+                if (ref.m_ol->m_opParam == CLR_OpcodeParam_ShortBrTarget &&
+                    !local_IsInShortBranchRange(ref, m_opcodes[refTarget.m_targets[0]]))
+                    break;
+
+                target = refTarget.m_targets[0];
+            }
+
+            if (target != ref.m_targets[j])
+            {
+                m_opcodes[ref.m_targets[j]].m_references--;
+                m_opcodes[target].m_references++;
+
+                ref.m_targets[j] = target;
+                num++;
+            }
+        }
+
+        if ((ref.m_op == CEE_BR || ref.m_op == CEE_BR_S) && ref.m_targets[0] == (CLR_INT32)(i + 1) && !pinned[i])
+        {
+            remove[i] = true;
+            num++;
+        }
+    }
+
+    return num;
+}
+
+//
+// Same traversal as ComputeStackDepth, from the method entry point and from every handler and filter.
+// These are the opcodes UpdateStackDepth reports as unreachable.
+//
+size_t MetaData::ByteCode::Peephole_Unreachable(const OpcodeMask &pinned, OpcodeMask &remove)
+{
+    size_t len = m_opcodes.size();
+    size_t num = 0;
+    OpcodeMask reached(len, false);
+    std::vector<size_t> pending;
+
+    pending.push_back(0);
+
+    for (size_t i = 0; i < m_exceptions.size(); i++)
+    {
+        LogicalExceptionBlock &leb = m_exceptions[i];
+
+        pending.push_back(leb.m_HandlerIndex);
+
+        if (leb.m_Flags == COR_ILEXCEPTION_CLAUSE_FILTER)
+        {
+            pending.push_back(leb.m_FilterIndex);
+        }
+    }
+
+    while (pending.size() > 0)
+    {
+        size_t pos = pending.back();
+
+        pending.pop_back();
+
+        while (pos < len && !reached[pos])
+        {
+            LogicalOpcodeDesc &ref = m_opcodes[pos];
+
+            reached[pos] = true;
+
+            if (ref.m_ol->m_flags & CLR_RT_OpcodeLookup::ATTRIB_HAS_TARGET)
+            {
+                for (CLR_UINT32 j = 0; j < ref.m_targets.size(); j++)
+                {
+                    pending.push_back(ref.m_targets[j]);
+                }
+            }
+
+            if ((ref.m_ol->m_flags & CLR_RT_OpcodeLookup::COND_BRANCH_MASK) == CLR_RT_OpcodeLookup::COND_BRANCH_ALWAYS)
+                break;
+
+            pos++;
+        }
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!reached[i] && !pinned[i])
+        {
+            remove[i] = true;
+            num++;
+        }
+    }
+
+    return num;
+}
+
+size_t MetaData::ByteCode::Peephole_Nop(const OpcodeMask &pinned, OpcodeMask &remove)
+{
+    size_t num = 0;
+
+    for (size_t i = 0; i < m_opcodes.size(); i++)
+    {
+        if (m_opcodes[i].m_op == CEE_NOP && !pinned[i])
+        {
+            remove[i] = true;
+            num++;
+        }
+    }
+
+    return num;
+}
+
+//
+// 'dup' immediately followed by 'pop' leaves the stack as it was, as long as nothing branches in between them.
+//
+size_t MetaData::ByteCode::Peephole_DupPop(const OpcodeMask &pinned, OpcodeMask &remove)
+{
+    size_t num = 0;
+
+    for (size_t i = 0; i + 1 < m_opcodes.size(); i++)
+    {
+        LogicalOpcodeDesc &ref = m_opcodes[i];
+        LogicalOpcodeDesc &refNext = m_opcodes[i + 1];
+
+        if (ref.m_op != CEE_DUP || refNext.m_op != CEE_POP)
+            continue;
+
+        if (refNext.m_references || pinned[i] || pinned[i + 1])
+            continue;
+
+        remove[i] = true;
+        remove[i + 1] = true;
+        num += 2;
+        i++;
+    }
+
+    return num;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool local_IsLocalAccess(CLR_OPCODE op, bool &fStore, bool &fAddress)
+{
+    fStore = false;
+    fAddress = false;
+
+    switch (op)
+    {
+        case CEE_LDLOC_0:
+        case CEE_LDLOC_1:
+        case CEE_LDLOC_2:
+        case CEE_LDLOC_3:
+        case CEE_LDLOC_S:
+        case CEE_LDLOC:
+            return true;
+
+        case CEE_STLOC_0:
+        case CEE_STLOC_1:
+        case CEE_STLOC_2:
+        case CEE_STLOC_3:
+        case CEE_STLOC_S:
+        case CEE_STLOC:
+            fStore = true;
+            return true;
+
+        case CEE_LDLOCA_S:
+        case CEE_LDLOCA:
+            fAddress = true;
+            return true;
+    }
+
+    return false;
+}
+
+//
+// Backward liveness over the local slots, one bit per local and opcode.
+// Exception handlers and filters are treated as possible successors of every opcode in their try block, and the end of
+// a finally or filter as a possible predecessor of every handler and 'leave' target.
+//
+// On return 'interference' is a numLocals x numLocals matrix of locals that cannot share a slot, 'excluded' flags the
+// locals that must keep a slot of their own: their address is taken, or they are read before being written and so
+// rely on the zero initialization of the frame.
+//
+HRESULT MetaData::ByteCode::ComputeLocalInterference(size_t numLocals, OpcodeMask &interference, OpcodeMask &excluded)
+{
+    NANOCLR_HEADER();
+
+    size_t len = m_opcodes.size();
+    size_t words = (numLocals + 31) / 32;
+    std::vector<CLR_UINT32> liveIn(len * words, 0);
+    std::vector<CLR_UINT32> liveOut(len * words, 0);
+    std::vector<CLR_UINT32> handlerIn(words);
+    std::vector<std::vector<CLR_INT32>> successors(len);
+    std::vector<CLR_INT32> handlerEntries;
+    std::vector<CLR_INT32> continuations;
+    bool fChanged;
+    size_t i;
+
+    interference.assign(numLocals * numLocals, false);
+    excluded.assign(numLocals, false);
+
+    if (len == 0 || numLocals == 0)
+        NANOCLR_SET_AND_LEAVE(S_OK);
+
+    for (i = 0; i < m_exceptions.size(); i++)
+    {
+        LogicalExceptionBlock &leb = m_exceptions[i];
+
+        handlerEntries.push_back(leb.m_HandlerIndex);
+
+        if (leb.m_Flags == COR_ILEXCEPTION_CLAUSE_FILTER)
+        {
+            handlerEntries.push_back(leb.m_FilterIndex);
+        }
+    }
+
+    continuations = handlerEntries;
+
+    for (i = 0; i < len; i++)
+    {
+        LogicalOpcodeDesc &ref = m_opcodes[i];
+        std::vector<CLR_INT32> &succ = successors[i];
+        bool fStore;
+        bool fAddress;
+
+        if (ref.m_op == CEE_LEAVE || ref.m_op == CEE_LEAVE_S)
+        {
+            continuations.push_back(ref.m_targets[0]);
+        }
+
+        if (local_IsLocalAccess(ref.m_op, fStore, fAddress))
+        {
+            if (ref.m_index >= numLocals)
+            {
+                wprintf(L"Method: %s\n", m_name.c_str());
+                wprintf(L"Bad local variable index at %d: %d\n", (int)i, ref.m_index);
+
+                NANOCLR_SET_AND_LEAVE(CLR_E_FAIL);
+            }
+
+            if (fAddress)
+            {
+                excluded[ref.m_index] = true;
+            }
+        }
+
+        if (ref.m_ol->m_flags & CLR_RT_OpcodeLookup::ATTRIB_HAS_TARGET)
+        {
+            succ.insert(succ.end(), ref.m_targets.begin(), ref.m_targets.end());
+        }
+
+        if ((ref.m_ol->m_flags & CLR_RT_OpcodeLookup::COND_BRANCH_MASK) != CLR_RT_OpcodeLookup::COND_BRANCH_ALWAYS &&
+            i + 1 < len)
+        {
+            succ.push_back((CLR_INT32)(i + 1));
+        }
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        LogicalOpcodeDesc &ref = m_opcodes[i];
+
+        if (ref.m_op == CEE_ENDFINALLY || ref.m_op == CEE_ENDFILTER)
+        {
+            successors[i].insert(successors[i].end(), continuations.begin(), continuations.end());
+        }
+    }
+
+    //--//
+
+    do
+    {
+        fChanged = false;
+
+        for (i = len; i-- > 0;)
+        {
+            LogicalOpcodeDesc &ref = m_opcodes[i];
+            CLR_UINT32 *in = &liveIn[i * words];
+            CLR_UINT32 *out = &liveOut[i * words];
+            bool fStore;
+            bool fAddress;
+            size_t w;
+
+            std::fill(handlerIn.begin(), handlerIn.end(), 0);
+
+            for (size_t j = 0; j < m_exceptions.size(); j++)
+            {
+                LogicalExceptionBlock &leb = m_exceptions[j];
+
+                if (leb.m_TryIndex <= (CLR_INT32)i && (CLR_INT32)i <= leb.m_TryIndexEnd)
+                {
+                    for (w = 0; w < words; w++)
+                    {
+                        handlerIn[w] |= liveIn[leb.m_HandlerIndex * words + w];
+
+                        if (leb.m_Flags == COR_ILEXCEPTION_CLAUSE_FILTER)
+                        {
+                            handlerIn[w] |= liveIn[leb.m_FilterIndex * words + w];
+                        }
+                    }
+                }
+            }
+
+            for (size_t j = 0; j < successors[i].size(); j++)
+            {
+                const CLR_UINT32 *inSucc = &liveIn[successors[i][j] * words];
+
+                for (w = 0; w < words; w++)
+                {
+                    out[w] |= inSucc[w];
+                }
+            }
+
+            for (w = 0; w < words; w++)
+            {
+                out[w] |= handlerIn[w];
+            }
+
+            for (w = 0; w < words; w++)
+            {
+                CLR_UINT32 val = out[w];
+
+                if (local_IsLocalAccess(ref.m_op, fStore, fAddress) && ref.m_index / 32 == w)
+                {
+                    CLR_UINT32 mask = 1u << (ref.m_index % 32);
+
+                    if (fStore)
+                    {
+                        val &= ~mask;
+                    }
+                    else
+                    {
+                        val |= mask;
+                    }
+                }
+
+                val |= handlerIn[w];
+
+                if (in[w] != val)
+                {
+                    in[w] = val;
+                    fChanged = true;
+                }
+            }
+        }
+    } while (fChanged);
+
+    //--//
+
+    for (size_t v = 0; v < numLocals; v++)
+    {
+        if (liveIn[v / 32] & (1u << (v % 32)))
+        {
+            excluded[v] = true;
+        }
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        LogicalOpcodeDesc &ref = m_opcodes[i];
+        const CLR_UINT32 *out = &liveOut[i * words];
+        bool fStore;
+        bool fAddress;
+
+        if (local_IsLocalAccess(ref.m_op, fStore, fAddress) && fStore)
+        {
+            for (size_t v = 0; v < numLocals; v++)
+            {
+                if (v != ref.m_index && (out[v / 32] & (1u << (v % 32))))
+                {
+                    interference[ref.m_index * numLocals + v] = true;
+                    interference[v * numLocals + ref.m_index] = true;
+                }
+            }
+        }
+    }
+
+    NANOCLR_NOCLEANUP();
+}
+
+//
+// Moves every local access to its new slot, switching to the shortest encoding of the opcode for that slot.
+//
+HRESULT MetaData::ByteCode::RemapLocals(const std::vector<CLR_UINT32> &remap)
+{
+    NANOCLR_HEADER();
+
+    for (size_t i = 0; i < m_opcodes.size(); i++)
+    {
+        LogicalOpcodeDesc &ref = m_opcodes[i];
+        CLR_OPCODE op;
+        CLR_UINT32 index;
+        bool fStore;
+        bool fAddress;
+
+        if (!local_IsLocalAccess(ref.m_op, fStore, fAddress))
+            continue;
+
+        if (ref.m_index >= remap.size())
+            NANOCLR_SET_AND_LEAVE(CLR_E_FAIL);
+
+        index = remap[ref.m_index];
+
+        if (fAddress)
+        {
+            op = (index <= 0xFF) ? CEE_LDLOCA_S : CEE_LDLOCA;
+        }
+        else if (index < 4)
+        {
+            op = (CLR_OPCODE)((fStore ? CEE_STLOC_0 : CEE_LDLOC_0) + index);
+        }
+        else if (index <= 0xFF)
+        {
+            op = fStore ? CEE_STLOC_S : CEE_LDLOC_S;
+        }
+        else
+        {
+            op = fStore ? CEE_STLOC : CEE_LDLOC;
+        }
+
+        ref.m_op = op;
+        ref.m_ol = &c_CLR_RT_OpcodeLookup[op];
+        ref.m_index = index;
+
+        switch (ref.m_ol->m_opParam)
+        {
+            case CLR_OpcodeParam_ShortVar:
+                ref.m_ipLength = 2;
+                break;
+
+            case CLR_OpcodeParam_Var:
+                ref.m_ipLength = 4;
+                break;
+
+            default:
+                ref.m_ipLength = 1;
+                break;
+        }
+    }
+
+    NANOCLR_NOCLEANUP();
+}
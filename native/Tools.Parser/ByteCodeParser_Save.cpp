@@ -8,6 +8,13 @@
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+//
+// Methods are compiled on several threads by the linker, the distribution stats are shared.
+//
+static std::mutex s_lockDistribution;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 HRESULT CLR_CompressTokenHelper(const CLR_TABLESENUM *tables, CLR_UINT16 cTables, CLR_UINT32 &tk)
 {
     CLR_TABLESENUM tbl = CLR_TypeFromTk(tk);
@@ -58,7 +65,7 @@ HRESULT MetaData::ByteCode::ConvertTokens(mdTokenMap &lookupIDs)
                 NANOCLR_SET_AND_LEAVE(CLR_E_FAIL);
             }
 
-            ref.m_token = lookupIDs[ref.m_token];
+            ref.m_token = lookupIDs.find(ref.m_token)->second;
         }
     }
 
@@ -135,6 +142,9 @@ HRESULT MetaData::ByteCode::GenerateOldIL(std::vector<BYTE> &code)
                 if (diff < -0x8000 || diff > 0x7FFF)
                     NANOCLR_SET_AND_LEAVE(CLR_E_FAIL);
 
+                if (ref.m_ol->m_opParam == CLR_OpcodeParam_ShortBrTarget && (diff < -0x80 || diff > 0x7F))
+                    NANOCLR_SET_AND_LEAVE(CLR_E_FAIL);
+
                 ref.m_targets[j] = diff;
             }
         }
@@ -284,9 +294,18 @@ HRESULT MetaData::ByteCode::GenerateOldIL(std::vector<BYTE> &code)
         }
     }
 
-    s_numOfOpcodes[(int)m_opcodes.size()]++;
-    s_numOfEHs[(int)m_exceptions.size()]++;
-    s_sizeOfMethod[(int)code.size()]++;
+    {
+        std::lock_guard<std::mutex> lock(s_lockDistribution);
+
+        s_numOfOpcodes[(int)m_opcodes.size()]++;
+        s_numOfEHs[(int)m_exceptions.size()]++;
+        s_sizeOfMethod[(int)code.size()]++;
+
+        if (s_statistics.m_fEnabled)
+        {
+            s_statistics.Add(*this);
+        }
+    }
 
     NANOCLR_NOCLEANUP();
 }
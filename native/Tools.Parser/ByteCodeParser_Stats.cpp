@@ -0,0 +1,404 @@
+//
+// Copyright (c) 2017 The nanoFramework project contributors
+// Portions Copyright (c) Microsoft Corporation.  All rights reserved.
+// See LICENSE file in the project root for full license information.
+//
+
+#include "stdafx.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum StatisticsAccess
+{
+    c_Access_Load = 0,
+    c_Access_Store = 1,
+    c_Access_Address = 2,
+};
+
+typedef void (*StatisticsFormatter)(CLR_INT64 key, std::string &str);
+
+struct StatisticsCategory
+{
+    LPCSTR m_name;
+    const MetaData::ByteCode::Statistics::Counter *m_counter;
+    StatisticsFormatter m_formatter;
+};
+
+//--//
+
+static bool local_LocalAccess(CLR_OPCODE op, CLR_INT64 &access)
+{
+    switch (op)
+    {
+        case CEE_LDLOC_0:
+        case CEE_LDLOC_1:
+        case CEE_LDLOC_2:
+        case CEE_LDLOC_3:
+        case CEE_LDLOC_S:
+        case CEE_LDLOC:
+            access = c_Access_Load;
+            return true;
+
+        case CEE_STLOC_0:
+        case CEE_STLOC_1:
+        case CEE_STLOC_2:
+        case CEE_STLOC_3:
+        case CEE_STLOC_S:
+        case CEE_STLOC:
+            access = c_Access_Store;
+            return true;
+
+        case CEE_LDLOCA_S:
+        case CEE_LDLOCA:
+            access = c_Access_Address;
+            return true;
+    }
+
+    return false;
+}
+
+static bool local_ArgAccess(CLR_OPCODE op, CLR_INT64 &access)
+{
+    switch (op)
+    {
+        case CEE_LDARG_0:
+        case CEE_LDARG_1:
+        case CEE_LDARG_2:
+        case CEE_LDARG_3:
+        case CEE_LDARG_S:
+        case CEE_LDARG:
+            access = c_Access_Load;
+            return true;
+
+        case CEE_STARG_S:
+        case CEE_STARG:
+            access = c_Access_Store;
+            return true;
+
+        case CEE_LDARGA_S:
+        case CEE_LDARGA:
+            access = c_Access_Address;
+            return true;
+    }
+
+    return false;
+}
+
+static LPCSTR local_OpcodeName(CLR_INT64 op)
+{
+    return (op >= 0 && op < CEE_COUNT) ? c_CLR_RT_OpcodeLookup[op].m_name : "<invalid>";
+}
+
+static LPCSTR local_TableName(CLR_INT64 tbl)
+{
+    switch (tbl)
+    {
+        case TBL_AssemblyRef:
+            return "AssemblyRef";
+        case TBL_TypeRef:
+            return "TypeRef";
+        case TBL_FieldRef:
+            return "FieldRef";
+        case TBL_MethodRef:
+            return "MethodRef";
+        case TBL_TypeDef:
+            return "TypeDef";
+        case TBL_FieldDef:
+            return "FieldDef";
+        case TBL_MethodDef:
+            return "MethodDef";
+        case TBL_TypeSpec:
+            return "TypeSpec";
+        case TBL_Strings:
+            return "Strings";
+        case TBL_Signatures:
+            return "Signatures";
+    }
+
+    return "<other>";
+}
+
+static void local_FormatOpcode(CLR_INT64 key, std::string &str)
+{
+    str = local_OpcodeName(key);
+}
+
+static void local_FormatBigram(CLR_INT64 key, std::string &str)
+{
+    str = local_OpcodeName((key >> 16) & 0xFFFF);
+    str += ' ';
+    str += local_OpcodeName(key & 0xFFFF);
+}
+
+static void local_FormatTrigram(CLR_INT64 key, std::string &str)
+{
+    str = local_OpcodeName((key >> 32) & 0xFFFF);
+    str += ' ';
+    str += local_OpcodeName((key >> 16) & 0xFFFF);
+    str += ' ';
+    str += local_OpcodeName(key & 0xFFFF);
+}
+
+static void local_FormatToken(CLR_INT64 key, std::string &str)
+{
+    str = local_OpcodeName(key >> 8);
+    str += ' ';
+    str += local_TableName(key & 0xFF);
+}
+
+static void local_FormatAccess(CLR_INT64 key, std::string &str)
+{
+    static const LPCSTR c_Access[] = {"load", "store", "address"};
+    char sz[32];
+
+    sprintf_s(sz, ARRAYSIZE(sz), "%s %u", c_Access[(key >> 16) % ARRAYSIZE(c_Access)], (CLR_UINT32)(key & 0xFFFF));
+
+    str = sz;
+}
+
+static void local_FormatNumber(CLR_INT64 key, std::string &str)
+{
+    char sz[32];
+
+    sprintf_s(sz, ARRAYSIZE(sz), "%lld", key);
+
+    str = sz;
+}
+
+static void local_FromDistribution(
+    const MetaData::ByteCode::Distribution &src,
+    MetaData::ByteCode::Statistics::Counter &dst)
+{
+    for (MetaData::ByteCode::DistributionConstIter it = src.begin(); it != src.end(); it++)
+    {
+        dst[(CLR_INT64)it->first] = it->second;
+    }
+}
+
+static bool local_SortByCount(
+    const MetaData::ByteCode::Statistics::CounterConstIter &left,
+    const MetaData::ByteCode::Statistics::CounterConstIter &right)
+{
+    return left->second > right->second;
+}
+
+//--//
+
+MetaData::ByteCode::Statistics MetaData::ByteCode::s_statistics;
+
+MetaData::ByteCode::Statistics::Statistics()
+{
+    m_fEnabled = false; // bool    m_fEnabled;
+    m_methods = 0;      // size_t  m_methods;
+                        // Counter m_opcodes;
+                        // Counter m_bigrams;
+                        // Counter m_trigrams;
+                        // Counter m_tokens;
+                        // Counter m_branches;
+                        // Counter m_locals;
+                        // Counter m_args;
+}
+
+void MetaData::ByteCode::Statistics::Add(const ByteCode &bc)
+{
+    size_t len = bc.m_opcodes.size();
+    OpcodeMask entry(len, false);
+    CLR_INT64 prev1 = -1;
+    CLR_INT64 prev2 = -1;
+
+    for (LogicalExceptionBlockVectorConstIter it = bc.m_exceptions.begin(); it != bc.m_exceptions.end(); it++)
+    {
+        entry[it->m_TryIndex] = true;
+        entry[it->m_HandlerIndex] = true;
+
+        if (it->m_Flags == COR_ILEXCEPTION_CLAUSE_FILTER)
+        {
+            entry[it->m_FilterIndex] = true;
+        }
+    }
+
+    m_methods++;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        const LogicalOpcodeDesc &ref = bc.m_opcodes[i];
+        CLR_INT64 op = ref.m_op;
+        CLR_INT64 access;
+
+        if (ref.m_references || entry[i])
+        {
+            prev1 = -1;
+            prev2 = -1;
+        }
+
+        m_opcodes[op]++;
+
+        if (prev1 >= 0)
+        {
+            m_bigrams[prev1 << 16 | op]++;
+
+            if (prev2 >= 0)
+            {
+                m_trigrams[prev2 << 32 | prev1 << 16 | op]++;
+            }
+        }
+
+        prev2 = prev1;
+        prev1 = op;
+
+        if (ref.m_ol->m_flags & CLR_RT_OpcodeLookup::ATTRIB_HAS_TOKEN)
+        {
+            m_tokens[op << 8 | CLR_TypeFromTk(ref.m_token)]++;
+        }
+
+        // the targets have been turned into distances by GenerateOldIL
+        if (ref.m_ol->m_flags & CLR_RT_OpcodeLookup::ATTRIB_HAS_TARGET)
+        {
+            for (size_t j = 0; j < ref.m_targets.size(); j++)
+            {
+                m_branches[ref.m_targets[j]]++;
+            }
+        }
+
+        if (local_LocalAccess(ref.m_op, access))
+        {
+            m_locals[access << 16 | ref.m_index]++;
+        }
+        else if (local_ArgAccess(ref.m_op, access))
+        {
+            m_args[access << 16 | ref.m_index]++;
+        }
+
+        if ((ref.m_ol->m_flags & CLR_RT_OpcodeLookup::COND_BRANCH_MASK) == CLR_RT_OpcodeLookup::COND_BRANCH_ALWAYS)
+        {
+            prev1 = -1;
+            prev2 = -1;
+        }
+    }
+}
+
+void MetaData::ByteCode::Statistics::Dump(size_t numTop)
+{
+    const StatisticsCategory categories[] = {
+        {"opcodes", &m_opcodes, local_FormatOpcode},
+        {"bigrams", &m_bigrams, local_FormatBigram},
+        {"trigrams", &m_trigrams, local_FormatTrigram},
+    };
+
+    for (size_t i = 0; i < ARRAYSIZE(categories); i++)
+    {
+        const StatisticsCategory &cat = categories[i];
+        std::vector<CounterConstIter> rows;
+        size_t total = 0;
+        std::string str;
+
+        for (CounterConstIter it = cat.m_counter->begin(); it != cat.m_counter->end(); it++)
+        {
+            rows.push_back(it);
+            total += it->second;
+        }
+
+        std::stable_sort(rows.begin(), rows.end(), local_SortByCount);
+
+        if (rows.size() > numTop)
+            rows.resize(numTop);
+
+        wprintf(L"Top %d %S of %d methods:\n", (int)rows.size(), cat.m_name, (int)m_methods);
+
+        for (size_t j = 0; j < rows.size(); j++)
+        {
+            cat.m_formatter(rows[j]->first, str);
+
+            wprintf(L"  %10d %6.2f%%  %S\n", (int)rows[j]->second, rows[j]->second * 100.0 / total, str.c_str());
+        }
+    }
+}
+
+HRESULT MetaData::ByteCode::Statistics::Save(const std::wstring &file)
+{
+    NANOCLR_HEADER();
+
+    Counter numOfOpcodes;
+    Counter numOfEHs;
+    Counter sizeOfMethod;
+    FILE *stream = NULL;
+    bool fJson = file.size() >= 5 && _wcsicmp(file.c_str() + file.size() - 5, L".json") == 0;
+    std::string str;
+
+    const StatisticsCategory categories[] = {
+        {"opcodes", &m_opcodes, local_FormatOpcode},
+        {"bigrams", &m_bigrams, local_FormatBigram},
+        {"trigrams", &m_trigrams, local_FormatTrigram},
+        {"tokens", &m_tokens, local_FormatToken},
+        {"branches", &m_branches, local_FormatNumber},
+        {"locals", &m_locals, local_FormatAccess},
+        {"args", &m_args, local_FormatAccess},
+        {"methodOpcodes", &numOfOpcodes, local_FormatNumber},
+        {"methodEHs", &numOfEHs, local_FormatNumber},
+        {"methodSize", &sizeOfMethod, local_FormatNumber},
+    };
+
+    local_FromDistribution(s_numOfOpcodes, numOfOpcodes);
+    local_FromDistribution(s_numOfEHs, numOfEHs);
+    local_FromDistribution(s_sizeOfMethod, sizeOfMethod);
+
+    if (_wfopen_s(&stream, file.c_str(), L"w") != 0)
+    {
+        NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FILE_IO, L"Cannot open '%s' for writing!\n", file.c_str());
+    }
+
+    //
+    // Keys are opcode names, table names and numbers, none of them needs escaping in either format.
+    //
+    if (fJson)
+    {
+        fprintf(stream, "{\"methods\":%llu", (CLR_UINT64)m_methods);
+    }
+    else
+    {
+        fprintf(stream, "Category,Key,Count\n");
+        fprintf(stream, "methods,,%llu\n", (CLR_UINT64)m_methods);
+    }
+
+    for (size_t i = 0; i < ARRAYSIZE(categories); i++)
+    {
+        const StatisticsCategory &cat = categories[i];
+
+        if (fJson)
+            fprintf(stream, ",\n\"%s\":{", cat.m_name);
+
+        for (CounterConstIter it = cat.m_counter->begin(); it != cat.m_counter->end(); it++)
+        {
+            cat.m_formatter(it->first, str);
+
+            if (fJson)
+            {
+                fprintf(
+                    stream,
+                    "%s\"%s\":%llu",
+                    it == cat.m_counter->begin() ? "" : ",",
+                    str.c_str(),
+                    (CLR_UINT64)it->second);
+            }
+            else
+            {
+                fprintf(stream, "%s,%s,%llu\n", cat.m_name, str.c_str(), (CLR_UINT64)it->second);
+            }
+        }
+
+        if (fJson)
+            fprintf(stream, "}");
+    }
+
+    if (fJson)
+        fprintf(stream, "}\n");
+
+    NANOCLR_CLEANUP();
+
+    if (stream)
+    {
+        fclose(stream);
+    }
+
+    NANOCLR_CLEANUP_END();
+}
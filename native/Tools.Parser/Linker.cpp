@@ -124,187 +124,347 @@ void WatchAssemblyBuilder::ChangeExtensionOnFileName(
     }
 }
 
+//
+// Same as CLR_RT_Assembly::FindMethodBoundaries, except that a method ends at the next higher RVA: a method folded by
+// -foldMethods has the same RVA as the one before it.
+//
+bool WatchAssemblyBuilder::FindMethodBoundaries(CLR_RT_Assembly *assm, CLR_INDEX i, CLR_OFFSET &start, CLR_OFFSET &end)
+{
+    const CLR_RECORD_METHODDEF *md = assm->GetMethodDef(i);
+
+    if (md->RVA == CLR_EmptyIndex)
+        return false;
+
+    start = md->RVA;
+    end = (CLR_OFFSET)assm->m_pTablesSize[TBL_ByteCode];
+
+    for (int j = i + 1; j < assm->m_pTablesSize[TBL_MethodDef]; j++)
+    {
+        md = assm->GetMethodDef(j);
+
+        if (md->RVA != CLR_EmptyIndex && md->RVA > start)
+        {
+            end = md->RVA;
+            break;
+        }
+    }
+
+    return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy::ExceptionHandlerHierarchy()
+WatchAssemblyBuilder::XmlWriter::XmlWriter()
+{
+    m_file = NULL;           // FILE*              m_file;
+                             // CQuickRecord<CHAR> m_buffer;
+                             // std::vector<LPCSTR> m_elements;
+    m_fStartPending = false; // bool               m_fStartPending;
+                             // std::string        m_tmp;
+}
+
+WatchAssemblyBuilder::XmlWriter::~XmlWriter()
 {
-    m_data = NULL; // CLR_RECORD_EH*                        m_data;
-                   // std::list<ExceptionHandlerHierarchy*> m_children;
+    if (m_file)
+    {
+        fclose(m_file);
+    }
 }
 
-WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy::ExceptionHandlerHierarchy(ExceptionHandlerHierarchy &ehh)
+HRESULT WatchAssemblyBuilder::XmlWriter::Open(LPCWSTR szFile)
 {
-    m_data = NULL;
+    NANOCLR_HEADER();
+
+    m_buffer.Reset();
+    m_elements.clear();
+    m_fStartPending = false;
+
+    if (_wfopen_s(&m_file, szFile, L"wb") != 0)
+    {
+        m_file = NULL;
+
+        NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FILE_IO, L"Cannot open '%s' for writing\n", szFile);
+    }
+
+    // Same prolog MSXML writes for a document created through CLR_XmlUtil::New.
+    NANOCLR_CHECK_HRESULT(Append("<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n"));
 
-    *this = ehh;
+    NANOCLR_NOCLEANUP();
 }
 
-WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy &WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy::
-    operator=(const ExceptionHandlerHierarchy &ehh)
+HRESULT WatchAssemblyBuilder::XmlWriter::Close()
 {
-    Clear();
+    NANOCLR_HEADER();
 
-    if (ehh.m_data)
+    while (m_elements.size())
     {
-        m_data = new CLR_RECORD_EH();
-        *m_data = *ehh.m_data;
+        NANOCLR_CHECK_HRESULT(EndElement());
     }
 
-    for (std::list<ExceptionHandlerHierarchy *>::const_iterator it = ehh.m_children.begin(); it != ehh.m_children.end();
-         it++)
+    NANOCLR_CHECK_HRESULT(Flush());
+
+    if (fclose(m_file) != 0)
     {
-        ExceptionHandlerHierarchy *orig = *it;
-        ExceptionHandlerHierarchy *child = new ExceptionHandlerHierarchy(*orig);
+        m_file = NULL;
 
-        m_children.push_back(child);
+        NANOCLR_SET_AND_LEAVE(CLR_E_FILE_IO);
     }
 
-    return *this;
+    m_file = NULL;
+
+    NANOCLR_NOCLEANUP();
 }
 
-WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy::~ExceptionHandlerHierarchy()
+HRESULT WatchAssemblyBuilder::XmlWriter::Append(LPCSTR sz, size_t len)
 {
-    Clear();
+    NANOCLR_HEADER();
+
+    CHAR *dst = m_buffer.Alloc(len);
+
+    if (dst == NULL)
+    {
+        NANOCLR_SET_AND_LEAVE(CLR_E_OUT_OF_MEMORY);
+    }
+
+    memcpy(dst, sz, len);
+
+    if (m_buffer.GetPos() >= c_FlushThreshold)
+    {
+        NANOCLR_CHECK_HRESULT(Flush());
+    }
+
+    NANOCLR_NOCLEANUP();
 }
 
-WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy::ExceptionHandlerHierarchy(const CLR_RECORD_EH &eh)
+HRESULT WatchAssemblyBuilder::XmlWriter::Append(LPCSTR sz)
 {
-    m_data = new CLR_RECORD_EH;
-    *m_data = eh;
+    return Append(sz, strlen(sz));
 }
 
-void WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy::Clear()
+HRESULT WatchAssemblyBuilder::XmlWriter::AppendEscaped(LPCSTR sz, size_t len)
 {
-    delete m_data;
-    m_data = NULL;
+    NANOCLR_HEADER();
 
-    for (std::list<ExceptionHandlerHierarchy *>::iterator it = m_children.begin(); it != m_children.end(); it++)
+    LPCSTR szStart = sz;
+    LPCSTR szEnd = sz + len;
+
+    for (; sz < szEnd; sz++)
     {
-        delete *it;
+        LPCSTR szEntity;
+
+        switch (*sz)
+        {
+            case '&':
+                szEntity = "&amp;";
+                break;
+            case '<':
+                szEntity = "&lt;";
+                break;
+            case '>':
+                szEntity = "&gt;";
+                break;
+            default:
+                continue;
+        }
+
+        NANOCLR_CHECK_HRESULT(Append(szStart, sz - szStart));
+        NANOCLR_CHECK_HRESULT(Append(szEntity));
+
+        szStart = sz + 1;
     }
-    m_children.clear();
+
+    NANOCLR_CHECK_HRESULT(Append(szStart, szEnd - szStart));
+
+    NANOCLR_NOCLEANUP();
 }
 
-//--//
+HRESULT WatchAssemblyBuilder::XmlWriter::CloseStartTag()
+{
+    NANOCLR_HEADER();
+
+    if (m_fStartPending)
+    {
+        m_fStartPending = false;
+
+        NANOCLR_CHECK_HRESULT(Append(">", 1));
+    }
+
+    NANOCLR_NOCLEANUP();
+}
+
+HRESULT WatchAssemblyBuilder::XmlWriter::Flush()
+{
+    NANOCLR_HEADER();
+
+    size_t len = m_buffer.GetPos();
+
+    if (len && fwrite(m_buffer.Ptr(), 1, len, m_file) != len)
+    {
+        NANOCLR_SET_AND_LEAVE(CLR_E_FILE_IO);
+    }
+
+    m_buffer.Reset();
+
+    NANOCLR_NOCLEANUP();
+}
+
+HRESULT WatchAssemblyBuilder::XmlWriter::StartElement(LPCSTR szTag)
+{
+    NANOCLR_HEADER();
+
+    NANOCLR_CHECK_HRESULT(CloseStartTag());
+
+    NANOCLR_CHECK_HRESULT(Append("<", 1));
+    NANOCLR_CHECK_HRESULT(Append(szTag));
+
+    m_elements.push_back(szTag);
+    m_fStartPending = true;
 
-bool WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy::FindMaxCoverage(CLR_OFFSET &start, CLR_OFFSET &end) const
+    NANOCLR_NOCLEANUP();
+}
+
+HRESULT WatchAssemblyBuilder::XmlWriter::EndElement()
 {
-    bool fGot;
+    NANOCLR_HEADER();
+
+    LPCSTR szTag = m_elements.back();
 
-    if (m_data)
+    m_elements.pop_back();
+
+    if (m_fStartPending)
     {
-        start = m_data->tryStart;
-        end = m_data->tryEnd;
+        // Elements without children are written in their short form, like MSXML does.
+        m_fStartPending = false;
 
-        fGot = true;
+        NANOCLR_CHECK_HRESULT(Append("/>", 2));
     }
     else
     {
-        fGot = false;
+        NANOCLR_CHECK_HRESULT(Append("</", 2));
+        NANOCLR_CHECK_HRESULT(Append(szTag));
+        NANOCLR_CHECK_HRESULT(Append(">", 1));
     }
 
-    for (std::list<ExceptionHandlerHierarchy *>::const_iterator it = m_children.begin(); it != m_children.end(); it++)
-    {
-        ExceptionHandlerHierarchy *child = *it;
-        CLR_OFFSET childStart;
-        CLR_OFFSET childEnd;
+    NANOCLR_NOCLEANUP();
+}
 
-        if (child->FindMaxCoverage(childStart, childEnd))
-        {
-            if (fGot)
-            {
-                if (start > childStart)
-                    start = childStart;
-                if (end < childEnd)
-                    end = childEnd;
-            }
-            else
-            {
-                start = childStart;
-                end = childEnd;
-                fGot = true;
-            }
-        }
+HRESULT WatchAssemblyBuilder::XmlWriter::WriteElement(LPCSTR szTag, LPCSTR szValue)
+{
+    NANOCLR_HEADER();
+
+    NANOCLR_CHECK_HRESULT(StartElement(szTag));
+
+    if (szValue[0])
+    {
+        NANOCLR_CHECK_HRESULT(CloseStartTag());
+        NANOCLR_CHECK_HRESULT(AppendEscaped(szValue, strlen(szValue)));
     }
 
-    return fGot;
+    NANOCLR_CHECK_HRESULT(EndElement());
+
+    NANOCLR_NOCLEANUP();
 }
 
-//--//
+HRESULT WatchAssemblyBuilder::XmlWriter::WriteElement(LPCSTR szTag, const std::wstring &strValue)
+{
+    CLR_RT_UnicodeHelper::ConvertToUTF8(strValue, m_tmp);
 
-void WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy::Queue(const CLR_RECORD_EH &eh)
+    return WriteElement(szTag, m_tmp.c_str());
+}
+
+HRESULT WatchAssemblyBuilder::XmlWriter::WriteElement(LPCSTR szTag, CLR_UINT32 value)
 {
-    Queue(new ExceptionHandlerHierarchy(eh));
+    char rgBuffer[16];
+
+    sprintf_s(rgBuffer, ARRAYSIZE(rgBuffer), "%u", value);
+
+    return WriteElement(szTag, rgBuffer);
 }
 
-void WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy::Queue(ExceptionHandlerHierarchy *newEhh)
+HRESULT WatchAssemblyBuilder::XmlWriter::WriteElementHex(LPCSTR szTag, CLR_UINT32 value)
 {
-    CLR_OFFSET start = newEhh->m_data->tryStart;
-    CLR_OFFSET end = newEhh->m_data->tryEnd;
-    std::list<ExceptionHandlerHierarchy *>::iterator it;
+    char rgBuffer[16];
 
-    for (it = m_children.begin(); it != m_children.end();)
-    {
-        ExceptionHandlerHierarchy *child = *it;
-        CLR_OFFSET childStart;
-        CLR_OFFSET childEnd;
+    sprintf_s(rgBuffer, ARRAYSIZE(rgBuffer), "0x%08X", value);
 
-        if (child->FindMaxCoverage(childStart, childEnd))
-        {
-            //
-            // Is child covered? Swap the two.
-            //
-            if (start <= childStart && end >= childEnd)
-            {
-                newEhh->Queue(child);
+    return WriteElement(szTag, rgBuffer);
+}
 
-                m_children.erase(it);
-                it = m_children.begin();
-                continue;
-            }
+////////////////////////////////////////////////////////////////////////////////////////////////////
 
-            //
-            // Does child cover the new block? Recurse.
-            //
-            if (childStart <= start && childEnd >= end)
-            {
-                child->Queue(newEhh);
-                return;
-            }
+//
+// Try blocks are either disjoint or nested, so sorting the clauses by (tryStart, -tryEnd) puts every clause right after
+// the clauses enclosing it. Identical try ranges (several catch clauses on the same try) are kept in reverse queue
+// order, so the clause queued first is treated as the innermost one.
+//
+bool WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy::SortByNesting(const Clause &left, const Clause &right)
+{
+    if (left.m_eh.tryStart != right.m_eh.tryStart)
+        return left.m_eh.tryStart < right.m_eh.tryStart;
 
-            if (childStart > end)
-            {
-                break;
-            }
+    if (left.m_eh.tryEnd != right.m_eh.tryEnd)
+        return left.m_eh.tryEnd > right.m_eh.tryEnd;
 
-            it++;
-        }
-    }
+    return left.m_index > right.m_index;
+}
+
+void WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy::Clear()
+{
+    m_clauses.clear();
+    m_stack.clear();
+}
+
+void WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy::Queue(const CLR_RECORD_EH &eh)
+{
+    Clause clause;
 
-    m_children.insert(it, newEhh);
+    clause.m_eh = eh;
+    clause.m_index = m_clauses.size();
+
+    m_clauses.push_back(clause);
 }
 
+//
+// Emits the clauses innermost first: a clause is written out once the scan moves past the end of its try block,
+// after everything nested in it and after the sibling blocks preceding it.
+//
 HRESULT WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy::GenerateOutput(CQuickRecord<CLR_RECORD_EH> &tbl)
 {
     NANOCLR_HEADER();
 
-    for (std::list<ExceptionHandlerHierarchy *>::iterator it = m_children.begin(); it != m_children.end(); it++)
-    {
-        ExceptionHandlerHierarchy *ehh = *it;
+    CLR_RECORD_EH *dstEH = tbl.Alloc(m_clauses.size());
+    size_t numEmitted = 0;
 
-        NANOCLR_CHECK_HRESULT(ehh->GenerateOutput(tbl));
-    }
+    if (dstEH == NULL && m_clauses.size() > 0)
+        REPORT_NO_MEMORY();
+
+    std::sort(m_clauses.begin(), m_clauses.end(), SortByNesting);
 
-    if (m_data)
+    m_stack.clear();
+
+    for (size_t i = 0; i <= m_clauses.size(); i++)
     {
-        // wprintf( L"%04x %04x %04x %04x\n", m_data->classToken, m_data->tryStart,
-        // m_data->tryEnd, m_data->handlerStart );
+        while (m_stack.size() > 0)
+        {
+            const CLR_RECORD_EH &outer = m_clauses[m_stack.back()].m_eh;
 
-        CLR_RECORD_EH *dstEH = tbl.Alloc(1);
-        if (dstEH == NULL)
-            REPORT_NO_MEMORY();
+            if (i < m_clauses.size())
+            {
+                const CLR_RECORD_EH &eh = m_clauses[i].m_eh;
+
+                if (outer.tryStart <= eh.tryStart && eh.tryEnd <= outer.tryEnd)
+                    break;
+            }
+
+            dstEH[numEmitted++] = outer;
 
-        *dstEH = *m_data;
+            m_stack.pop_back();
+        }
+
+        if (i < m_clauses.size())
+        {
+            m_stack.push_back(i);
+        }
     }
 
     NANOCLR_NOCLEANUP();
@@ -314,6 +474,21 @@ HRESULT WatchAssemblyBuilder::Linker::ExceptionHandlerHierarchy::GenerateOutput(
 
 WatchAssemblyBuilder::Linker::Linker()
 {
+    m_fFoldMethods = false;
+    m_previousBody.m_RVA = CLR_EmptyIndex;
+    m_previousBody.m_length = 0;
+    m_fPreviousHasEH = false;
+    m_numFoldedMethods = 0;
+    m_sizeFoldedMethods = 0;
+
+    m_fOptimizeByteCode = false;
+    m_numRemovedOpcodes = 0;
+
+    m_fCompactLocals = false;
+    m_numRemovedLocals = 0;
+
+    m_numProfiledMethods = 0;
+
     m_pr = NULL;
 }
 
@@ -349,6 +524,23 @@ void WatchAssemblyBuilder::Linker::Clean()
     m_setAttributes_Types.clear();   // MetaData::mdTokenSet m_setAttributes_Types;
     m_setAttributes_Fields.clear();  // MetaData::mdTokenSet                 m_setAttributes_Fields;
     m_setAttributes_Methods.clear(); // MetaData::mdTokenSet                 m_setAttributes_Methods;
+                                     //
+                                     // ByteCodeBody                         m_previousBody;
+    m_previousBody.m_RVA = CLR_EmptyIndex;
+    m_previousBody.m_length = 0;
+                                     // bool                                 m_fFoldMethods;
+    m_fPreviousHasEH = false;        // bool                                 m_fPreviousHasEH;
+    m_numFoldedMethods = 0;          // size_t                               m_numFoldedMethods;
+    m_sizeFoldedMethods = 0;         // size_t                               m_sizeFoldedMethods;
+                                     //
+                                     // bool                                 m_fOptimizeByteCode;
+    m_numRemovedOpcodes = 0;         // size_t                               m_numRemovedOpcodes;
+                                     //
+                                     // bool                                 m_fCompactLocals;
+    m_numRemovedLocals = 0;          // size_t                               m_numRemovedLocals;
+                                     //
+                                     // std::map<std::wstring, CLR_UINT32>   m_profile;
+    m_numProfiledMethods = 0;        // size_t                               m_numProfiledMethods;
                                      //
                                      // MetaData::Parser*                    m_pr;
                                      // BYTE                                 m_tmpSig[1024];
@@ -961,7 +1153,11 @@ CLR_IDX WatchAssemblyBuilder::Linker::EncodeTypeRefOrDef(mdToken tk)
         return CLR_EmptyIndex;
     }
 
-    CLR_IDX val = m_lookupIDs[tk];
+    //
+    // Can be called from the ByteCode workers, so look the token up without inserting it.
+    //
+    MetaData::mdTokenMapIter it = m_lookupIDs.find(tk);
+    CLR_IDX val = (it != m_lookupIDs.end()) ? (CLR_IDX)it->second : 0;
 
     return (TypeFromToken(tk) == mdtTypeRef) ? val | 0x8000 : val;
 }
@@ -1031,16 +1227,51 @@ HRESULT WatchAssemblyBuilder::Linker::Process(MetaData::Parser &pr)
         NANOCLR_CHECK_HRESULT(ProcessAttribute());
         NANOCLR_CHECK_HRESULT(ProcessResource());
         NANOCLR_CHECK_HRESULT(ProcessUserString());
+        NANOCLR_CHECK_HRESULT(ProcessByteCode(order));
+    }
 
-        for (MetaData::mdTypeDefListIter itOrder = order.begin(); itOrder != order.end(); itOrder++)
-        {
-            NANOCLR_CHECK_HRESULT(ProcessTypeDef_ByteCode((mdTypeDef)*itOrder));
-        }
+    if (m_fFoldMethods)
+    {
+        wprintf(
+            L"%s: folded %d identical method bodies, saved %d bytes\n",
+            m_pr->m_assemblyName.c_str(),
+            (int)m_numFoldedMethods,
+            (int)m_sizeFoldedMethods);
+    }
+
+    if (m_fOptimizeByteCode)
+    {
+        wprintf(L"%s: removed %d opcodes\n", m_pr->m_assemblyName.c_str(), (int)m_numRemovedOpcodes);
+    }
+
+    if (m_fCompactLocals)
+    {
+        wprintf(L"%s: removed %d local variable slots\n", m_pr->m_assemblyName.c_str(), (int)m_numRemovedLocals);
+    }
+
+    if (m_profile.size() > 0)
+    {
+        wprintf(L"%s: %d methods found in profile\n", m_pr->m_assemblyName.c_str(), (int)m_numProfiledMethods);
     }
 
     NANOCLR_NOCLEANUP();
 }
 
+void WatchAssemblyBuilder::Linker::SetFoldIdenticalMethods(bool fFold)
+{
+    m_fFoldMethods = fFold;
+}
+
+void WatchAssemblyBuilder::Linker::SetOptimizeByteCode(bool fOptimize)
+{
+    m_fOptimizeByteCode = fOptimize;
+}
+
+void WatchAssemblyBuilder::Linker::SetCompactLocals(bool fCompact)
+{
+    m_fCompactLocals = fCompact;
+}
+
 //--//
 
 HRESULT WatchAssemblyBuilder::Linker::ProcessAssemblyRef()
@@ -1188,6 +1419,155 @@ HRESULT WatchAssemblyBuilder::Linker::ProcessMemberRef()
 
 //--//
 
+typedef std::pair<CLR_UINT64, MetaData::TypeDef *> TypeHits;
+typedef std::vector<TypeHits> TypeHitsVector;
+typedef TypeHitsVector::iterator TypeHitsVectorIter;
+
+static bool local_SortByHits(const TypeHits &left, const TypeHits &right)
+{
+    return left.first > right.first;
+}
+
+struct MethodHitsCompare
+{
+    std::map<mdMethodDef, CLR_UINT32> &m_hits;
+
+    MethodHitsCompare(std::map<mdMethodDef, CLR_UINT32> &hits) : m_hits(hits)
+    {
+    }
+
+    bool operator()(mdMethodDef left, mdMethodDef right)
+    {
+        return m_hits[left] > m_hits[right];
+    }
+};
+
+//
+// A profile lists one method per line, followed by its hit count. A method is either its CLR token, as found in the
+// pdbx, or its full signature, '<type>::<method> <return>( <args> )', so overloads don't share their hits. The
+// signature is the one the dump prints, except that classes and value types are named rather than given by token,
+// e.g. 'Ns.Type::Run VOID( CLASS Ns.Item,I4 )', so it still matches after the assembly is rebuilt.
+//
+HRESULT
+WatchAssemblyBuilder::Linker::LoadProfile(const std::wstring &file)
+{
+    NANOCLR_HEADER();
+
+    CLR_RT_Buffer buffer;
+    LPCSTR ptr;
+
+    m_profile.clear();
+
+    NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::LoadFile(file.c_str(), buffer));
+
+    buffer.push_back(0);
+    ptr = (LPCSTR)&buffer[0];
+
+    while (*ptr)
+    {
+        LPCSTR ptrEnd = ptr + strcspn(ptr, "\r\n");
+        std::string line(ptr, ptrEnd);
+        std::string::size_type first;
+        std::string::size_type last;
+        std::string::size_type sep;
+        std::wstring method;
+        CLR_UINT32 hits;
+
+        ptr = ptrEnd + strspn(ptrEnd, "\r\n");
+
+        first = line.find_first_not_of(" \t");
+        if (first == std::string::npos)
+            continue;
+
+        //
+        // The hit count is the last field, the signature in front of it has spaces of its own.
+        //
+        last = line.find_last_not_of(" \t");
+        sep = line.find_last_of(" \t", last);
+        if (sep == std::string::npos || sep < first)
+        {
+            NANOCLR_MSG1_SET_AND_LEAVE(
+                CLR_E_FAIL,
+                L"Profile '%s' should list a method and its hit count on each line\n",
+                file.c_str());
+        }
+
+        hits = (CLR_UINT32)strtoul(line.c_str() + sep + 1, NULL, 0);
+        last = line.find_last_not_of(" \t", sep);
+
+        CLR_RT_UnicodeHelper::ConvertFromUTF8(line.substr(first, last + 1 - first).c_str(), method);
+
+        if (method.compare(0, 2, L"0x") == 0 || method.compare(0, 2, L"0X") == 0)
+        {
+            WCHAR rgBuffer[16];
+
+            swprintf_s(rgBuffer, ARRAYSIZE(rgBuffer), L"0x%08X", wcstoul(method.c_str(), NULL, 16));
+
+            method = rgBuffer;
+        }
+
+        m_profile[method] += hits;
+    }
+
+    NANOCLR_NOCLEANUP();
+}
+
+CLR_UINT32 WatchAssemblyBuilder::Linker::GetProfileHits(MetaData::MethodDef &md)
+{
+    std::map<std::wstring, CLR_UINT32>::iterator it;
+    WCHAR rgBuffer[16];
+    std::wstring strName;
+
+    swprintf_s(rgBuffer, ARRAYSIZE(rgBuffer), L"0x%08X", md.m_md);
+
+    it = m_profile.find(rgBuffer);
+    if (it != m_profile.end())
+        return it->second;
+
+    m_pr->TokenToString(md.m_md, strName);
+    strName.append(L" ");
+    m_pr->SigToString(md.m_method, strName, true);
+
+    it = m_profile.find(strName);
+    if (it != m_profile.end())
+        return it->second;
+
+    return 0;
+}
+
+//
+// Moves the hot instance and static methods to the front of their group, so their ByteCode is laid out first.
+// Virtual methods keep their order.
+//
+void WatchAssemblyBuilder::Linker::ApplyProfile(MetaData::TypeDef &td)
+{
+    std::map<mdMethodDef, CLR_UINT32> hits;
+
+    for (MetaData::mdMethodDefListIter it = td.m_methods.begin(); it != td.m_methods.end(); it++)
+    {
+        MetaData::MethodDefMapIter itDM = m_pr->m_mapDef_Method.find(*it);
+        CLR_UINT32 num;
+
+        if (itDM == m_pr->m_mapDef_Method.end())
+            continue;
+
+        MetaData::MethodDef &md = itDM->second;
+
+        num = GetProfileHits(md);
+
+        if (num > 0)
+        {
+            m_numProfiledMethods++;
+        }
+
+        hits[md.m_md] = (md.m_flags & mdVirtual) ? 0 : num;
+    }
+
+    td.m_methods.sort(MethodHitsCompare(hits));
+}
+
+//--//
+
 HRESULT
 WatchAssemblyBuilder::Linker::ProcessTypeDef(MetaData::mdTypeDefList &order)
 {
@@ -1195,6 +1575,7 @@ WatchAssemblyBuilder::Linker::ProcessTypeDef(MetaData::mdTypeDefList &order)
 
     MetaData::TypeDefMapIter it;
     MetaData::mdTypeDefListIter itOrder;
+    MetaData::mdMethodDefListIter itMethod;
     MetaData::mdTokenSet resolved;
 
     //
@@ -1203,9 +1584,44 @@ WatchAssemblyBuilder::Linker::ProcessTypeDef(MetaData::mdTypeDefList &order)
     // This is good, because the layout will be ordered and no multiple passes
     // will be required on the runtime end.
     //
-    for (it = m_pr->m_mapDef_Type.begin(); it != m_pr->m_mapDef_Type.end(); it++)
+    // With a profile loaded, the hottest types are resolved first, so they and their dependencies end up at the
+    // start of the tables and their ByteCode at the start of the ByteCode table.
+    //
+    if (m_profile.size() > 0)
+    {
+        TypeHitsVector types;
+
+        for (it = m_pr->m_mapDef_Type.begin(); it != m_pr->m_mapDef_Type.end(); it++)
+        {
+            MetaData::TypeDef &td = it->second;
+            CLR_UINT64 hits = 0;
+
+            for (itMethod = td.m_methods.begin(); itMethod != td.m_methods.end(); itMethod++)
+            {
+                MetaData::MethodDefMapIter itDM = m_pr->m_mapDef_Method.find(*itMethod);
+
+                if (itDM != m_pr->m_mapDef_Method.end())
+                {
+                    hits += GetProfileHits(itDM->second);
+                }
+            }
+
+            types.push_back(TypeHits(hits, &td));
+        }
+
+        std::stable_sort(types.begin(), types.end(), local_SortByHits);
+
+        for (TypeHitsVectorIter itType = types.begin(); itType != types.end(); itType++)
+        {
+            NANOCLR_CHECK_HRESULT(ResolveTypeDef(*itType->second, order, resolved));
+        }
+    }
+    else
     {
-        NANOCLR_CHECK_HRESULT(ResolveTypeDef(it->second, order, resolved));
+        for (it = m_pr->m_mapDef_Type.begin(); it != m_pr->m_mapDef_Type.end(); it++)
+        {
+            NANOCLR_CHECK_HRESULT(ResolveTypeDef(it->second, order, resolved));
+        }
     }
 
     //
@@ -1231,6 +1647,11 @@ WatchAssemblyBuilder::Linker::ProcessTypeDef(MetaData::mdTypeDefList &order)
     //
     for (itOrder = order.begin(); itOrder != order.end(); itOrder++)
     {
+        if (m_profile.size() > 0)
+        {
+            ApplyProfile(m_pr->m_mapDef_Type.find(*itOrder)->second);
+        }
+
         NANOCLR_CHECK_HRESULT(ProcessTypeDef((mdTypeDef)*itOrder));
     }
 
@@ -1582,14 +2003,98 @@ HRESULT WatchAssemblyBuilder::Linker::ProcessTypeDef(mdTypeDef tdIdx)
 
 //--//
 
-HRESULT WatchAssemblyBuilder::Linker::ProcessTypeDef_ByteCode(mdTypeDef tdIdx)
+//
+// Compiling the ByteCode of a method only reads the tables built so far, so types are handed out to one worker per
+// core, each compiling into a buffer of its own. The buffers are then appended to m_tableByteCode in type order,
+// assigning the RVAs, which keeps the output identical to a serial build.
+//
+HRESULT WatchAssemblyBuilder::Linker::ProcessByteCode(MetaData::mdTypeDefList &order)
 {
     NANOCLR_HEADER();
 
-    MetaData::TypeDef &td = m_pr->m_mapDef_Type.find(tdIdx)->second;
+    TypeByteCodeVector types;
+    std::vector<std::thread> workers;
+    LONG volatile next = 0;
+    size_t numWorkers = std::thread::hardware_concurrency();
+
+    for (MetaData::mdTypeDefListIter itOrder = order.begin(); itOrder != order.end(); itOrder++)
+    {
+        TypeByteCode *tbc = new TypeByteCode();
+
+        tbc->m_td = (mdTypeDef)*itOrder;
+        tbc->m_hr = S_OK;
+        tbc->m_numRemovedOpcodes = 0;
+
+        types.push_back(tbc);
+    }
+
+    if (numWorkers > types.size())
+        numWorkers = types.size();
+
+    for (size_t i = 1; i < numWorkers; i++)
+    {
+        workers.push_back(std::thread(&WatchAssemblyBuilder::Linker::CompileByteCode, this, std::ref(types), &next));
+    }
+
+    CompileByteCode(types, &next);
+
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+
+    //--//
+
+    for (TypeByteCodeVectorIter it = types.begin(); it != types.end(); it++)
+    {
+        TypeByteCode &tbc = **it;
+
+        NANOCLR_CHECK_HRESULT(tbc.m_hr);
+
+        for (size_t i = 0; i < tbc.m_methods.size(); i++)
+        {
+            MethodByteCode &mbc = tbc.m_methods[i];
+
+            NANOCLR_CHECK_HRESULT(
+                EmitMethodBody(mbc.m_dst, tbc.m_buffer.GetRecordAt(mbc.m_offset), mbc.m_length, mbc.m_fHasEH));
+        }
+
+        m_numRemovedOpcodes += tbc.m_numRemovedOpcodes;
+    }
+
+    NANOCLR_CLEANUP();
+
+    for (TypeByteCodeVectorIter it = types.begin(); it != types.end(); it++)
+    {
+        delete *it;
+    }
+
+    NANOCLR_CLEANUP_END();
+}
+
+void WatchAssemblyBuilder::Linker::CompileByteCode(TypeByteCodeVector &types, LONG volatile *next)
+{
+    ExceptionHandlerHierarchy lookupEh;
+
+    while (true)
+    {
+        size_t pos = (size_t)(::InterlockedIncrement(next) - 1);
+
+        if (pos >= types.size())
+            break;
+
+        types[pos]->m_hr = ProcessTypeDef_ByteCode(*types[pos], lookupEh);
+    }
+}
+
+HRESULT WatchAssemblyBuilder::Linker::ProcessTypeDef_ByteCode(TypeByteCode &tbc, ExceptionHandlerHierarchy &lookupEh)
+{
+    NANOCLR_HEADER();
+
+    MetaData::TypeDef &td = m_pr->m_mapDef_Type.find(tbc.m_td)->second;
     MetaData::mdMethodDefListIter itMethod;
 
-    CLR_RECORD_TYPEDEF *dst = m_tableTypeDef.GetRecordAt(CLR_DataFromTk(m_lookupIDs[td.m_td]));
+    CLR_RECORD_TYPEDEF *dst = m_tableTypeDef.GetRecordAt(CLR_DataFromTk(m_lookupIDs.find(td.m_td)->second));
 
     //
     // Virtual Methods.
@@ -1606,7 +2111,7 @@ HRESULT WatchAssemblyBuilder::Linker::ProcessTypeDef_ByteCode(mdTypeDef tdIdx)
 
         MetaData::MethodDef &md = itDM->second;
 
-        NANOCLR_CHECK_HRESULT(ProcessMethodDef_ByteCode(td, dst, md, mdVirtual));
+        NANOCLR_CHECK_HRESULT(ProcessMethodDef_ByteCode(td, dst, md, mdVirtual, tbc, lookupEh));
     }
 
     //
@@ -1624,7 +2129,7 @@ HRESULT WatchAssemblyBuilder::Linker::ProcessTypeDef_ByteCode(mdTypeDef tdIdx)
 
         MetaData::MethodDef &md = itDM->second;
 
-        NANOCLR_CHECK_HRESULT(ProcessMethodDef_ByteCode(td, dst, md, 0));
+        NANOCLR_CHECK_HRESULT(ProcessMethodDef_ByteCode(td, dst, md, 0, tbc, lookupEh));
     }
 
     //
@@ -1642,7 +2147,7 @@ HRESULT WatchAssemblyBuilder::Linker::ProcessTypeDef_ByteCode(mdTypeDef tdIdx)
 
         MetaData::MethodDef &md = itDM->second;
 
-        NANOCLR_CHECK_HRESULT(ProcessMethodDef_ByteCode(td, dst, md, mdStatic));
+        NANOCLR_CHECK_HRESULT(ProcessMethodDef_ByteCode(td, dst, md, mdStatic, tbc, lookupEh));
     }
 
     //--//
@@ -1965,6 +2470,11 @@ HRESULT WatchAssemblyBuilder::Linker::ProcessMethodDef(
     }
     else
     {
+        if (m_fCompactLocals && md.m_byteCode.m_opcodes.size() > 0)
+        {
+            NANOCLR_CHECK_HRESULT(CompactLocals(md));
+        }
+
         NANOCLR_CHECK_HRESULT(CheckRange(md.m_vars.m_lstVars, dst->numLocals, L"number", L"locals"));
 
         dst->numLocals = (CLR_UINT8)md.m_vars.m_lstVars.size();
@@ -1985,6 +2495,88 @@ HRESULT WatchAssemblyBuilder::Linker::ProcessMethodDef(
     NANOCLR_CLEANUP_END();
 }
 
+//
+// Greedy assignment of locals to slots, in declaration order: a local joins the first slot holding locals of the same
+// type that are never live at the same time, otherwise it gets a new slot.
+// Slots are numbered in order of creation, so no local ends up at a higher index than before.
+//
+HRESULT WatchAssemblyBuilder::Linker::CompactLocals(MetaData::MethodDef &md)
+{
+    NANOCLR_HEADER();
+
+    size_t numLocals = md.m_vars.m_lstVars.size();
+    MetaData::ByteCode::OpcodeMask interference;
+    MetaData::ByteCode::OpcodeMask excluded;
+    std::vector<MetaData::TypeSignature *> types;
+    std::vector<CLR_UINT32> remap(numLocals);
+    std::vector<size_t> slots;
+    MetaData::TypeSignatureList lstVars;
+    size_t v;
+
+    if (numLocals < 2)
+        NANOCLR_SET_AND_LEAVE(S_OK);
+
+    NANOCLR_CHECK_HRESULT(md.m_byteCode.ComputeLocalInterference(numLocals, interference, excluded));
+
+    for (MetaData::TypeSignatureIter it = md.m_vars.m_lstVars.begin(); it != md.m_vars.m_lstVars.end(); it++)
+    {
+        types.push_back(&(*it));
+    }
+
+    for (v = 0; v < numLocals; v++)
+    {
+        MetaData::TypeSignature &sig = *types[v];
+        bool fFound = false;
+
+        if (!excluded[v] && sig.m_optTypeModifier != ELEMENT_TYPE_PINNED)
+        {
+            for (size_t slot = 0; slot < slots.size() && !fFound; slot++)
+            {
+                MetaData::TypeSignature &sigSlot = *types[slots[slot]];
+
+                if (excluded[slots[slot]] || sigSlot.m_optTypeModifier != sig.m_optTypeModifier || sigSlot != sig)
+                    continue;
+
+                fFound = true;
+
+                for (size_t other = 0; other < v; other++)
+                {
+                    if (remap[other] == slot && interference[v * numLocals + other])
+                    {
+                        fFound = false;
+                        break;
+                    }
+                }
+
+                if (fFound)
+                {
+                    remap[v] = (CLR_UINT32)slot;
+                }
+            }
+        }
+
+        if (!fFound)
+        {
+            remap[v] = (CLR_UINT32)slots.size();
+
+            slots.push_back(v);
+
+            lstVars.push_back(sig);
+        }
+    }
+
+    if (slots.size() < numLocals)
+    {
+        NANOCLR_CHECK_HRESULT(md.m_byteCode.RemapLocals(remap));
+
+        m_numRemovedLocals += numLocals - slots.size();
+
+        md.m_vars.m_lstVars = lstVars;
+    }
+
+    NANOCLR_NOCLEANUP();
+}
+
 void WatchAssemblyBuilder::Linker::DumpSig(CLR_UINT32 token, CLR_UINT16 sig, const BYTE *sigRaw, size_t sigLen)
 {
     printf("%d -> ", token);
@@ -2002,11 +2594,58 @@ void WatchAssemblyBuilder::Linker::DumpSig(CLR_UINT32 token, CLR_UINT16 sig, con
 
 //--//
 
+//
+// The runtime finds the end of a method, and with it the exception handler table, at the RVA of the next method with
+// ByteCode (see CLR_RT_Assembly::FindMethodBoundaries).
+// A method is only folded onto the body emitted right before it, so RVAs never decrease and every body still ends
+// where the next different one starts. The earlier method of the pair sees an empty range in the runtime, so neither
+// method may have exception handlers, their table is found from the end of the range.
+//
+HRESULT WatchAssemblyBuilder::Linker::EmitMethodBody(
+    CLR_RECORD_METHODDEF *dst,
+    const BYTE *body,
+    size_t len,
+    bool fHasEH)
+{
+    NANOCLR_HEADER();
+
+    bool fCanFold = m_fFoldMethods && !fHasEH && !m_fPreviousHasEH && m_previousBody.m_RVA != CLR_EmptyIndex;
+    BYTE *byteCodeDst;
+
+    m_fPreviousHasEH = fHasEH;
+
+    if (fCanFold && m_previousBody.m_length == len &&
+        memcmp(m_tableByteCode.GetRecordAt(m_previousBody.m_RVA), body, len) == 0)
+    {
+        dst->RVA = m_previousBody.m_RVA;
+
+        m_numFoldedMethods++;
+        m_sizeFoldedMethods += len;
+
+        NANOCLR_SET_AND_LEAVE(S_OK);
+    }
+
+    m_previousBody.m_RVA = (CLR_OFFSET)m_tableByteCode.Size();
+    m_previousBody.m_length = len;
+
+    dst->RVA = m_previousBody.m_RVA;
+
+    byteCodeDst = m_tableByteCode.Alloc(len);
+    if (byteCodeDst == NULL)
+        REPORT_NO_MEMORY();
+
+    memcpy(byteCodeDst, body, len);
+
+    NANOCLR_NOCLEANUP();
+}
+
 HRESULT WatchAssemblyBuilder::Linker::ProcessMethodDef_ByteCode(
     MetaData::TypeDef &td,
     CLR_RECORD_TYPEDEF *tdDst,
     MetaData::MethodDef &md,
-    CLR_UINT32 mode)
+    CLR_UINT32 mode,
+    TypeByteCode &tbc,
+    ExceptionHandlerHierarchy &lookupEh)
 {
     NANOCLR_HEADER();
 
@@ -2038,7 +2677,7 @@ HRESULT WatchAssemblyBuilder::Linker::ProcessMethodDef_ByteCode(
 
     //--//
 
-    dst = m_tableMethodDef.GetRecordAt(CLR_DataFromTk(m_lookupIDs[md.m_md]));
+    dst = m_tableMethodDef.GetRecordAt(CLR_DataFromTk(m_lookupIDs.find(md.m_md)->second));
 
     if (m_pr->m_fNoByteCode || (md.m_flags & mdAbstract) || (md.m_implFlags & (miRuntime | miInternalCall)))
     {
@@ -2050,6 +2689,16 @@ HRESULT WatchAssemblyBuilder::Linker::ProcessMethodDef_ByteCode(
         CLR_UINT32 stackDepth;
 
         NANOCLR_CHECK_HRESULT(md.m_byteCode.ConvertTokens(m_lookupIDs));
+
+        if (m_fOptimizeByteCode)
+        {
+            size_t numRemoved;
+
+            NANOCLR_CHECK_HRESULT(md.m_byteCode.Optimize(numRemoved));
+
+            tbc.m_numRemovedOpcodes += numRemoved;
+        }
+
         NANOCLR_CHECK_HRESULT(md.m_byteCode.GenerateOldIL(code));
 
         //--//
@@ -2074,12 +2723,15 @@ HRESULT WatchAssemblyBuilder::Linker::ProcessMethodDef_ByteCode(
         const BYTE *byteCodeSrc = &code[0];
         size_t byteCodeLen = code.size();
         size_t numExceptions = md.m_byteCode.m_exceptions.size();
+        CQuickRecord<BYTE> &body = tbc.m_buffer;
+        MethodByteCode mbc;
 
-        //--//
+        mbc.m_dst = dst;
+        mbc.m_offset = body.Size();
 
-        dst->RVA = (CLR_OFFSET)m_tableByteCode.Size();
+        //--//
 
-        BYTE *byteCodeDst = m_tableByteCode.Alloc(byteCodeLen);
+        BYTE *byteCodeDst = body.Alloc(byteCodeLen);
         if (byteCodeDst == NULL)
             REPORT_NO_MEMORY();
 
@@ -2089,7 +2741,7 @@ HRESULT WatchAssemblyBuilder::Linker::ProcessMethodDef_ByteCode(
 
         if (numExceptions > 0)
         {
-            ExceptionHandlerHierarchy lookupEh;
+            lookupEh.Clear();
 
             dst->flags |= CLR_RECORD_METHODDEF::MD_HasExceptionHandlers;
 
@@ -2144,15 +2796,20 @@ HRESULT WatchAssemblyBuilder::Linker::ProcessMethodDef_ByteCode(
 
                 NANOCLR_CHECK_HRESULT(lookupEh.GenerateOutput(tableEh));
 
-                NANOCLR_CHECK_HRESULT(tableEh.CopyTo(m_tableByteCode, start));
+                NANOCLR_CHECK_HRESULT(tableEh.CopyTo(body, start));
             }
 
-            byteCodeDst = m_tableByteCode.Alloc(1);
+            byteCodeDst = body.Alloc(1);
             if (byteCodeDst == NULL)
                 REPORT_NO_MEMORY();
 
             *byteCodeDst = (BYTE)numExceptions;
         }
+
+        mbc.m_length = body.Size() - mbc.m_offset;
+        mbc.m_fHasEH = numExceptions > 0;
+
+        tbc.m_methods.push_back(mbc);
     }
 
     //--//
@@ -2870,16 +3527,60 @@ HRESULT WatchAssemblyBuilder::Linker::Generate(
     NANOCLR_NOCLEANUP();
 }
 
-HRESULT WatchAssemblyBuilder::Linker::DumpPdbxToken(CLR_XmlUtil &xml, IXMLDOMNodePtr pNodeParent, mdToken tk)
+HRESULT WatchAssemblyBuilder::Linker::DumpPdbxToken(XmlWriter &xml, mdToken tk)
 {
     NANOCLR_HEADER();
 
-    IXMLDOMNodePtr pNodeToken;
-    bool fFound;
+    NANOCLR_CHECK_HRESULT(xml.StartElement("Token"));
+    NANOCLR_CHECK_HRESULT(xml.WriteElementHex("CLR", tk));
+    NANOCLR_CHECK_HRESULT(xml.WriteElementHex("nanoCLR", m_lookupIDs[tk]));
+    NANOCLR_CHECK_HRESULT(xml.EndElement());
+
+    NANOCLR_NOCLEANUP();
+}
+
+HRESULT WatchAssemblyBuilder::Linker::GetPdbxILMap(MetaData::MethodDef &md, std::vector<NanoPdbxBinaryIL> &ilMap)
+{
+    NANOCLR_HEADER();
+
+    int ipDiff = 0;
+
+    ilMap.clear();
+
+    if (md.m_byteCode.m_opcodes.size() > md.m_byteCodeOriginal.m_opcodes.size())
+        NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"Linker error when dumping pdbx: op codes size is different\n");
+
+    //
+    // The peephole optimizer may have removed opcodes, each one remembers where it came from.
+    //
+    for (size_t i = 0; i < md.m_byteCode.m_opcodes.size(); i++)
+    {
+        MetaData::ByteCode::LogicalOpcodeDesc &op = md.m_byteCode.m_opcodes[i];
+
+        if (op.m_originalIndex >= md.m_byteCodeOriginal.m_opcodes.size())
+            NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"Linker error when dumping pdbx: op codes are different\n");
+
+        MetaData::ByteCode::LogicalOpcodeDesc &opOriginal = md.m_byteCodeOriginal.m_opcodes[op.m_originalIndex];
+        int ipDiffNew = opOriginal.m_ipOffset - op.m_ipOffset;
+
+        //
+        // Compacting locals may switch between the short and long forms of the same logical opcode.
+        //
+        if (op.m_ol->m_logicalOpcode != opOriginal.m_ol->m_logicalOpcode || ipDiffNew < ipDiff)
+            NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"Linker error when dumping pdbx: op codes are different\n");
+
+        if (ipDiffNew > ipDiff)
+        {
+            NanoPdbxBinaryIL il;
+
+            ipDiff = ipDiffNew;
 
-    NANOCLR_CHECK_HRESULT(xml.CreateNode(L"Token", &pNodeToken, pNodeParent));
-    NANOCLR_CHECK_HRESULT(xml.PutValue(L"CLR", ToHex(tk), fFound, pNodeToken));
-    NANOCLR_CHECK_HRESULT(xml.PutValue(L"nanoCLR", ToHex(m_lookupIDs[tk]), fFound, pNodeToken));
+            il.ipCLR = opOriginal.m_ipOffset;
+            il.ipNanoCLR = op.m_ipOffset;
+
+            ilMap.push_back(il);
+        }
+    }
 
     NANOCLR_NOCLEANUP();
 }
@@ -2888,40 +3589,39 @@ HRESULT WatchAssemblyBuilder::Linker::DumpPdbx(std::wstring szFileNamePE)
 {
     NANOCLR_HEADER();
 
-    CLR_XmlUtil xml;
-    IXMLDOMNodePtr pNodePDBXFile;
-    IXMLDOMNodePtr pNodeAssembly;
-    IXMLDOMNodePtr pNodeClasses;
-    IXMLDOMNodePtr pNodeVersion;
+    XmlWriter xml;
+    std::vector<NanoPdbxBinaryIL> ilMap;
     std::wstring strFilePdbx;
     std::wstring strAssemblyFile;
-    bool fFound;
 
     if (!m_pr)
         NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"Linker error when dumping pdbx: MDP can't be null\n");
 
     NANOCLR_CHECK_HRESULT(GetFullPath(m_pr->m_assemblyFile, NULL, &strAssemblyFile));
 
-    NANOCLR_CHECK_HRESULT(xml.New(L"PdbxFile"));
-    xml.GetRoot(&pNodePDBXFile);
+    ChangeExtensionOnFileName(szFileNamePE, strFilePdbx, L"pdbx");
+
+    NANOCLR_CHECK_HRESULT(xml.Open(strFilePdbx.c_str()));
+
+    NANOCLR_CHECK_HRESULT(xml.StartElement("PdbxFile"));
 
-    xml.CreateNode(L"Assembly", &pNodeAssembly, pNodePDBXFile);
-    DumpPdbxToken(xml, pNodeAssembly, m_pr->m_tkAsm);
+    NANOCLR_CHECK_HRESULT(xml.StartElement("Assembly"));
+    NANOCLR_CHECK_HRESULT(DumpPdbxToken(xml, m_pr->m_tkAsm));
 
-    xml.PutValue(L"FileName", strAssemblyFile, fFound, pNodeAssembly);
+    NANOCLR_CHECK_HRESULT(xml.WriteElement("FileName", strAssemblyFile));
 
 #ifdef DEBUG
-    xml.PutValue(L"Name", m_pr->m_assemblyName, fFound, pNodeAssembly);
+    NANOCLR_CHECK_HRESULT(xml.WriteElement("Name", m_pr->m_assemblyName));
 #endif
 
-    xml.CreateNode(L"Version", &pNodeVersion, pNodeAssembly);
+    NANOCLR_CHECK_HRESULT(xml.StartElement("Version"));
+    NANOCLR_CHECK_HRESULT(xml.WriteElement("Major", (CLR_UINT32)m_pr->m_version.iMajorVersion));
+    NANOCLR_CHECK_HRESULT(xml.WriteElement("Minor", (CLR_UINT32)m_pr->m_version.iMinorVersion));
+    NANOCLR_CHECK_HRESULT(xml.WriteElement("Build", (CLR_UINT32)m_pr->m_version.iBuildNumber));
+    NANOCLR_CHECK_HRESULT(xml.WriteElement("Revision", (CLR_UINT32)m_pr->m_version.iRevisionNumber));
+    NANOCLR_CHECK_HRESULT(xml.EndElement());
 
-    xml.PutValue(L"Major", _variant_t(m_pr->m_version.iMajorVersion), fFound, pNodeVersion);
-    xml.PutValue(L"Minor", _variant_t(m_pr->m_version.iMinorVersion), fFound, pNodeVersion);
-    xml.PutValue(L"Build", _variant_t(m_pr->m_version.iBuildNumber), fFound, pNodeVersion);
-    xml.PutValue(L"Revision", _variant_t(m_pr->m_version.iRevisionNumber), fFound, pNodeVersion);
-
-    xml.CreateNode(L"Classes", &pNodeClasses, pNodeAssembly);
+    NANOCLR_CHECK_HRESULT(xml.StartElement("Classes"));
 
     for (MetaData::TypeDefMapIter itTypeDef = m_pr->m_mapDef_Type.begin(); itTypeDef != m_pr->m_mapDef_Type.end();
          itTypeDef++)
@@ -2929,102 +3629,243 @@ HRESULT WatchAssemblyBuilder::Linker::DumpPdbx(std::wstring szFileNamePE)
         MetaData::TypeDef &td = itTypeDef->second;
         CLR_RECORD_TYPEDEF *tdCLR = m_tableTypeDef.GetRecordAt(CLR_DataFromTk(m_lookupIDs[td.m_td]));
 
-        IXMLDOMNodePtr pNodeClass;
-        IXMLDOMNodePtr pNodeFields;
-        IXMLDOMNodePtr pNodeMethods;
-
-        xml.CreateNode(L"Class", &pNodeClass, pNodeClasses);
+        NANOCLR_CHECK_HRESULT(xml.StartElement("Class"));
 
 #ifdef DEBUG
-        xml.PutValue(L"Name", td.m_name, fFound, pNodeClass);
+        NANOCLR_CHECK_HRESULT(xml.WriteElement("Name", td.m_name));
 
         switch (tdCLR->flags & CLR_RECORD_TYPEDEF::TD_Semantics_Mask)
         {
             case CLR_RECORD_TYPEDEF::TD_Semantics_ValueType:
-                xml.PutValue(L"IsValueClass", L"true", fFound, pNodeClass);
+                NANOCLR_CHECK_HRESULT(xml.WriteElement("IsValueClass", "true"));
                 break;
 
             case CLR_RECORD_TYPEDEF::TD_Semantics_Enum:
-                xml.PutValue(L"IsEnum", L"true", fFound, pNodeClass);
+                NANOCLR_CHECK_HRESULT(xml.WriteElement("IsEnum", "true"));
                 break;
         }
 #endif
 
-        DumpPdbxToken(xml, pNodeClass, td.m_td);
+        NANOCLR_CHECK_HRESULT(DumpPdbxToken(xml, td.m_td));
 
         //--//
 
-        xml.CreateNode(L"Methods", &pNodeMethods, pNodeClass);
+        NANOCLR_CHECK_HRESULT(xml.StartElement("Methods"));
 
         for (MetaData::mdMethodDefListIter itMethod = td.m_methods.begin(); itMethod != td.m_methods.end(); itMethod++)
         {
             MetaData::MethodDef &md = m_pr->m_mapDef_Method.find(*itMethod)->second;
             CLR_RECORD_METHODDEF *mdCLR = m_tableMethodDef.GetRecordAt(CLR_DataFromTk(m_lookupIDs[md.m_md]));
 
-            IXMLDOMNodePtr pNodeMethod;
-            IXMLDOMNodePtr pNodeILMap;
-            int ipDiff = 0;
+            NANOCLR_CHECK_HRESULT(GetPdbxILMap(md, ilMap));
 
-            if (md.m_byteCode.m_opcodes.size() != md.m_byteCodeOriginal.m_opcodes.size())
-                NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"Linker error when dumping pdbx: op codes size is different\n");
-
-            xml.CreateNode(L"Method", &pNodeMethod, pNodeMethods);
+            NANOCLR_CHECK_HRESULT(xml.StartElement("Method"));
 #ifdef DEBUG
-            xml.PutValue(L"Name", md.m_name, fFound, pNodeMethod);
-            xml.PutValue(L"NumArg", _variant_t(mdCLR->numArgs), fFound, pNodeMethod);
-            xml.PutValue(L"NumLocal", _variant_t(mdCLR->numLocals), fFound, pNodeMethod);
-            xml.PutValue(L"MaxStack", _variant_t(mdCLR->lengthEvalStack), fFound, pNodeMethod);
+            NANOCLR_CHECK_HRESULT(xml.WriteElement("Name", md.m_name));
+            NANOCLR_CHECK_HRESULT(xml.WriteElement("NumArg", (CLR_UINT32)mdCLR->numArgs));
+            NANOCLR_CHECK_HRESULT(xml.WriteElement("NumLocal", (CLR_UINT32)mdCLR->numLocals));
+            NANOCLR_CHECK_HRESULT(xml.WriteElement("MaxStack", (CLR_UINT32)mdCLR->lengthEvalStack));
 #endif
-            DumpPdbxToken(xml, pNodeMethod, md.m_md);
+            NANOCLR_CHECK_HRESULT(DumpPdbxToken(xml, md.m_md));
 
             if (!md.m_byteCode.m_opcodes.size())
             {
-                xml.PutValue(L"HasByteCode", L"false", fFound, pNodeMethod);
+                NANOCLR_CHECK_HRESULT(xml.WriteElement("HasByteCode", "false"));
             }
 
-            xml.CreateNode(L"ILMap", &pNodeILMap, pNodeMethod);
+            NANOCLR_CHECK_HRESULT(xml.StartElement("ILMap"));
 
-            for (size_t i = 0; i < md.m_byteCode.m_opcodes.size(); i++)
+            for (size_t i = 0; i < ilMap.size(); i++)
             {
-                IXMLDOMNodePtr pNodeIL;
-                MetaData::ByteCode::LogicalOpcodeDesc &op = md.m_byteCode.m_opcodes[i];
-                MetaData::ByteCode::LogicalOpcodeDesc &opOriginal = md.m_byteCodeOriginal.m_opcodes[i];
-                int ipDiffNew = opOriginal.m_ipOffset - op.m_ipOffset;
-
-                if (op.m_op != opOriginal.m_op || ipDiffNew < ipDiff)
-                    NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"Linker error when dumping pdbx: op codes are different\n");
-
-                if (ipDiffNew > ipDiff)
-                {
-                    ipDiff = ipDiffNew;
-
-                    xml.CreateNode(L"IL", &pNodeIL, pNodeILMap);
-                    xml.PutValue(L"CLR", ToHex(opOriginal.m_ipOffset), fFound, pNodeIL);
-                    xml.PutValue(L"nanoCLR", ToHex(op.m_ipOffset), fFound, pNodeIL);
-                }
+                NANOCLR_CHECK_HRESULT(xml.StartElement("IL"));
+                NANOCLR_CHECK_HRESULT(xml.WriteElementHex("CLR", ilMap[i].ipCLR));
+                NANOCLR_CHECK_HRESULT(xml.WriteElementHex("nanoCLR", ilMap[i].ipNanoCLR));
+                NANOCLR_CHECK_HRESULT(xml.EndElement());
             }
+
+            NANOCLR_CHECK_HRESULT(xml.EndElement()); // ILMap
+            NANOCLR_CHECK_HRESULT(xml.EndElement()); // Method
         }
 
+        NANOCLR_CHECK_HRESULT(xml.EndElement()); // Methods
+
         //--//
 
-        xml.CreateNode(L"Fields", &pNodeFields, pNodeClass);
+        NANOCLR_CHECK_HRESULT(xml.StartElement("Fields"));
 
         for (MetaData::mdFieldDefListIter itField = td.m_fields.begin(); itField != td.m_fields.end(); itField++)
         {
             MetaData::FieldDef &fd = m_pr->m_mapDef_Field.find(*itField)->second;
-            IXMLDOMNodePtr pNodeField;
 
-            xml.CreateNode(L"Field", &pNodeField, pNodeFields);
+            NANOCLR_CHECK_HRESULT(xml.StartElement("Field"));
 #ifdef DEBUG
-            xml.PutValue(L"Name", fd.m_name, fFound, pNodeField);
+            NANOCLR_CHECK_HRESULT(xml.WriteElement("Name", fd.m_name));
 #endif
-            DumpPdbxToken(xml, pNodeField, fd.m_fd);
+            NANOCLR_CHECK_HRESULT(DumpPdbxToken(xml, fd.m_fd));
+            NANOCLR_CHECK_HRESULT(xml.EndElement()); // Field
         }
+
+        NANOCLR_CHECK_HRESULT(xml.EndElement()); // Fields
+        NANOCLR_CHECK_HRESULT(xml.EndElement()); // Class
     }
 
-    ChangeExtensionOnFileName(szFileNamePE, strFilePdbx, L"pdbx");
+    // closes Classes, Assembly and PdbxFile
+    NANOCLR_CHECK_HRESULT(xml.Close());
+
+    NANOCLR_NOCLEANUP();
+}
+
+static bool local_SortByCLR(const NanoPdbxBinaryToken &left, const NanoPdbxBinaryToken &right)
+{
+    return left.tokenCLR < right.tokenCLR;
+}
+
+static bool local_SortByNanoCLR(const NanoPdbxBinaryToken &left, const NanoPdbxBinaryToken &right)
+{
+    return left.tokenNanoCLR < right.tokenNanoCLR;
+}
+
+static bool local_SortMethods(const NanoPdbxBinaryMethod &left, const NanoPdbxBinaryMethod &right)
+{
+    return left.tokenNanoCLR < right.tokenNanoCLR;
+}
+
+template <typename T>
+static HRESULT local_AppendTable(
+    WatchAssemblyBuilder::CQuickRecord<BYTE> &buf,
+    const std::vector<T> &vec,
+    CLR_UINT32 &offset)
+{
+    NANOCLR_HEADER();
+
+    size_t len = vec.size() * sizeof(T);
+    BYTE *ptr;
+
+    offset = (CLR_UINT32)buf.GetPos();
+
+    if (len)
+    {
+        ptr = buf.Alloc(len);
+        if (ptr == NULL)
+            NANOCLR_SET_AND_LEAVE(CLR_E_OUT_OF_MEMORY);
+
+        memcpy(ptr, &vec[0], len);
+    }
+
+    NANOCLR_NOCLEANUP();
+}
+
+HRESULT WatchAssemblyBuilder::Linker::DumpPdbxBinary(std::wstring szFileNamePE)
+{
+    NANOCLR_HEADER();
+
+    CQuickRecord<BYTE> buf;
+    NanoPdbxBinaryHeader header;
+    std::vector<NanoPdbxBinaryToken> tokensByCLR;
+    std::vector<NanoPdbxBinaryToken> tokensByNanoCLR;
+    std::vector<NanoPdbxBinaryMethod> methods;
+    std::vector<NanoPdbxBinaryIL> ilEntries;
+    std::vector<NanoPdbxBinaryIL> ilMap;
+    std::wstring strFilePdbx;
+    std::wstring strAssemblyFile;
+    std::string strAssemblyFileUTF8;
+    NanoPdbxBinaryToken tk;
+    BYTE *ptr;
+
+    if (!m_pr)
+        NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"Linker error when dumping pdbx: MDP can't be null\n");
+
+    NANOCLR_CHECK_HRESULT(GetFullPath(m_pr->m_assemblyFile, NULL, &strAssemblyFile));
+
+    CLR_RT_UnicodeHelper::ConvertToUTF8(strAssemblyFile, strAssemblyFileUTF8);
+
+    //
+    // Same tokens and IL maps as the XML version.
+    //
+    tk.tokenCLR = m_pr->m_tkAsm;
+    tk.tokenNanoCLR = m_lookupIDs[m_pr->m_tkAsm];
+    tokensByCLR.push_back(tk);
+
+    for (MetaData::TypeDefMapIter itTypeDef = m_pr->m_mapDef_Type.begin(); itTypeDef != m_pr->m_mapDef_Type.end();
+         itTypeDef++)
+    {
+        MetaData::TypeDef &td = itTypeDef->second;
+
+        tk.tokenCLR = td.m_td;
+        tk.tokenNanoCLR = m_lookupIDs[td.m_td];
+        tokensByCLR.push_back(tk);
+
+        for (MetaData::mdMethodDefListIter itMethod = td.m_methods.begin(); itMethod != td.m_methods.end(); itMethod++)
+        {
+            MetaData::MethodDef &md = m_pr->m_mapDef_Method.find(*itMethod)->second;
+            NanoPdbxBinaryMethod method;
+
+            NANOCLR_CHECK_HRESULT(GetPdbxILMap(md, ilMap));
+
+            tk.tokenCLR = md.m_md;
+            tk.tokenNanoCLR = m_lookupIDs[md.m_md];
+            tokensByCLR.push_back(tk);
+
+            method.tokenCLR = tk.tokenCLR;
+            method.tokenNanoCLR = tk.tokenNanoCLR;
+            method.flags = md.m_byteCode.m_opcodes.size() ? NanoPdbxBinaryMethod::FLAGS_HasByteCode : 0;
+            method.firstILEntry = (CLR_UINT32)ilEntries.size();
+            method.numberOfILEntries = (CLR_UINT32)ilMap.size();
+            methods.push_back(method);
+
+            ilEntries.insert(ilEntries.end(), ilMap.begin(), ilMap.end());
+        }
+
+        for (MetaData::mdFieldDefListIter itField = td.m_fields.begin(); itField != td.m_fields.end(); itField++)
+        {
+            tk.tokenCLR = *itField;
+            tk.tokenNanoCLR = m_lookupIDs[*itField];
+            tokensByCLR.push_back(tk);
+        }
+    }
+
+    tokensByNanoCLR = tokensByCLR;
+
+    std::stable_sort(tokensByCLR.begin(), tokensByCLR.end(), local_SortByCLR);
+    std::stable_sort(tokensByNanoCLR.begin(), tokensByNanoCLR.end(), local_SortByNanoCLR);
+    std::stable_sort(methods.begin(), methods.end(), local_SortMethods);
+
+    //--//
+
+    memset(&header, 0, sizeof(header));
+
+    header.magicNumber = NanoPdbxBinaryHeader::MAGIC_NUMBER;
+    header.version = NanoPdbxBinaryHeader::VERSION;
+    header.sizeOfHeader = sizeof(header);
+    header.assemblyToken_CLR = m_pr->m_tkAsm;
+    header.assemblyToken_nanoCLR = m_lookupIDs[m_pr->m_tkAsm];
+    header.assemblyVersion = m_pr->m_version;
+    header.numberOfTokens = (CLR_UINT32)tokensByCLR.size();
+    header.numberOfMethods = (CLR_UINT32)methods.size();
+    header.numberOfILEntries = (CLR_UINT32)ilEntries.size();
+    header.lengthFileName = (CLR_UINT32)strAssemblyFileUTF8.size();
+
+    if (buf.Alloc(sizeof(header)) == NULL)
+        NANOCLR_SET_AND_LEAVE(CLR_E_OUT_OF_MEMORY);
+
+    NANOCLR_CHECK_HRESULT(local_AppendTable(buf, tokensByCLR, header.offsetTokensByCLR));
+    NANOCLR_CHECK_HRESULT(local_AppendTable(buf, tokensByNanoCLR, header.offsetTokensByNanoCLR));
+    NANOCLR_CHECK_HRESULT(local_AppendTable(buf, methods, header.offsetMethods));
+    NANOCLR_CHECK_HRESULT(local_AppendTable(buf, ilEntries, header.offsetILEntries));
+
+    header.offsetFileName = (CLR_UINT32)buf.GetPos();
+
+    ptr = buf.Alloc(strAssemblyFileUTF8.size() + 1);
+    if (ptr == NULL)
+        NANOCLR_SET_AND_LEAVE(CLR_E_OUT_OF_MEMORY);
+
+    memcpy(ptr, strAssemblyFileUTF8.c_str(), strAssemblyFileUTF8.size() + 1);
+
+    memcpy(buf.GetRecordAt(0), &header, sizeof(header));
+
+    ChangeExtensionOnFileName(szFileNamePE, strFilePdbx, L"pdbxb");
 
-    NANOCLR_CHECK_HRESULT(xml.Save(strFilePdbx.c_str()));
+    NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::SaveFile(strFilePdbx.c_str(), (CLR_UINT8 *)buf.Ptr(), (DWORD)buf.GetPos()));
 
     NANOCLR_NOCLEANUP();
 }
@@ -0,0 +1,784 @@
+//
+// Copyright (c) 2017 The nanoFramework project contributors
+// Portions Copyright (c) Microsoft Corporation.  All rights reserved.
+// See LICENSE file in the project root for full license information.
+//
+
+#include "stdafx.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+LPCSTR const WatchAssemblyBuilder::SizeReport::c_Kind_Assembly = "Assembly";
+LPCSTR const WatchAssemblyBuilder::SizeReport::c_Kind_Namespace = "Namespace";
+LPCSTR const WatchAssemblyBuilder::SizeReport::c_Kind_Type = "Type";
+LPCSTR const WatchAssemblyBuilder::SizeReport::c_Kind_Method = "Method";
+LPCSTR const WatchAssemblyBuilder::SizeReport::c_Kind_Reference = "Reference";
+LPCSTR const WatchAssemblyBuilder::SizeReport::c_Kind_Resource = "Resource";
+
+bool WatchAssemblyBuilder::SizeReport::Key::operator<(const Key &r) const
+{
+    int res = m_kind.compare(r.m_kind);
+
+    if (res == 0)
+        res = m_entity.compare(r.m_entity);
+    if (res == 0)
+        res = m_table.compare(r.m_table);
+
+    return res < 0;
+}
+
+void WatchAssemblyBuilder::SizeReport::Charge(LPCSTR szKind, const std::string &entity, LPCSTR szTable, size_t bytes)
+{
+    if (bytes)
+    {
+        Key key;
+
+        key.m_kind = szKind;
+        key.m_entity = entity;
+        key.m_table = szTable;
+
+        m_rows[key] += (CLR_INT64)bytes;
+    }
+}
+
+CLR_INT64 WatchAssemblyBuilder::SizeReport::Total()
+{
+    CLR_INT64 total = 0;
+
+    for (RowMapIter it = m_rows.begin(); it != m_rows.end(); it++)
+    {
+        total += it->second;
+    }
+
+    return total;
+}
+
+bool WatchAssemblyBuilder::SizeReport::SortBySize(const RowMapIter &left, const RowMapIter &right)
+{
+    return left->second > right->second;
+}
+
+bool WatchAssemblyBuilder::SizeReport::SortByDelta(const RowMapIter &left, const RowMapIter &right)
+{
+    return _abs64(left->second) > _abs64(right->second);
+}
+
+void WatchAssemblyBuilder::SizeReport::WriteField(FILE *stream, const std::string &str)
+{
+    if (str.find_first_of(",\"\r\n") == str.npos)
+    {
+        fputs(str.c_str(), stream);
+    }
+    else
+    {
+        fputc('"', stream);
+
+        for (std::string::const_iterator it = str.begin(); it != str.end(); it++)
+        {
+            if (*it == '"')
+                fputc('"', stream);
+
+            fputc(*it, stream);
+        }
+
+        fputc('"', stream);
+    }
+}
+
+//
+// Reads one field and moves past the comma following it, returns false when the line has no more fields.
+//
+bool WatchAssemblyBuilder::SizeReport::ReadField(LPCSTR &ptr, std::string &str)
+{
+    str.clear();
+
+    if (*ptr == 0 || *ptr == '\r' || *ptr == '\n')
+        return false;
+
+    if (*ptr == '"')
+    {
+        ptr++;
+
+        while (*ptr)
+        {
+            if (ptr[0] == '"')
+            {
+                if (ptr[1] != '"')
+                {
+                    ptr++;
+                    break;
+                }
+
+                ptr++;
+            }
+
+            str += *ptr++;
+        }
+    }
+    else
+    {
+        while (*ptr && *ptr != ',' && *ptr != '\r' && *ptr != '\n')
+        {
+            str += *ptr++;
+        }
+    }
+
+    if (*ptr == ',')
+        ptr++;
+
+    return true;
+}
+
+HRESULT WatchAssemblyBuilder::SizeReport::Save(const std::wstring &file)
+{
+    NANOCLR_HEADER();
+
+    std::vector<RowMapIter> rows;
+    FILE *stream;
+
+    if (_wfopen_s(&stream, file.c_str(), L"w") != 0)
+    {
+        NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FILE_IO, L"Cannot open '%s' for writing!\n", file.c_str());
+    }
+
+    for (RowMapIter it = m_rows.begin(); it != m_rows.end(); it++)
+    {
+        rows.push_back(it);
+    }
+
+    // biggest first, the map order breaks the ties so the output is stable
+    std::stable_sort(rows.begin(), rows.end(), SortBySize);
+
+    fprintf(stream, "Kind,Entity,Table,Bytes\n");
+
+    for (std::vector<RowMapIter>::iterator it = rows.begin(); it != rows.end(); it++)
+    {
+        const Key &key = (*it)->first;
+
+        WriteField(stream, key.m_kind);
+        fputc(',', stream);
+        WriteField(stream, key.m_entity);
+        fputc(',', stream);
+        WriteField(stream, key.m_table);
+        fprintf(stream, ",%lld\n", (*it)->second);
+    }
+
+    fclose(stream);
+
+    NANOCLR_NOCLEANUP();
+}
+
+HRESULT WatchAssemblyBuilder::SizeReport::Load(const std::wstring &file)
+{
+    NANOCLR_HEADER();
+
+    CLR_RT_Buffer buffer;
+    LPCSTR ptr;
+    bool fHeader = true;
+
+    NANOCLR_CHECK_HRESULT(CLR_RT_FileStore::LoadFile(file.c_str(), buffer));
+
+    buffer.push_back(0);
+    ptr = (LPCSTR)&buffer[0];
+
+    while (*ptr)
+    {
+        Key key;
+        std::string bytes;
+
+        if (ReadField(ptr, key.m_kind) && ReadField(ptr, key.m_entity) && ReadField(ptr, key.m_table) &&
+            ReadField(ptr, bytes) && !fHeader)
+        {
+            m_rows[key] += _strtoi64(bytes.c_str(), NULL, 10);
+        }
+
+        fHeader = false;
+
+        while (*ptr && *ptr != '\n')
+            ptr++;
+        if (*ptr == '\n')
+            ptr++;
+    }
+
+    NANOCLR_NOCLEANUP();
+}
+
+HRESULT WatchAssemblyBuilder::SizeReport::Diff(
+    const std::wstring &fileOld,
+    const std::wstring &fileNew,
+    const std::wstring &fileOut)
+{
+    NANOCLR_HEADER();
+
+    SizeReport reportOld;
+    SizeReport reportNew;
+    RowMap rows;
+    std::vector<RowMapIter> changed;
+    FILE *stream;
+
+    NANOCLR_CHECK_HRESULT(reportOld.Load(fileOld));
+    NANOCLR_CHECK_HRESULT(reportNew.Load(fileNew));
+
+    // rows[key] holds the delta, the old and new sizes are looked up again when writing
+    for (RowMapIter it = reportOld.m_rows.begin(); it != reportOld.m_rows.end(); it++)
+    {
+        rows[it->first] -= it->second;
+    }
+
+    for (RowMapIter it = reportNew.m_rows.begin(); it != reportNew.m_rows.end(); it++)
+    {
+        rows[it->first] += it->second;
+    }
+
+    for (RowMapIter it = rows.begin(); it != rows.end(); it++)
+    {
+        if (it->second)
+        {
+            changed.push_back(it);
+        }
+    }
+
+    std::stable_sort(changed.begin(), changed.end(), SortByDelta);
+
+    if (_wfopen_s(&stream, fileOut.c_str(), L"w") != 0)
+    {
+        NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FILE_IO, L"Cannot open '%s' for writing!\n", fileOut.c_str());
+    }
+
+    fprintf(stream, "Kind,Entity,Table,Old,New,Delta\n");
+
+    for (std::vector<RowMapIter>::iterator it = changed.begin(); it != changed.end(); it++)
+    {
+        const Key &key = (*it)->first;
+        RowMapIter itOld = reportOld.m_rows.find(key);
+        RowMapIter itNew = reportNew.m_rows.find(key);
+
+        WriteField(stream, key.m_kind);
+        fputc(',', stream);
+        WriteField(stream, key.m_entity);
+        fputc(',', stream);
+        WriteField(stream, key.m_table);
+        fprintf(
+            stream,
+            ",%lld,%lld,%lld\n",
+            itOld != reportOld.m_rows.end() ? itOld->second : 0,
+            itNew != reportNew.m_rows.end() ? itNew->second : 0,
+            (*it)->second);
+    }
+
+    fclose(stream);
+
+    wprintf(
+        L"Size: %lld -> %lld byte(s) (%+lld), %d row(s) changed\n",
+        reportOld.Total(),
+        reportNew.Total(),
+        reportNew.Total() - reportOld.Total(),
+        (int)changed.size());
+
+    NANOCLR_NOCLEANUP();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//
+// A range of a blob table owned by one entity. Without a length the range runs up to the next one, where several
+// entities share the same data the first one queued gets charged.
+//
+struct SizeReportChunk
+{
+    CLR_UINT32 m_offset;
+    CLR_UINT32 m_length;
+    LPCSTR m_kind;
+    std::string m_entity;
+};
+
+typedef std::vector<SizeReportChunk> SizeReportChunkVector;
+
+static bool local_SortChunks(const SizeReportChunk &left, const SizeReportChunk &right)
+{
+    return left.m_offset < right.m_offset;
+}
+
+static void local_QueueChunk(
+    SizeReportChunkVector &chunks,
+    CLR_UINT32 offset,
+    CLR_UINT32 length,
+    LPCSTR szKind,
+    const std::string &entity)
+{
+    SizeReportChunk chunk;
+
+    chunk.m_offset = offset;
+    chunk.m_length = length;
+    chunk.m_kind = szKind;
+    chunk.m_entity = entity;
+
+    chunks.push_back(chunk);
+}
+
+static void local_QueueString(
+    SizeReportChunkVector &chunks,
+    WatchAssemblyBuilder::CQuickRecord<CHAR> &tbl,
+    CLR_STRING idx,
+    LPCSTR szKind,
+    const std::string &entity)
+{
+    // strings coming from the global table take no space in the assembly
+    if (idx < tbl.Size())
+    {
+        LPCSTR sz = tbl.GetRecordAt(idx);
+
+        local_QueueChunk(chunks, idx, (CLR_UINT32)hal_strlen_s(sz) + 1, szKind, entity);
+    }
+}
+
+static void local_QueueSignature(
+    SizeReportChunkVector &chunks,
+    CLR_SIG idx,
+    LPCSTR szKind,
+    const std::string &entity)
+{
+    if (idx != CLR_EmptyIndex)
+    {
+        local_QueueChunk(chunks, idx, 0, szKind, entity);
+    }
+}
+
+//
+// Whatever no chunk covers, like user strings or alignment, is charged to the assembly itself.
+//
+static void local_ChargeChunks(
+    WatchAssemblyBuilder::SizeReport &report,
+    SizeReportChunkVector &chunks,
+    size_t tableSize,
+    LPCSTR szTable,
+    const std::string &assembly)
+{
+    std::vector<size_t> next(chunks.size());
+    size_t pos = 0;
+
+    std::stable_sort(chunks.begin(), chunks.end(), local_SortChunks);
+
+    for (size_t i = chunks.size(); i-- > 0;)
+    {
+        if (i + 1 == chunks.size())
+            next[i] = tableSize;
+        else if (chunks[i + 1].m_offset > chunks[i].m_offset)
+            next[i] = chunks[i + 1].m_offset;
+        else
+            next[i] = next[i + 1];
+    }
+
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        SizeReportChunk &chunk = chunks[i];
+        size_t end = chunk.m_length ? chunk.m_offset + chunk.m_length : next[i];
+
+        if (chunk.m_offset >= tableSize)
+            continue;
+
+        if (end > tableSize)
+            end = tableSize;
+
+        if (chunk.m_offset > pos)
+        {
+            report.Charge(WatchAssemblyBuilder::SizeReport::c_Kind_Assembly, assembly, szTable, chunk.m_offset - pos);
+
+            pos = chunk.m_offset;
+        }
+
+        if (end > pos)
+        {
+            report.Charge(chunk.m_kind, chunk.m_entity, szTable, end - pos);
+
+            pos = end;
+        }
+    }
+
+    if (tableSize > pos)
+    {
+        report.Charge(WatchAssemblyBuilder::SizeReport::c_Kind_Assembly, assembly, szTable, tableSize - pos);
+    }
+}
+
+static bool local_SortByRVA(const std::pair<CLR_OFFSET, size_t> &left, const std::pair<CLR_OFFSET, size_t> &right)
+{
+    return left.first < right.first;
+}
+
+static void local_TypeName(MetaData::Parser &pr, mdTypeDef tk, std::wstring &name)
+{
+    MetaData::TypeDefMapIter it = pr.m_mapDef_Type.find(tk);
+
+    if (it == pr.m_mapDef_Type.end())
+        return;
+
+    MetaData::TypeDef &td = it->second;
+
+    if (!IsNilToken(td.m_enclosingClass))
+    {
+        local_TypeName(pr, td.m_enclosingClass, name);
+
+        name += L"+";
+    }
+
+    name += td.m_name;
+}
+
+//
+// Maps every nanoCLR token of the assembly to the entity its records are charged to: fields go to their type,
+// references to the name of what they point to.
+//
+void WatchAssemblyBuilder::Linker::SizeReport_Names(std::map<CLR_UINT32, std::string> &names)
+{
+    std::wstring name;
+
+    for (MetaData::mdTokenMapIter it = m_lookupIDs.begin(); it != m_lookupIDs.end(); it++)
+    {
+        mdToken tk = it->first;
+
+        name.clear();
+
+        switch (TypeFromToken(tk))
+        {
+            case mdtTypeDef:
+                local_TypeName(*m_pr, tk, name);
+                break;
+
+            case mdtFieldDef:
+            {
+                MetaData::FieldDefMapIter itFD = m_pr->m_mapDef_Field.find(tk);
+
+                if (itFD != m_pr->m_mapDef_Field.end())
+                {
+                    local_TypeName(*m_pr, itFD->second.m_td, name);
+                }
+                break;
+            }
+
+            case mdtMethodDef:
+            {
+                MetaData::MethodDefMapIter itMD = m_pr->m_mapDef_Method.find(tk);
+
+                if (itMD != m_pr->m_mapDef_Method.end())
+                {
+                    local_TypeName(*m_pr, itMD->second.m_td, name);
+
+                    name += L"::";
+                    name += itMD->second.m_name;
+                }
+                break;
+            }
+
+            case mdtAssemblyRef:
+            {
+                MetaData::AssemblyRefMapIter itAR = m_pr->m_mapRef_Assembly.find(tk);
+
+                if (itAR != m_pr->m_mapRef_Assembly.end())
+                {
+                    name = itAR->second.m_name;
+                }
+                break;
+            }
+
+            case mdtTypeRef:
+            {
+                MetaData::TypeRefMapIter itTR = m_pr->m_mapRef_Type.find(tk);
+
+                if (itTR != m_pr->m_mapRef_Type.end())
+                {
+                    name = itTR->second.m_name;
+                }
+                break;
+            }
+
+            case mdtMemberRef:
+            {
+                MetaData::MemberRefMapIter itMR = m_pr->m_mapRef_Member.find(tk);
+
+                if (itMR != m_pr->m_mapRef_Member.end())
+                {
+                    MetaData::TypeRefMapIter itTR = m_pr->m_mapRef_Type.find(itMR->second.m_tr);
+
+                    if (itTR != m_pr->m_mapRef_Type.end())
+                    {
+                        name = itTR->second.m_name;
+                    }
+
+                    name += L"::";
+                    name += itMR->second.m_name;
+                }
+                break;
+            }
+
+            default:
+                continue;
+        }
+
+        CLR_RT_UnicodeHelper::ConvertToUTF8(name, names[it->second]);
+    }
+}
+
+//
+// Every byte of the image generated by Generate is charged to exactly one row: records to the entity they describe,
+// blobs to the first entity referencing them and padding, header and unreferenced data to the assembly.
+//
+HRESULT WatchAssemblyBuilder::Linker::DumpSizeReport(const std::wstring &file, CQuickRecord<BYTE> &buf)
+{
+    NANOCLR_HEADER();
+
+    SizeReport report;
+    std::map<CLR_UINT32, std::string> names;
+    SizeReportChunkVector strings;
+    SizeReportChunkVector signatures;
+    SizeReportChunkVector resourceData;
+    std::vector<std::pair<CLR_OFFSET, size_t>> byteCode;
+    const CLR_RECORD_ASSEMBLY *header;
+    std::string assembly;
+    size_t padding = 0;
+    size_t i;
+
+    if (!m_pr)
+        NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"Linker error when dumping size report: MDP can't be null\n");
+
+    if (buf.Size() < sizeof(CLR_RECORD_ASSEMBLY))
+        NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"Linker error when dumping size report: nothing generated\n");
+
+    header = (const CLR_RECORD_ASSEMBLY *)buf.GetRecordAt(0);
+
+    CLR_RT_UnicodeHelper::ConvertToUTF8(m_pr->m_assemblyName, assembly);
+
+    SizeReport_Names(names);
+
+#define SIZEREPORT_NAME(tbl, idx) names[CLR_TkFromType(tbl, (CLR_UINT32)(idx))]
+
+    report.Charge(SizeReport::c_Kind_Assembly, assembly, "Header", sizeof(CLR_RECORD_ASSEMBLY));
+    local_QueueString(strings, m_tableString, header->assemblyName, SizeReport::c_Kind_Assembly, assembly);
+
+    for (int tbl = 0; tbl < TBL_EndOfAssembly; tbl++)
+    {
+        padding += header->paddingOfTables[tbl];
+    }
+
+    report.Charge(SizeReport::c_Kind_Assembly, assembly, "Padding", padding);
+
+    //--//
+
+    for (i = 0; i < m_tableTypeDef.Size() / sizeof(CLR_RECORD_TYPEDEF); i++)
+    {
+        CLR_RECORD_TYPEDEF *td = m_tableTypeDef.GetRecordAt(i);
+        std::string &name = SIZEREPORT_NAME(TBL_TypeDef, i);
+
+        report.Charge(SizeReport::c_Kind_Type, name, "TypeDef", sizeof(CLR_RECORD_TYPEDEF));
+        local_QueueString(strings, m_tableString, td->name, SizeReport::c_Kind_Type, name);
+        local_QueueSignature(signatures, td->interfaces, SizeReport::c_Kind_Type, name);
+
+        if (td->nameSpace < m_tableString.Size())
+        {
+            LPCSTR szNameSpace = m_tableString.GetRecordAt(td->nameSpace);
+
+            local_QueueString(strings, m_tableString, td->nameSpace, SizeReport::c_Kind_Namespace, szNameSpace);
+        }
+    }
+
+    for (i = 0; i < m_tableMethodDef.Size() / sizeof(CLR_RECORD_METHODDEF); i++)
+    {
+        CLR_RECORD_METHODDEF *md = m_tableMethodDef.GetRecordAt(i);
+        std::string &name = SIZEREPORT_NAME(TBL_MethodDef, i);
+
+        report.Charge(SizeReport::c_Kind_Method, name, "MethodDef", sizeof(CLR_RECORD_METHODDEF));
+        local_QueueString(strings, m_tableString, md->name, SizeReport::c_Kind_Method, name);
+        local_QueueSignature(signatures, md->sig, SizeReport::c_Kind_Method, name);
+        local_QueueSignature(signatures, md->locals, SizeReport::c_Kind_Method, name);
+
+        if (md->RVA != CLR_EmptyIndex)
+        {
+            byteCode.push_back(std::pair<CLR_OFFSET, size_t>(md->RVA, i));
+        }
+    }
+
+    for (i = 0; i < m_tableFieldDef.Size() / sizeof(CLR_RECORD_FIELDDEF); i++)
+    {
+        CLR_RECORD_FIELDDEF *fd = m_tableFieldDef.GetRecordAt(i);
+        std::string &name = SIZEREPORT_NAME(TBL_FieldDef, i);
+
+        report.Charge(SizeReport::c_Kind_Type, name, "FieldDef", sizeof(CLR_RECORD_FIELDDEF));
+        local_QueueString(strings, m_tableString, fd->name, SizeReport::c_Kind_Type, name);
+        local_QueueSignature(signatures, fd->sig, SizeReport::c_Kind_Type, name);
+        local_QueueSignature(signatures, fd->defaultValue, SizeReport::c_Kind_Type, name);
+    }
+
+    for (i = 0; i < m_tableAttribute.Size() / sizeof(CLR_RECORD_ATTRIBUTE); i++)
+    {
+        CLR_RECORD_ATTRIBUTE *attr = m_tableAttribute.GetRecordAt(i);
+        LPCSTR szKind = (attr->ownerType == TBL_MethodDef) ? SizeReport::c_Kind_Method : SizeReport::c_Kind_Type;
+        std::string &name = SIZEREPORT_NAME(attr->ownerType, attr->ownerIdx);
+
+        report.Charge(szKind, name, "Attributes", sizeof(CLR_RECORD_ATTRIBUTE));
+        local_QueueSignature(signatures, attr->data, szKind, name);
+    }
+
+    //--//
+
+    for (i = 0; i < m_tableAssemblyRef.Size() / sizeof(CLR_RECORD_ASSEMBLYREF); i++)
+    {
+        CLR_RECORD_ASSEMBLYREF *ar = m_tableAssemblyRef.GetRecordAt(i);
+        std::string &name = SIZEREPORT_NAME(TBL_AssemblyRef, i);
+
+        report.Charge(SizeReport::c_Kind_Reference, name, "AssemblyRef", sizeof(CLR_RECORD_ASSEMBLYREF));
+        local_QueueString(strings, m_tableString, ar->name, SizeReport::c_Kind_Reference, name);
+    }
+
+    for (i = 0; i < m_tableTypeRef.Size() / sizeof(CLR_RECORD_TYPEREF); i++)
+    {
+        CLR_RECORD_TYPEREF *tr = m_tableTypeRef.GetRecordAt(i);
+        std::string &name = SIZEREPORT_NAME(TBL_TypeRef, i);
+
+        report.Charge(SizeReport::c_Kind_Reference, name, "TypeRef", sizeof(CLR_RECORD_TYPEREF));
+        local_QueueString(strings, m_tableString, tr->name, SizeReport::c_Kind_Reference, name);
+        local_QueueString(strings, m_tableString, tr->nameSpace, SizeReport::c_Kind_Reference, name);
+    }
+
+    for (i = 0; i < m_tableFieldRef.Size() / sizeof(CLR_RECORD_FIELDREF); i++)
+    {
+        CLR_RECORD_FIELDREF *fr = m_tableFieldRef.GetRecordAt(i);
+        std::string &name = SIZEREPORT_NAME(TBL_FieldRef, i);
+
+        report.Charge(SizeReport::c_Kind_Reference, name, "FieldRef", sizeof(CLR_RECORD_FIELDREF));
+        local_QueueString(strings, m_tableString, fr->name, SizeReport::c_Kind_Reference, name);
+        local_QueueSignature(signatures, fr->sig, SizeReport::c_Kind_Reference, name);
+    }
+
+    for (i = 0; i < m_tableMethodRef.Size() / sizeof(CLR_RECORD_METHODREF); i++)
+    {
+        CLR_RECORD_METHODREF *mr = m_tableMethodRef.GetRecordAt(i);
+        std::string &name = SIZEREPORT_NAME(TBL_MethodRef, i);
+
+        report.Charge(SizeReport::c_Kind_Reference, name, "MethodRef", sizeof(CLR_RECORD_METHODREF));
+        local_QueueString(strings, m_tableString, mr->name, SizeReport::c_Kind_Reference, name);
+        local_QueueSignature(signatures, mr->sig, SizeReport::c_Kind_Reference, name);
+    }
+
+    for (i = 0; i < m_tableTypeSpec.Size() / sizeof(CLR_RECORD_TYPESPEC); i++)
+    {
+        CLR_RECORD_TYPESPEC *ts = m_tableTypeSpec.GetRecordAt(i);
+
+        report.Charge(SizeReport::c_Kind_Assembly, assembly, "TypeSpec", sizeof(CLR_RECORD_TYPESPEC));
+        local_QueueSignature(signatures, ts->sig, SizeReport::c_Kind_Assembly, assembly);
+    }
+
+    //--//
+
+    {
+        size_t numFiles = m_tableResourceFile.Size() / sizeof(CLR_RECORD_RESOURCE_FILE);
+        size_t numResources = m_tableResource.Size() / sizeof(CLR_RECORD_RESOURCE);
+        char rgBuffer[32];
+
+        for (size_t iFile = 0; iFile < numFiles; iFile++)
+        {
+            CLR_RECORD_RESOURCE_FILE *rf = m_tableResourceFile.GetRecordAt(iFile);
+            size_t end = (iFile + 1 < numFiles) ? m_tableResourceFile.GetRecordAt(iFile + 1)->offset : numResources - 1;
+            std::string file;
+
+            if (rf->name < m_tableString.Size())
+            {
+                file = m_tableString.GetRecordAt(rf->name);
+            }
+
+            report.Charge(SizeReport::c_Kind_Resource, file, "ResourcesFiles", sizeof(CLR_RECORD_RESOURCE_FILE));
+            local_QueueString(strings, m_tableString, rf->name, SizeReport::c_Kind_Resource, file);
+
+            for (i = rf->offset; i < end && i + 1 < numResources; i++)
+            {
+                CLR_RECORD_RESOURCE *res = m_tableResource.GetRecordAt(i);
+                CLR_RECORD_RESOURCE *resNext = m_tableResource.GetRecordAt(i + 1);
+                CLR_UINT32 endData = resNext->offset - (resNext->flags & CLR_RECORD_RESOURCE::FLAGS_PaddingMask);
+
+                sprintf_s(rgBuffer, ARRAYSIZE(rgBuffer), ":%d", res->id);
+
+                report.Charge(SizeReport::c_Kind_Resource, file + rgBuffer, "Resources", sizeof(CLR_RECORD_RESOURCE));
+
+                if (endData > res->offset)
+                {
+                    local_QueueChunk(
+                        resourceData,
+                        res->offset,
+                        endData - res->offset,
+                        SizeReport::c_Kind_Resource,
+                        file + rgBuffer);
+                }
+            }
+        }
+
+        // the sentinel closing the table
+        if (numResources)
+        {
+            report.Charge(SizeReport::c_Kind_Assembly, assembly, "Resources", sizeof(CLR_RECORD_RESOURCE));
+        }
+    }
+
+    //--//
+
+    //
+    // Methods folded together share the same body, the first one in the table pays for it. The exception handlers
+    // sit at the end of the body, followed by their count.
+    //
+    std::stable_sort(byteCode.begin(), byteCode.end(), local_SortByRVA);
+
+    report.Charge(
+        SizeReport::c_Kind_Assembly,
+        assembly,
+        "ByteCode",
+        byteCode.empty() ? m_tableByteCode.Size() : byteCode[0].first);
+
+    for (i = 0; i < byteCode.size(); i++)
+    {
+        CLR_RECORD_METHODDEF *md = m_tableMethodDef.GetRecordAt(byteCode[i].second);
+        size_t start = byteCode[i].first;
+        size_t end = m_tableByteCode.Size();
+        size_t sizeEH = 0;
+
+        if (i > 0 && byteCode[i - 1].first == start)
+            continue;
+
+        for (size_t j = i + 1; j < byteCode.size(); j++)
+        {
+            if (byteCode[j].first != start)
+            {
+                end = byteCode[j].first;
+                break;
+            }
+        }
+
+        if (end <= start)
+            continue;
+
+        if (md->flags & CLR_RECORD_METHODDEF::MD_HasExceptionHandlers)
+        {
+            sizeEH = 1 + *m_tableByteCode.GetRecordAt(end - 1) * sizeof(CLR_RECORD_EH);
+
+            if (sizeEH > end - start)
+                sizeEH = end - start;
+        }
+
+        std::string &name = SIZEREPORT_NAME(TBL_MethodDef, byteCode[i].second);
+
+        report.Charge(SizeReport::c_Kind_Method, name, "ByteCode", end - start - sizeEH);
+        report.Charge(SizeReport::c_Kind_Method, name, "EH", sizeEH);
+    }
+
+#undef SIZEREPORT_NAME
+
+    local_ChargeChunks(report, strings, m_tableString.Size(), "Strings", assembly);
+    local_ChargeChunks(report, signatures, m_tableSignature.Size(), "Signatures", assembly);
+    local_ChargeChunks(report, resourceData, m_tableResourceData.Size(), "ResourcesData", assembly);
+
+    if (report.Total() != (CLR_INT64)buf.Size())
+    {
+        wprintf(L"Warning: size report covers %lld byte(s) out of %d\n", report.Total(), (int)buf.Size());
+    }
+
+    NANOCLR_CHECK_HRESULT(report.Save(file));
+
+    NANOCLR_NOCLEANUP();
+}
@@ -0,0 +1,295 @@
+//
+// Copyright (c) 2017 The nanoFramework project contributors
+// Portions Copyright (c) Microsoft Corporation.  All rights reserved.
+// See LICENSE file in the project root for full license information.
+//
+
+#include "stdafx.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool local_CompareCLR(const NanoPdbxBinaryToken &left, CLR_UINT32 tk)
+{
+    return left.tokenCLR < tk;
+}
+
+static bool local_CompareNanoCLR(const NanoPdbxBinaryToken &left, CLR_UINT32 tk)
+{
+    return left.tokenNanoCLR < tk;
+}
+
+static bool local_CompareMethod(const NanoPdbxBinaryMethod &left, CLR_UINT32 tk)
+{
+    return left.tokenNanoCLR < tk;
+}
+
+static bool local_CompareIPCLR(CLR_UINT32 ip, const NanoPdbxBinaryIL &right)
+{
+    return ip < right.ipCLR;
+}
+
+static bool local_CompareIPNanoCLR(CLR_UINT32 ip, const NanoPdbxBinaryIL &right)
+{
+    return ip < right.ipNanoCLR;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+WatchAssemblyBuilder::PdbxBinaryReader::PdbxBinaryReader()
+{
+    m_hFile = INVALID_HANDLE_VALUE; // HANDLE                      m_hFile;
+    m_hMapping = NULL;              // HANDLE                      m_hMapping;
+                                    //
+    m_data = NULL;                  // const CLR_UINT8*            m_data;
+    m_size = 0;                     // size_t                      m_size;
+                                    //
+    m_header = NULL;                // const NanoPdbxBinaryHeader* m_header;
+    m_tokensByCLR = NULL;           // const NanoPdbxBinaryToken*  m_tokensByCLR;
+    m_tokensByNanoCLR = NULL;       // const NanoPdbxBinaryToken*  m_tokensByNanoCLR;
+    m_methods = NULL;               // const NanoPdbxBinaryMethod* m_methods;
+    m_ilEntries = NULL;             // const NanoPdbxBinaryIL*     m_ilEntries;
+}
+
+WatchAssemblyBuilder::PdbxBinaryReader::~PdbxBinaryReader()
+{
+    Close();
+}
+
+HRESULT WatchAssemblyBuilder::PdbxBinaryReader::Open(LPCWSTR szFile)
+{
+    NANOCLR_HEADER();
+
+    LARGE_INTEGER size;
+    const void *view;
+
+    Close();
+
+    m_hFile = ::CreateFileW(szFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        NANOCLR_MSG1_SET_AND_LEAVE(CLR_E_FILE_IO, L"Cannot open '%s'\n", szFile);
+    }
+
+    if (::GetFileSizeEx(m_hFile, &size) == FALSE || size.QuadPart < (LONGLONG)sizeof(NanoPdbxBinaryHeader))
+    {
+        NANOCLR_SET_AND_LEAVE(CLR_E_FILE_IO);
+    }
+
+    m_hMapping = ::CreateFileMappingW(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_hMapping == NULL)
+    {
+        NANOCLR_SET_AND_LEAVE(CLR_E_FILE_IO);
+    }
+
+    view = ::MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == NULL)
+    {
+        NANOCLR_SET_AND_LEAVE(CLR_E_FILE_IO);
+    }
+
+    NANOCLR_CHECK_HRESULT(Attach(view, (size_t)size.QuadPart));
+
+    NANOCLR_CLEANUP();
+
+    if (FAILED(hr))
+    {
+        Close();
+    }
+
+    NANOCLR_CLEANUP_END();
+}
+
+HRESULT WatchAssemblyBuilder::PdbxBinaryReader::Attach(const void *data, size_t size)
+{
+    NANOCLR_HEADER();
+
+    const NanoPdbxBinaryHeader *header = (const NanoPdbxBinaryHeader *)data;
+
+    m_data = (const CLR_UINT8 *)data;
+    m_size = size;
+
+    if (size < sizeof(NanoPdbxBinaryHeader) || header->magicNumber != NanoPdbxBinaryHeader::MAGIC_NUMBER ||
+        header->version != NanoPdbxBinaryHeader::VERSION || header->sizeOfHeader != sizeof(NanoPdbxBinaryHeader))
+    {
+        NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"Invalid binary pdbx format\n");
+    }
+
+    if (VerifyTable(header->offsetTokensByCLR, header->numberOfTokens, sizeof(NanoPdbxBinaryToken)) == false ||
+        VerifyTable(header->offsetTokensByNanoCLR, header->numberOfTokens, sizeof(NanoPdbxBinaryToken)) == false ||
+        VerifyTable(header->offsetMethods, header->numberOfMethods, sizeof(NanoPdbxBinaryMethod)) == false ||
+        VerifyTable(header->offsetILEntries, header->numberOfILEntries, sizeof(NanoPdbxBinaryIL)) == false ||
+        VerifyTable(header->offsetFileName, header->lengthFileName + 1, sizeof(CHAR)) == false)
+    {
+        NANOCLR_MSG_SET_AND_LEAVE(CLR_E_FAIL, L"Binary pdbx is truncated\n");
+    }
+
+    m_header = header;
+    m_tokensByCLR = (const NanoPdbxBinaryToken *)&m_data[header->offsetTokensByCLR];
+    m_tokensByNanoCLR = (const NanoPdbxBinaryToken *)&m_data[header->offsetTokensByNanoCLR];
+    m_methods = (const NanoPdbxBinaryMethod *)&m_data[header->offsetMethods];
+    m_ilEntries = (const NanoPdbxBinaryIL *)&m_data[header->offsetILEntries];
+
+    NANOCLR_NOCLEANUP();
+}
+
+void WatchAssemblyBuilder::PdbxBinaryReader::Close()
+{
+    if (m_hMapping)
+    {
+        if (m_data)
+        {
+            ::UnmapViewOfFile(m_data);
+        }
+
+        ::CloseHandle(m_hMapping);
+
+        m_hMapping = NULL;
+    }
+
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        ::CloseHandle(m_hFile);
+
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+
+    m_data = NULL;
+    m_size = 0;
+
+    m_header = NULL;
+    m_tokensByCLR = NULL;
+    m_tokensByNanoCLR = NULL;
+    m_methods = NULL;
+    m_ilEntries = NULL;
+}
+
+bool WatchAssemblyBuilder::PdbxBinaryReader::VerifyTable(CLR_UINT32 offset, CLR_UINT32 num, size_t size) const
+{
+    return offset <= m_size && (CLR_UINT64)num * size <= m_size - offset;
+}
+
+//--//
+
+const NanoPdbxBinaryHeader *WatchAssemblyBuilder::PdbxBinaryReader::GetHeader() const
+{
+    return m_header;
+}
+
+LPCSTR WatchAssemblyBuilder::PdbxBinaryReader::GetFileName() const
+{
+    return m_header ? (LPCSTR)&m_data[m_header->offsetFileName] : NULL;
+}
+
+const NanoPdbxBinaryMethod *WatchAssemblyBuilder::PdbxBinaryReader::FindMethod(CLR_UINT32 tkNanoCLR) const
+{
+    if (m_header == NULL)
+        return NULL;
+
+    const NanoPdbxBinaryMethod *end = m_methods + m_header->numberOfMethods;
+    const NanoPdbxBinaryMethod *it = std::lower_bound(m_methods, end, tkNanoCLR, local_CompareMethod);
+
+    if (it == end || it->tokenNanoCLR != tkNanoCLR)
+        return NULL;
+
+    if ((CLR_UINT64)it->firstILEntry + it->numberOfILEntries > m_header->numberOfILEntries)
+        return NULL;
+
+    return it;
+}
+
+bool WatchAssemblyBuilder::PdbxBinaryReader::TokenToCLR(CLR_UINT32 tkNanoCLR, CLR_UINT32 &tkCLR) const
+{
+    if (m_header == NULL)
+        return false;
+
+    const NanoPdbxBinaryToken *end = m_tokensByNanoCLR + m_header->numberOfTokens;
+    const NanoPdbxBinaryToken *it = std::lower_bound(m_tokensByNanoCLR, end, tkNanoCLR, local_CompareNanoCLR);
+
+    if (it == end || it->tokenNanoCLR != tkNanoCLR)
+        return false;
+
+    tkCLR = it->tokenCLR;
+
+    return true;
+}
+
+bool WatchAssemblyBuilder::PdbxBinaryReader::TokenToNanoCLR(CLR_UINT32 tkCLR, CLR_UINT32 &tkNanoCLR) const
+{
+    if (m_header == NULL)
+        return false;
+
+    const NanoPdbxBinaryToken *end = m_tokensByCLR + m_header->numberOfTokens;
+    const NanoPdbxBinaryToken *it = std::lower_bound(m_tokensByCLR, end, tkCLR, local_CompareCLR);
+
+    if (it == end || it->tokenCLR != tkCLR)
+        return false;
+
+    tkNanoCLR = it->tokenNanoCLR;
+
+    return true;
+}
+
+//
+// Before the first entry of the map the two offsets are the same, after each entry they differ by the distance
+// recorded in that entry.
+//
+bool WatchAssemblyBuilder::PdbxBinaryReader::IPToCLR(
+    CLR_UINT32 tkMethodNanoCLR,
+    CLR_UINT32 ipNanoCLR,
+    CLR_UINT32 &ipCLR) const
+{
+    const NanoPdbxBinaryMethod *md = FindMethod(tkMethodNanoCLR);
+
+    if (md == NULL)
+        return false;
+
+    const NanoPdbxBinaryIL *begin = m_ilEntries + md->firstILEntry;
+    const NanoPdbxBinaryIL *end = begin + md->numberOfILEntries;
+    const NanoPdbxBinaryIL *it = std::upper_bound(begin, end, ipNanoCLR, local_CompareIPNanoCLR);
+
+    if (it == begin)
+    {
+        ipCLR = ipNanoCLR;
+    }
+    else
+    {
+        it--;
+
+        ipCLR = it->ipCLR + (ipNanoCLR - it->ipNanoCLR);
+    }
+
+    return true;
+}
+
+bool WatchAssemblyBuilder::PdbxBinaryReader::IPToNanoCLR(
+    CLR_UINT32 tkMethodCLR,
+    CLR_UINT32 ipCLR,
+    CLR_UINT32 &ipNanoCLR) const
+{
+    CLR_UINT32 tkMethodNanoCLR;
+    const NanoPdbxBinaryMethod *md;
+
+    if (TokenToNanoCLR(tkMethodCLR, tkMethodNanoCLR) == false)
+        return false;
+
+    md = FindMethod(tkMethodNanoCLR);
+    if (md == NULL)
+        return false;
+
+    const NanoPdbxBinaryIL *begin = m_ilEntries + md->firstILEntry;
+    const NanoPdbxBinaryIL *end = begin + md->numberOfILEntries;
+    const NanoPdbxBinaryIL *it = std::upper_bound(begin, end, ipCLR, local_CompareIPCLR);
+
+    if (it == begin)
+    {
+        ipNanoCLR = ipCLR;
+    }
+    else
+    {
+        it--;
+
+        ipNanoCLR = it->ipNanoCLR + (ipCLR - it->ipCLR);
+    }
+
+    return true;
+}
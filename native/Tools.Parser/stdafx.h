@@ -12,7 +12,11 @@
 
 #include <AssemblyParser.h>
 #include "WatchAssemblyBuilder.h"
+#include "AssemblyReparser.h"
 
+#include <algorithm>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <WinBase.h>